@@ -0,0 +1,504 @@
+/* Decodes the binary crash reports (Backtrace::CRASH_REPORT_BINARY) and
+ * symbolizes their stacks with addr2line, using the build-ids to check that
+ * the modules on disk are the ones that crashed.
+ *
+ * Usage: crash_reader [--no-symbols] <report>
+ */
+
+#include "CrashReportFormat.h"
+
+#include <cxxabi.h>
+#include <elf.h>
+#include <link.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+	struct Module {
+		CrashReport::ModuleRecord record;
+		string buildId;
+		string path;
+	};
+
+	struct Thread {
+		CrashReport::ThreadRecord record;
+		vector<uint64_t> addrs;
+	};
+
+	struct Breadcrumb {
+		CrashReport::BreadcrumbRecord record;
+		string text;
+		vector<uint64_t> frames;
+	};
+
+	struct LogLine {
+		CrashReport::LogLineRecord record;
+		string text;
+	};
+
+	struct Report {
+		bool hasSignal;
+		CrashReport::SignalRecord signal;
+		CrashReport::RegistersRecord registers;
+		vector<uint64_t> registerValues;
+		vector<Module> modules;
+		vector<Thread> threads;
+		vector<Breadcrumb> breadcrumbs;
+		vector<LogLine> logLines;
+		bool complete;
+
+		Report() : hasSignal(false), complete(false) {
+			registers.machine = 0;
+			registers.count = 0;
+		}
+	};
+
+	// Le o payload de um registro, os bytes depois da struct ficam em extra
+	template <class T>
+	bool readPayload(const string& payload, T* value, string* extra)
+	{
+		if (payload.size() < sizeof(T)) {
+			return false;
+		}
+		memcpy(value, payload.data(), sizeof(T));
+		extra->assign(payload, sizeof(T), string::npos);
+		return true;
+	}
+
+	vector<uint64_t> readAddresses(const string& data, uint32_t count)
+	{
+		vector<uint64_t> values(min<size_t>(count, data.size() / sizeof(uint64_t)));
+		if (!values.empty()) {
+			memcpy(&values[0], data.data(), values.size()*sizeof(uint64_t));
+		}
+		return values;
+	}
+
+	bool readReport(const char* fileName, Report* report)
+	{
+		ifstream in(fileName, ios::binary);
+		if (!in) {
+			fprintf(stderr, "Can't open %s\n", fileName);
+			return false;
+		}
+		CrashReport::Header header;
+		if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != CrashReport::MAGIC) {
+			if (in && header.magic == __builtin_bswap32(CrashReport::MAGIC)) {
+				fprintf(stderr, "%s was written by a machine with a different byte order\n", fileName);
+			} else {
+				fprintf(stderr, "%s is not a crash report\n", fileName);
+			}
+			return false;
+		}
+		if (header.version != CrashReport::VERSION) {
+			fprintf(stderr, "Unsupported version %u of the crash report\n", header.version);
+			return false;
+		}
+
+		CrashReport::RecordHeader record;
+		while (in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+			string payload(record.size, '\0');
+			if (record.size > 0 && !in.read(&payload[0], record.size)) {
+				break;
+			}
+			string extra;
+			switch (record.type) {
+				case CrashReport::RECORD_SIGNAL:
+					report->hasSignal = readPayload(payload, &report->signal, &extra);
+					break;
+				case CrashReport::RECORD_REGISTERS:
+					if (readPayload(payload, &report->registers, &extra)) {
+						report->registerValues = readAddresses(extra, report->registers.count);
+					}
+					break;
+				case CrashReport::RECORD_MODULE:
+				{
+					Module module;
+					if (readPayload(payload, &module.record, &extra)
+							&& extra.size() >= module.record.buildIdSize + module.record.pathSize) {
+						module.buildId = extra.substr(0, module.record.buildIdSize);
+						module.path = extra.substr(module.record.buildIdSize, module.record.pathSize);
+						report->modules.push_back(module);
+					}
+					break;
+				}
+				case CrashReport::RECORD_THREAD:
+				{
+					Thread thread;
+					if (readPayload(payload, &thread.record, &extra)) {
+						thread.addrs = readAddresses(extra, thread.record.count);
+						report->threads.push_back(thread);
+					}
+					break;
+				}
+				case CrashReport::RECORD_BREADCRUMB:
+				{
+					Breadcrumb breadcrumb;
+					if (readPayload(payload, &breadcrumb.record, &extra)) {
+						breadcrumb.text = extra.substr(0, breadcrumb.record.textSize);
+						if (extra.size() > breadcrumb.record.textSize) {
+							breadcrumb.frames = readAddresses(extra.substr(breadcrumb.record.textSize), breadcrumb.record.frameCount);
+						}
+						report->breadcrumbs.push_back(breadcrumb);
+					}
+					break;
+				}
+				case CrashReport::RECORD_LOG_LINE:
+				{
+					LogLine line;
+					if (readPayload(payload, &line.record, &extra)) {
+						line.text = extra.substr(0, line.record.textSize);
+						report->logLines.push_back(line);
+					}
+					break;
+				}
+				case CrashReport::RECORD_END:
+					report->complete = true;
+					break;
+				default:
+					// registro de uma versao mais nova
+					break;
+			}
+		}
+		return true;
+	}
+
+	string hex(const string& bytes)
+	{
+		string result;
+		char digits[3];
+		for (size_t i = 0; i < bytes.size(); ++i) {
+			snprintf(digits, sizeof(digits), "%02x", static_cast<unsigned char>(bytes[i]));
+			result += digits;
+		}
+		return result;
+	}
+
+	// Build-id do arquivo em disco, lido das notas dos program headers
+	string fileBuildId(const string& path)
+	{
+		ifstream in(path.c_str(), ios::binary);
+		ElfW(Ehdr) ehdr;
+		if (!in.read(reinterpret_cast<char*>(&ehdr), sizeof(ehdr)) || memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0
+				|| ehdr.e_phentsize != sizeof(ElfW(Phdr))) {
+			return string();
+		}
+		for (int i = 0; i < ehdr.e_phnum; ++i) {
+			ElfW(Phdr) phdr;
+			in.seekg(ehdr.e_phoff + i*sizeof(phdr));
+			if (!in.read(reinterpret_cast<char*>(&phdr), sizeof(phdr))) {
+				return string();
+			}
+			if (phdr.p_type != PT_NOTE) {
+				continue;
+			}
+			string notes(phdr.p_filesz, '\0');
+			in.seekg(phdr.p_offset);
+			if (notes.empty() || !in.read(&notes[0], notes.size())) {
+				continue;
+			}
+			size_t pos = 0;
+			while (pos + sizeof(ElfW(Nhdr)) <= notes.size()) {
+				ElfW(Nhdr) nhdr;
+				memcpy(&nhdr, notes.data() + pos, sizeof(nhdr));
+				const size_t name = pos + sizeof(nhdr);
+				const size_t desc = name + ((nhdr.n_namesz + 3) & ~3u);
+				if (desc + nhdr.n_descsz > notes.size()) {
+					break;
+				}
+				if (nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_namesz == 4 && notes.compare(name, 4, string("GNU\0", 4)) == 0) {
+					return notes.substr(desc, nhdr.n_descsz);
+				}
+				pos = desc + ((nhdr.n_descsz + 3) & ~3u);
+			}
+		}
+		return string();
+	}
+
+	const Module* findModule(const Report& report, uint64_t addr)
+	{
+		for (size_t i = 0; i < report.modules.size(); ++i) {
+			const Module& module = report.modules[i];
+			if (addr >= module.record.start && addr < module.record.end) {
+				return &module;
+			}
+		}
+		return NULL;
+	}
+
+	// FNV-1a de cada byte do valor
+	void mixHash(uint64_t& hash, uint64_t value, size_t bytes)
+	{
+		for (size_t b = 0; b < bytes; ++b) {
+			hash ^= (value >> (8*b)) & 0xff;
+			hash *= 1099511628211ULL;
+		}
+	}
+
+	// O mesmo que Backtrace::fingerprint(): o hash do nome do arquivo de cada
+	// modulo e os offsets dos enderecos nele. O modulo e o de addr-1, o
+	// endereco de retorno pode estar logo depois do fim dele.
+	uint64_t fingerprint(const Report& report, const vector<uint64_t>& addrs)
+	{
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < addrs.size(); ++i) {
+			const Module* module = addrs[i] != 0 ? findModule(report, addrs[i] - 1) : NULL;
+			uint64_t moduleHash = 0;
+			uint64_t offset = addrs[i];
+			if (module) {
+				const size_t slash = module->path.rfind('/');
+				const string name = (slash == string::npos) ? module->path : module->path.substr(slash + 1);
+				moduleHash = 14695981039346656037ULL;
+				for (size_t c = 0; c < name.size(); ++c) {
+					mixHash(moduleHash, static_cast<unsigned char>(name[c]), 1);
+				}
+				offset -= module->record.loadBias;
+			}
+			mixHash(hash, moduleHash, 8);
+			mixHash(hash, offset, 8);
+		}
+		return hash;
+	}
+
+	// Resolve os enderecos de um modulo de uma vez so, "funcao em arquivo:linha"
+	// por offset. Com -i o addr2line escreve as funcoes inline antes da que as
+	// contem, por isso cada pergunta e seguida de um endereco invalido (0) que
+	// marca o fim da resposta.
+	map<uint64_t, string> symbolize(const string& path, const vector<uint64_t>& offsets)
+	{
+		map<uint64_t, string> names;
+		char file[] = "/tmp/crash_reader_XXXXXX";
+		const int fd = mkstemp(file);
+		if (fd < 0) {
+			return names;
+		}
+		FILE* input = fdopen(fd, "w");
+		for (size_t i = 0; i < offsets.size(); ++i) {
+			fprintf(input, "0x%llx\n0\n", static_cast<unsigned long long>(offsets[i]));
+		}
+		fclose(input);
+
+		const string command = "addr2line -Cfie '" + path + "' < " + file + " 2>/dev/null";
+		FILE* output = popen(command.c_str(), "r");
+		if (output != NULL) {
+			size_t current = 0;
+			string text;
+			char function[4096];
+			char location[4096];
+			while (current < offsets.size() && fgets(function, sizeof(function), output) && fgets(location, sizeof(location), output)) {
+				function[strcspn(function, "\n")] = '\0';
+				location[strcspn(location, "\n")] = '\0';
+				if (strcmp(function, "??") == 0 && strncmp(location, "??:0", 4) == 0 && !text.empty()) {
+					// fim da resposta de um endereco
+					names[offsets[current++]] = text;
+					text.clear();
+					continue;
+				}
+				if (!text.empty()) {
+					text += " inlined in ";
+				}
+				text += function;
+				if (strncmp(location, "??", 2) != 0) {
+					text += string(" at ") + location;
+				}
+			}
+			pclose(output);
+		}
+		unlink(file);
+		return names;
+	}
+
+	const char* signalName(int signo)
+	{
+		switch (signo) {
+			case SIGSEGV: return "SIGSEGV";
+			case SIGBUS: return "SIGBUS";
+			case SIGILL: return "SIGILL";
+			case SIGFPE: return "SIGFPE";
+			case SIGABRT: return "SIGABRT";
+			default: return "signal";
+		}
+	}
+
+	string registerName(uint32_t machine, size_t index)
+	{
+		static const char* const x86_64[] = {
+			"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rdi", "rsi", "rbp", "rbx",
+			"rdx", "rax", "rcx", "rsp", "rip", "eflags", "csgsfs", "err", "trapno", "oldmask", "cr2"
+		};
+		static const char* const i386[] = {
+			"gs", "fs", "es", "ds", "edi", "esi", "ebp", "esp", "ebx", "edx", "ecx", "eax",
+			"trapno", "err", "eip", "cs", "eflags", "uesp", "ss"
+		};
+		if (machine == EM_X86_64 && index < sizeof(x86_64)/sizeof(x86_64[0])) {
+			return x86_64[index];
+		}
+		if (machine == EM_386 && index < sizeof(i386)/sizeof(i386[0])) {
+			return i386[index];
+		}
+		stringstream ss;
+		if (machine == EM_AARCH64) {
+			static const char* const special[] = { "sp", "pc", "pstate" };
+			if (index < 31) {
+				ss << "x" << index;
+			} else if (index < 34) {
+				ss << special[index - 31];
+			}
+			return ss.str();
+		}
+		ss << "r" << index;
+		return ss.str();
+	}
+
+	void printReport(const Report& report, bool loadSymbols)
+	{
+		if (report.hasSignal) {
+			const CrashReport::SignalRecord& signal = report.signal;
+			char date[64] = "";
+			const time_t when = static_cast<time_t>(signal.time);
+			strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S UTC", gmtime(&when));
+			printf("Crash: %s (%d, code %d) at 0x%llx, pid %d, thread %d, %s\n",
+				signalName(signal.signo), signal.signo, signal.code,
+				static_cast<unsigned long long>(signal.address), signal.pid, signal.tid, date);
+		}
+		if (!report.complete) {
+			printf("The report is incomplete, the process was killed while writing it\n");
+		}
+
+		if (!report.registerValues.empty()) {
+			printf("\nRegisters:\n");
+			for (size_t i = 0; i < report.registerValues.size(); ++i) {
+				printf("  %-8s 0x%016llx%s", registerName(report.registers.machine, i).c_str(),
+					static_cast<unsigned long long>(report.registerValues[i]), (i % 3 == 2) ? "\n" : "");
+			}
+			if (report.registerValues.size() % 3 != 0) {
+				printf("\n");
+			}
+		}
+
+		printf("\nModules:\n");
+		for (size_t i = 0; i < report.modules.size(); ++i) {
+			const Module& module = report.modules[i];
+			printf("  0x%llx-0x%llx %s %s\n", static_cast<unsigned long long>(module.record.start),
+				static_cast<unsigned long long>(module.record.end),
+				module.buildId.empty() ? "-" : hex(module.buildId).c_str(), module.path.c_str());
+		}
+
+		// offsets de cada modulo, para chamar o addr2line uma vez por modulo
+		map<const Module*, vector<uint64_t> > offsets;
+		for (size_t t = 0; t < report.threads.size(); ++t) {
+			const vector<uint64_t>& addrs = report.threads[t].addrs;
+			for (size_t i = 0; i < addrs.size(); ++i) {
+				// os enderecos de retorno apontam para depois da chamada
+				const uint64_t pc = (i == 0) ? addrs[i] : addrs[i] - 1;
+				const Module* module = findModule(report, pc);
+				if (module) {
+					offsets[module].push_back(pc - module->record.loadBias);
+				}
+			}
+		}
+		map<const Module*, map<uint64_t, string> > names;
+		if (loadSymbols) {
+			for (map<const Module*, vector<uint64_t> >::const_iterator it = offsets.begin(); it != offsets.end(); ++it) {
+				const Module& module = *it->first;
+				if (module.path.empty() || module.path[0] != '/') {
+					continue;
+				}
+				const string onDisk = fileBuildId(module.path);
+				if (!module.buildId.empty() && onDisk != module.buildId) {
+					printf("Warning: %s on disk doesn't match the build-id of the report, not symbolized\n", module.path.c_str());
+					continue;
+				}
+				names[&module] = symbolize(module.path, it->second);
+			}
+		}
+
+		if (!report.breadcrumbs.empty()) {
+			printf("\nBreadcrumbs of the crashed thread:\n");
+		}
+		for (size_t i = 0; i < report.breadcrumbs.size(); ++i) {
+			const Breadcrumb& breadcrumb = report.breadcrumbs[i];
+			printf("  %u: ", breadcrumb.record.sequence);
+			// Breadcrumbs::LOG
+			if (breadcrumb.record.kind == 1) {
+				printf("log level %u %s\n", breadcrumb.record.level, breadcrumb.text.c_str());
+			} else {
+				int status = 0;
+				char* type = abi::__cxa_demangle(breadcrumb.text.c_str(), NULL, NULL, &status);
+				// as versoes anteriores gravavam o fingerprint, sem os frames
+				const uint64_t hash = breadcrumb.frames.empty() ? breadcrumb.record.fingerprint : fingerprint(report, breadcrumb.frames);
+				printf("throw %s at 0x%llx, fingerprint %016llx\n", type ? type : breadcrumb.text.c_str(),
+					static_cast<unsigned long long>(breadcrumb.record.site), static_cast<unsigned long long>(hash));
+				free(type);
+			}
+		}
+
+		if (!report.logLines.empty()) {
+			printf("\nLast log lines:\n");
+		}
+		for (size_t i = 0; i < report.logLines.size(); ++i) {
+			const LogLine& line = report.logLines[i];
+			printf("  %u: thread %d level %u %s\n", line.record.sequence, line.record.tid, line.record.level, line.text.c_str());
+		}
+
+		for (size_t t = 0; t < report.threads.size(); ++t) {
+			const Thread& thread = report.threads[t];
+			printf("\nThread %d%s:\n", thread.record.tid, thread.record.crashed ? " (crashed)" : "");
+			for (size_t i = 0; i < thread.addrs.size(); ++i) {
+				const uint64_t pc = (i == 0) ? thread.addrs[i] : thread.addrs[i] - 1;
+				printf("  #%-2d 0x%016llx", static_cast<int>(i), static_cast<unsigned long long>(thread.addrs[i]));
+				const Module* module = findModule(report, pc);
+				if (module == NULL) {
+					printf("\n");
+					continue;
+				}
+				const uint64_t offset = pc - module->record.loadBias;
+				const char* base = strrchr(module->path.c_str(), '/');
+				printf(" %s+0x%llx", base ? base + 1 : module->path.c_str(), static_cast<unsigned long long>(offset));
+				const map<uint64_t, string>& moduleNames = names[module];
+				map<uint64_t, string>::const_iterator name = moduleNames.find(offset);
+				if (name != moduleNames.end()) {
+					printf("  %s", name->second.c_str());
+				}
+				printf("\n");
+			}
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	bool loadSymbols = true;
+	const char* fileName = NULL;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--no-symbols") == 0) {
+			loadSymbols = false;
+		} else {
+			fileName = argv[i];
+		}
+	}
+	if (fileName == NULL) {
+		fprintf(stderr, "Usage: %s [--no-symbols] <report>\n", argv[0]);
+		return 2;
+	}
+
+	Report report;
+	if (!readReport(fileName, &report)) {
+		return 1;
+	}
+	printReport(report, loadSymbols);
+	return 0;
+}
@@ -26,6 +26,9 @@ HEADERS += \
         $$SRC/svector.h \
         $$SRC/SymbolCache.h \
         $$SRC/VectorIO.h \
+        $$SRC/Watchdog.h \
+        $$SRC/Breadcrumbs.h \
+        $$SRC/CrashReportFormat.h \
         $$SRC/MapUtils.h \
         $$SRC/VectorOf.h \
         $$SRC/ArrayPtr.h \
@@ -46,6 +49,8 @@ SOURCES += \
         $$SRC/string_format.cpp \
         $$SRC/SymbolCache.cpp \
         $$SRC/VectorIO.cpp \
+        $$SRC/Watchdog.cpp \
+        $$SRC/Breadcrumbs.cpp \
 
 
 win32 {
@@ -71,16 +76,27 @@ unix {
                         $$SRC/default/DebugSymbolLoader.cpp \
 
 	} else {
+		# o unwinder de frame pointer precisa percorrer os nossos frames
+		QMAKE_CXXFLAGS += -fno-omit-frame-pointer
+
 		SOURCES += \
 			$$SRC/linux/BackTrace.cpp \
                         $$SRC/linux/StackLoader.cpp \
+                        $$SRC/linux/CfiStackLoader.cpp \
+                        $$SRC/linux/Modules.cpp \
+                        $$SRC/linux/CrashReport.cpp \
+                        $$SRC/linux/ElfFile.cpp \
+                        $$SRC/linux/SymbolTable.cpp \
 
                 bfd {
                         SOURCES += \
                             $$SRC/bfd/DebugSymbolLoader.cpp
-                } else {
+                } else:addr2line {
                         SOURCES += \
                             $$SRC/linux/DebugSymbolLoader.cpp
+                } else {
+                        SOURCES += \
+                            $$SRC/linux/DwarfSymbolLoader.cpp
                 }
 	}
 }
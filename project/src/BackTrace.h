@@ -10,6 +10,14 @@
 #include <vector>
 #include <stdint.h>
 
+#ifdef USE_CXX11
+	#include <atomic>
+	#include <mutex>
+#elif defined USE_QT
+	#include <QAtomicInt>
+	#include <QMutex>
+#endif
+
 namespace Backtrace {
 
 	struct StackFrame {
@@ -21,10 +29,24 @@ namespace Backtrace {
 		StackFrame() : addr(0), function(""), line(-1), sourceFile(""), imageFile("") {}
 	};
 
+	// The form in which the traces keep their frames: the address, where it
+	// was in the code when captured (see moduleAddresses()) and the id of its
+	// entry in the symbol table, 0 while the names weren't loaded.
+	struct CompactFrame {
+		void* addr;
+		uint64_t module;
+		uintptr_t offset;
+		uint32_t symbol;
+	};
+
+	/* A trace may be shared between exceptions thrown in several threads (see
+	 * internedTrace), the names are loaded only once under the lock of the
+	 * trace and the frames aren't modified after that.
+	 */
 	class StackTrace {
 	public:
 
-		StackTrace() : m_debugSmbolsLoaded(false), m_referenceCount(1) {}
+		StackTrace() : m_namesLoaded(false), m_debugSmbolsLoaded(false), m_interned(false), m_hash(0), m_fingerprint(0), m_pool(NULL), m_referenceCount(1), m_hits(1) {}
 
 		~StackTrace() {}
 
@@ -36,20 +58,170 @@ namespace Backtrace {
 
 		void loadDebug();
 
-		std::vector<StackFrame>& getFrames() { return m_frames; }
+		// The function and module names are loaded on the first call, the
+		// StackFrames are built from the symbol table at this point
+		std::vector<StackFrame>& getFrames();
+
+		// The frames as they were captured. They must not be modified if the
+		// trace was interned.
+		std::vector<CompactFrame>& rawFrames() { return m_compact; }
+
+		// Hash of the frames that doesn't change with ASLR or between runs
+		// of the same binaries, see Backtrace::fingerprint(). It's computed
+		// when the trace is captured, while its modules are still loaded.
+		uint64_t fingerprint() const { return m_fingerprint; }
+
+		// How many times this stack was captured, more than one only for
+		// interned traces
+		unsigned hits() const;
 
 		void increaseCount();
 
+		// When the count drops to zero the trace goes back to the pool of the
+		// calling thread, so it must not be deleted directly.
 		void decreaseCount();
 
+		// Prepares a pooled trace to be used again
+		void reset();
+
 	private:
+		friend class InternTable;
+		friend class StackTracePool;
+		friend StackTrace* trace(void* const* addrs, int n);
+
+		StackTrace(const StackTrace&);
+		StackTrace& operator=(const StackTrace&);
+
+		// chamado com o lock
+		void loadNames();
+
+		bool m_namesLoaded;
 		bool m_debugSmbolsLoaded;
-		int m_referenceCount;
+		bool m_interned;
+		uint64_t m_hash;
+		uint64_t m_fingerprint;
+		// pool da thread que capturou, so ela reaproveita o trace
+		const void* m_pool;
+#ifdef USE_CXX11
+		std::atomic<int> m_referenceCount;
+		std::atomic<unsigned> m_hits;
+		std::mutex m_lock;
+#elif defined USE_QT
+		QAtomicInt m_referenceCount;
+		QAtomicInt m_hits;
+		QMutex m_lock;
+#endif
+		std::vector<CompactFrame> m_compact;
+		// vazio ate os nomes serem carregados
 		std::vector<StackFrame> m_frames;
+		// copia de m_frames com a informacao de debug
+		std::vector<StackFrame> m_debugFrames;
 	};
 
 	void initialize(const char* argv0);
-	StackTrace* trace();
+
+	/* Loads the per thread state used by the stack loaders, like the bounds
+	 * of the stack, so that getStackAddresses() is complete when called from
+	 * a signal handler. On linux it also registers an alternate signal
+	 * stack, so a stack overflow in the thread is reported instead of
+	 * killing the process silently. initialize() does it for the calling
+	 * thread, normally the main one. The other threads are initialized on
+	 * their first trace or exception, which may be too late: a thread that
+	 * overflows its stack before that dies without a report, so threads
+	 * should call this when they start. Calling it again does nothing.
+	 */
+	void initializeThread();
+
+	// Captures the stack of the calling function, at most depth frames
+	// (limited to MAX_STACK_DEPTH). The first skip frames, or SKIP_LIBRARY,
+	// are dropped by the stack loader and don't count in the depth.
+	StackTrace* trace(int depth = 32, int skip = 0);
+
+	// Like trace(), but identical stacks share the same immutable trace,
+	// whose hit count is incremented. The symbols of a hot throw site are
+	// then loaded only once.
+	StackTrace* internedTrace(int depth, int skip);
+
+	// Interns a stack that was already captured
+	StackTrace* internedTrace(void* const* addrs, int n);
+
+	// A trace from a stack that was already captured
+	StackTrace* trace(void* const* addrs, int n);
+
+	/* A 64 bit hash of the stack to group traces without loading symbols or
+	 * comparing strings. It is computed from the offsets of the addresses in
+	 * their modules and from the names of the modules, so it's the same in
+	 * every run of the same binaries, wherever they were loaded.
+	 */
+	uint64_t fingerprint(void* const* addrs, int n);
+
+	struct ThreadStack {
+		int threadId;
+		// NULL if the thread didn't answer in time
+		StackTrace* trace;
+	};
+
+	/* Captures the stacks of all the threads of the process, to diagnose
+	 * stalls without a debugger. Each thread is signaled to record only the
+	 * addresses of its own stack, the names are loaded after all of them went
+	 * back to work. The caller must call decreaseCount() on the traces.
+	 *
+	 * On linux the signal (SIGRTMIN+3, see setSnapshotSignal()) interrupts
+	 * blocking calls of the other threads, so calls that aren't restarted,
+	 * like poll() or sleep(), may return EINTR or earlier. Threads that block
+	 * the signal are listed with a NULL trace. On windows and the other
+	 * platforms only the calling thread is listed and captured.
+	 */
+	std::vector<ThreadStack> snapshotAllThreads(int depth = 32);
+
+	// Same as above for a single thread, NULL if it didn't answer. Outside
+	// linux it's always NULL for a thread other than the calling one.
+	StackTrace* snapshotThread(int threadId, int depth = 32);
+
+	// The id of the calling thread, as used by the snapshots
+	int currentThreadId();
+
+	/* Changes the signal sent to the other threads by the snapshots and the
+	 * binary crash report, 0 disables it. The handler is installed by the
+	 * first snapshot, and only if the signal still has its default action:
+	 * a handler installed by the program for it is kept, and the snapshots
+	 * then list the other threads with a NULL trace. Call it before the
+	 * first snapshot if the program uses SIGRTMIN+3. Only used on linux.
+	 */
+	void setSnapshotSignal(int signum);
+
+	/* Makes the handlers installed by initialize() write a crash report to
+	 * fd and kill the process with the signal, instead of throwing an
+	 * exception from the handler. The report is written with write(2) only:
+	 * the signal, the faulting address, the thread and the raw addresses of
+	 * the stack, followed by the memory map of the process for offline
+	 * symbolization. With symbolize, a child forked from the handler appends
+	 * the names and source lines while the process itself dies right away,
+	 * so symbolizing doesn't delay a restart. The child gives up after 3 s,
+	 * in case the crash left a lock it needs held. fd must stay open. Only
+	 * linux writes the report, elsewhere it does nothing. While the
+	 * breadcrumbs are enabled (see Breadcrumbs.h) the report also has the
+	 * events of the crashed thread and the last lines written by the loggers.
+	 *
+	 * The binary format (see CrashReportFormat.h) also has the registers,
+	 * the build-id of each module and the stacks of up to 64 other threads,
+	 * which are signaled like in snapshotAllThreads(). It is decoded and
+	 * symbolized later by the crash_reader tool, symbolize is ignored.
+	 */
+	enum CrashReportFormat {
+		CRASH_REPORT_TEXT = 0,
+		CRASH_REPORT_BINARY
+	};
+
+	void enableCrashReport(int fd, bool symbolize = true, CrashReportFormat format = CRASH_REPORT_TEXT);
+
+	/* Writes message and the stack of the calling thread to fd without
+	 * allocating: only the addresses and, on linux, the exported names from
+	 * backtrace_symbols_fd(). It's the last resort of the fatal error paths
+	 * when the logger fails, usually for lack of memory.
+	 */
+	void writeEmergencyReport(int fd, const char* message);
+
 	bool backtraceSupported();
 
 }
@@ -1,33 +1,398 @@
 #include "BackTrace.h"
 #include "DebugSymbolLoader.h"
 #include "StackAddressLoader.h"
+#include "SymbolCache.h"
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <sstream>
+
+#ifdef USE_QT
+	#include <QThreadStorage>
+#endif
 // This file contains the platform independent parts of Backtrace.h's implementation
 
+namespace Backtrace {
+
+	/* Traces released by the thread that captured them, kept with the
+	 * capacity of their frame vectors so that the next trace() doesn't touch
+	 * the heap. A trace released by another thread is deleted: each pool only
+	 * gets back its own traces, so a thread that releases traces captured
+	 * elsewhere doesn't fill its pool with them.
+	 */
+	class StackTracePool {
+	public:
+		// criado no primeiro trace da thread
+		StackTracePool() : m_size(0), m_closed(false) {
+			Backtrace::initializeThread();
+		}
+
+		~StackTracePool() {
+			m_closed = true;
+			for (int i = 0; i < m_size; ++i) {
+				delete m_free[i];
+			}
+			m_size = 0;
+		}
+
+		StackTrace* acquire() {
+			StackTrace* trace;
+			if (m_size == 0) {
+				trace = new StackTrace();
+			} else {
+				trace = m_free[--m_size];
+				trace->reset();
+			}
+			trace->m_pool = m_closed ? NULL : this;
+			return trace;
+		}
+
+		// Returns false if the trace must be deleted
+		bool release(StackTrace* trace) {
+			if (m_closed || trace->m_pool != this || m_size == POOL_SIZE) {
+				return false;
+			}
+			m_free[m_size++] = trace;
+			return true;
+		}
+
+	private:
+		static const int POOL_SIZE = 16;
+
+		StackTrace* m_free[POOL_SIZE];
+		int m_size;
+		// a thread esta terminando
+		bool m_closed;
+	};
+}
+
+namespace {
+	using Backtrace::StackTrace;
+	using Backtrace::StackTracePool;
+
+#ifdef USE_CXX11
+	StackTracePool& localPool()
+	{
+		thread_local StackTracePool pool;
+		return pool;
+	}
+#elif defined USE_QT
+	StackTracePool& localPool()
+	{
+		static QThreadStorage<StackTracePool*> pools;
+		if (!pools.hasLocalData()) {
+			pools.setLocalData(new StackTracePool());
+		}
+		return *pools.localData();
+	}
+#endif
+
+#ifdef USE_CXX11
+	typedef std::mutex lock_t;
+	struct Locker {
+		std::lock_guard<lock_t> guard;
+		Locker(lock_t* l) : guard(*l) {}
+	};
+	typedef Locker locker_t;
+
+	// retornam o valor novo
+	inline int increment(std::atomic<int>& v) { return ++v; }
+	inline int decrement(std::atomic<int>& v) { return --v; }
+	inline unsigned increment(std::atomic<unsigned>& v) { return ++v; }
+#elif defined USE_QT
+	typedef QMutex lock_t;
+	typedef QMutexLocker locker_t;
+
+	inline int increment(QAtomicInt& v) { return v.fetchAndAddOrdered(1) + 1; }
+	inline int decrement(QAtomicInt& v) { return v.fetchAndAddOrdered(-1) - 1; }
+#endif
+
+	// FNV-1a sobre os enderecos
+	const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+
+	// FNV-1a de cada byte do valor
+	void mixHash(uint64_t& hash, uint64_t value, size_t bytes)
+	{
+		for (size_t b = 0; b < bytes; ++b) {
+			hash ^= (value >> (8*b)) & 0xff;
+			hash *= 1099511628211ULL;
+		}
+	}
+
+	uint64_t hashFrames(void* const* addrs, int n)
+	{
+		uint64_t hash = FNV_OFFSET;
+		for (int i = 0; i < n; ++i) {
+			mixHash(hash, reinterpret_cast<uintptr_t>(addrs[i]), sizeof(void*));
+		}
+		return hash;
+	}
+
+	// O hash de Backtrace::fingerprint(), sempre 8 bytes por valor para ser o
+	// mesmo em 32 e 64 bits
+	uint64_t hashModuleOffsets(const uintptr_t* offsets, const uint64_t* names, int n)
+	{
+		uint64_t hash = FNV_OFFSET;
+		for (int i = 0; i < n; ++i) {
+			mixHash(hash, names[i], 8);
+			mixHash(hash, offsets[i], 8);
+		}
+		return hash;
+	}
+
+	void setFrames(std::vector<Backtrace::CompactFrame>& frames, void* const* addrs, const uintptr_t* offsets, const uint64_t* modules, int n)
+	{
+		frames.resize(n);
+		for (int i = 0; i < n; ++i) {
+			frames[i].addr = addrs[i];
+			frames[i].module = modules[i];
+			frames[i].offset = offsets[i];
+			frames[i].symbol = 0;
+		}
+	}
+
+	// Frames cujo modulo foi descarregado depois da captura, o endereco agora
+	// e de outra biblioteca (ou de nenhuma)
+	void findUnloaded(const std::vector<Backtrace::CompactFrame>& frames, bool* unloaded)
+	{
+		const int n = std::min(static_cast<int>(frames.size()), Backtrace::MAX_STACK_DEPTH);
+		void* addrs[Backtrace::MAX_STACK_DEPTH];
+		for (int i = 0; i < n; ++i) {
+			addrs[i] = frames[i].addr;
+		}
+		uintptr_t offsets[Backtrace::MAX_STACK_DEPTH];
+		uint64_t modules[Backtrace::MAX_STACK_DEPTH];
+		Backtrace::moduleAddresses(addrs, n, offsets, modules);
+		for (int i = 0; i < n; ++i) {
+			unloaded[i] = (modules[i] != frames[i].module || offsets[i] != frames[i].offset);
+		}
+	}
+}
+
+namespace Backtrace {
+
+	/* Traces shared by identical stacks. The table is split in shards, each
+	 * one with its own lock, selected by the hash of the addresses. Each
+	 * shard keeps a reference to up to RETAINED_PER_SHARD traces, so the
+	 * stacks of the hot throw sites are symbolized once and keep counting
+	 * hits. When a shard is full, a new trace takes the place of a retained
+	 * one that got no hits since the last new trace of the shard, if there is
+	 * one, so the traces captured once during startup don't keep the hot
+	 * ones out. The traces that aren't retained stay in the table while
+	 * they're referenced, the last decreaseCount() removes them under the
+	 * lock of the shard, so a lookup never finds a trace that is being
+	 * released.
+	 */
+	class InternTable {
+	public:
+		StackTrace* intern(void* const* addrs, int n)
+		{
+			// o mesmo endereco pode ser de outra biblioteca depois de um dlclose
+			uintptr_t offsets[MAX_STACK_DEPTH];
+			uint64_t modules[MAX_STACK_DEPTH];
+			uint64_t names[MAX_STACK_DEPTH];
+			moduleAddresses(addrs, n, offsets, modules, names);
+
+			const uint64_t hash = hashFrames(addrs, n);
+			Shard& shard = m_shards[hash % SHARDS];
+			locker_t locker(&shard.lock);
+
+			typedef Shard::Map::iterator iterator;
+			std::pair<iterator, iterator> range = shard.traces.equal_range(hash);
+			for (iterator it = range.first; it != range.second; ++it) {
+				StackTrace* trace = it->second;
+				if (sameFrames(trace->m_compact, addrs, modules, n)) {
+					increment(trace->m_referenceCount);
+					increment(trace->m_hits);
+					return trace;
+				}
+			}
+
+			StackTrace* trace = localPool().acquire();
+			setFrames(trace->m_compact, addrs, offsets, modules, n);
+			trace->m_interned = true;
+			trace->m_hash = hash;
+			trace->m_fingerprint = hashModuleOffsets(offsets, names, n);
+			shard.traces.insert(std::make_pair(hash, trace));
+			StackTrace* evicted = retain(shard, trace);
+			if (evicted != NULL && !localPool().release(evicted)) {
+				delete evicted;
+			}
+			return trace;
+		}
+
+		// Returns true if it was the last reference
+		bool release(StackTrace* trace)
+		{
+			Shard& shard = m_shards[trace->m_hash % SHARDS];
+			locker_t locker(&shard.lock);
+
+			return releaseLocked(shard, trace);
+		}
+
+		static InternTable& instance()
+		{
+			static InternTable table;
+			return table;
+		}
+
+	private:
+		static const int SHARDS = 16;
+		static const int RETAINED_PER_SHARD = 64;
+
+		struct Retained {
+			StackTrace* trace;
+			// hits quando o ultimo trace novo do shard foi criado
+			unsigned hits;
+		};
+
+		struct Shard {
+			typedef std::multimap<uint64_t, StackTrace*> Map;
+			Map traces;
+			// traces com uma referencia da tabela
+			std::vector<Retained> retained;
+			lock_t lock;
+		};
+
+		// chamado com o lock do shard, true se era a ultima referencia
+		static bool releaseLocked(Shard& shard, StackTrace* trace)
+		{
+			if (decrement(trace->m_referenceCount) > 0) {
+				return false;
+			}
+			typedef Shard::Map::iterator iterator;
+			std::pair<iterator, iterator> range = shard.traces.equal_range(trace->m_hash);
+			for (iterator it = range.first; it != range.second; ++it) {
+				if (it->second == trace) {
+					shard.traces.erase(it);
+					break;
+				}
+			}
+			return true;
+		}
+
+		/* Chamado com o lock do shard para cada trace novo. Com o shard
+		 * cheio, o trace fica no lugar de um retido sem hits desde o ultimo
+		 * trace novo. Retorna o trace que saiu se ele precisa ser liberado.
+		 */
+		static StackTrace* retain(Shard& shard, StackTrace* trace)
+		{
+			if (shard.retained.size() < static_cast<size_t>(RETAINED_PER_SHARD)) {
+				const Retained entry = { trace, 1 };
+				shard.retained.push_back(entry);
+				increment(trace->m_referenceCount);
+				return NULL;
+			}
+			int idle = -1;
+			for (size_t i = 0; i < shard.retained.size(); ++i) {
+				Retained& entry = shard.retained[i];
+				const unsigned hits = entry.trace->hits();
+				if (idle < 0 && hits == entry.hits) {
+					idle = static_cast<int>(i);
+				}
+				entry.hits = hits;
+			}
+			if (idle < 0) {
+				return NULL;
+			}
+			StackTrace* evicted = shard.retained[idle].trace;
+			shard.retained[idle].trace = trace;
+			shard.retained[idle].hits = 1;
+			increment(trace->m_referenceCount);
+			return releaseLocked(shard, evicted) ? evicted : NULL;
+		}
+
+		static bool sameFrames(const std::vector<CompactFrame>& frames, void* const* addrs, const uint64_t* modules, int n)
+		{
+			if (frames.size() != static_cast<size_t>(n)) {
+				return false;
+			}
+			for (int i = 0; i < n; ++i) {
+				if (frames[i].addr != addrs[i] || frames[i].module != modules[i]) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		Shard m_shards[SHARDS];
+	};
+}
+
 
 namespace Backtrace {
 
+	static IStackAddresLoader* currentLoader = NULL;
+
+	IStackAddresLoader& getPlatformStackLoader()
+	{
+		if (currentLoader) {
+			return *currentLoader;
+		}
+		return getDefaultStackLoader();
+	}
+
+	void setStackLoader(IStackAddresLoader* loader)
+	{
+		currentLoader = loader;
+	}
+
+	StackTrace* trace(int depth, int skip)
+	{
+		depth = std::max(1, std::min(depth, MAX_STACK_DEPTH));
+		void* addrs[MAX_STACK_DEPTH];
+		const int num = getPlatformStackLoader().getStackAddresses(depth, addrs, skip);
+		return trace(addrs, num);
+	}
+
+	StackTrace* trace(void* const* addrs, int n)
+	{
+		n = std::max(0, std::min(n, MAX_STACK_DEPTH));
+		uintptr_t offsets[MAX_STACK_DEPTH];
+		uint64_t modules[MAX_STACK_DEPTH];
+		uint64_t names[MAX_STACK_DEPTH];
+		moduleAddresses(addrs, n, offsets, modules, names);
 
+		StackTrace* trace = localPool().acquire();
+		// o vetor reaproveitado ja tem a capacidade, entao nao ha alocacao
+		setFrames(trace->rawFrames(), addrs, offsets, modules, n);
+		trace->m_fingerprint = hashModuleOffsets(offsets, names, n);
+		return trace;
+	}
 
-	StackTrace* trace()
+	StackTrace* internedTrace(int depth, int skip)
 	{
-		const int MAX_STACK = 32;
-		std::auto_ptr<StackTrace> trace(new StackTrace());
-		trace->getFrames().resize(MAX_STACK);
-		const int num = getPlatformStackLoader().getStack(MAX_STACK, &trace->getFrames()[0]);
-		trace->getFrames().resize(num);
+		depth = std::max(1, std::min(depth, MAX_STACK_DEPTH));
+		void* addrs[MAX_STACK_DEPTH];
+		const int num = getPlatformStackLoader().getStackAddresses(depth, addrs, skip);
+		return InternTable::instance().intern(addrs, num);
+	}
 
-		return trace.release();
+	StackTrace* internedTrace(void* const* addrs, int n)
+	{
+		return InternTable::instance().intern(addrs, std::max(0, std::min(n, MAX_STACK_DEPTH)));
 	}
 
 
+	uint64_t fingerprint(void* const* addrs, int n)
+	{
+		n = std::max(0, std::min(n, MAX_STACK_DEPTH));
+		uintptr_t offsets[MAX_STACK_DEPTH];
+		uint64_t names[MAX_STACK_DEPTH];
+		moduleOffsets(addrs, n, offsets, names);
+		return hashModuleOffsets(offsets, names, n);
+	}
+
 	std::string StackTrace::asString(bool loadDebugSyms, int skip)
 	{
 		if (loadDebugSyms && !m_debugSmbolsLoaded) {
 			loadDebug();
 		}
-		return asString(m_frames.size(), &m_frames[0], skip);
+		const std::vector<StackFrame>& frames = getFrames();
+		if (frames.empty()) {
+			return std::string();
+		}
+		return asString(frames.size(), &frames[0], skip);
 	}
 
 	std::string StackTrace::asString(int depth, const StackFrame* frames, int skip)
@@ -45,24 +410,120 @@ namespace Backtrace {
 
 	void StackTrace::loadDebug()
 	{
+		locker_t locker(&m_lock);
 		if (!m_debugSmbolsLoaded) {
+			// the debug symbol loaders may need the module names
+			loadNames();
+			// outras threads podem estar lendo m_frames, entao a informacao
+			// de debug vai para uma copia
+			m_debugFrames = m_frames;
+			if (!m_debugFrames.empty()) {
+				getPlatformDebugSymbolLoader().findDebugInfo(&m_debugFrames[0], m_debugFrames.size());
+				bool unloaded[MAX_STACK_DEPTH];
+				findUnloaded(m_compact, unloaded);
+				for (size_t i = 0; i < m_debugFrames.size(); ++i) {
+					if (unloaded[i]) {
+						m_debugFrames[i] = m_frames[i];
+					}
+				}
+			}
 			m_debugSmbolsLoaded = true;
-			getPlatformDebugSymbolLoader().findDebugInfo(&m_frames[0], m_frames.size());
+		}
+	}
+
+	std::vector<StackFrame>& StackTrace::getFrames()
+	{
+		locker_t locker(&m_lock);
+		loadNames();
+		return m_debugSmbolsLoaded ? m_debugFrames : m_frames;
+	}
+
+	unsigned StackTrace::hits() const
+	{
+		return m_hits;
+	}
+
+	void StackTrace::loadNames()
+	{
+		if (m_namesLoaded) {
+			return;
+		}
+		m_namesLoaded = true;
+		m_frames.resize(m_compact.size());
+		if (m_compact.empty()) {
+			return;
+		}
+
+		typedef BacktracePrivate::SymbolCache SymbolCache;
+		SymbolCache& cache = SymbolCache::instance();
+		bool missing[MAX_STACK_DEPTH];
+		bool anyMissing = false;
+		for (size_t i = 0; i < m_compact.size(); ++i) {
+			CompactFrame& compact = m_compact[i];
+			if (compact.symbol == 0) {
+				// outro trace do mesmo codigo pode ja ter carregado os nomes
+				compact.symbol = cache.find(SymbolCache::Key(compact.module, compact.offset));
+			}
+			m_frames[i] = StackFrame();
+			m_frames[i].addr = compact.addr;
+			missing[i] = !cache.fill(compact.symbol, &m_frames[i], SymbolCache::AddressLoaded);
+			if (missing[i]) {
+				anyMissing = true;
+			}
+		}
+		if (anyMissing) {
+			loadSymbolNames(&m_frames[0], m_frames.size());
+			bool unloaded[MAX_STACK_DEPTH];
+			findUnloaded(m_compact, unloaded);
+			for (size_t i = 0; i < m_compact.size(); ++i) {
+				if (!missing[i]) {
+					continue;
+				}
+				CompactFrame& compact = m_compact[i];
+				// os nomes carregados agora seriam do codigo que esta no endereco
+				SymbolCache::CacheState state = SymbolCache::AddressLoaded;
+				if (unloaded[i]) {
+					m_frames[i] = StackFrame();
+					m_frames[i].addr = compact.addr;
+					state = SymbolCache::NothingLoaded;
+				}
+				compact.symbol = cache.intern(SymbolCache::Key(compact.module, compact.offset), &m_frames[i], state);
+			}
 		}
 	}
 
 
 	void StackTrace::increaseCount()
 	{
-		++m_referenceCount;
+		increment(m_referenceCount);
 	}
 
 	void StackTrace::decreaseCount()
 	{
-		--m_referenceCount;
-		if (m_referenceCount <= 0) {
-			delete this; // o destrutor é virtual
+		if (m_interned) {
+			if (!InternTable::instance().release(this)) {
+				return;
+			}
+		} else if (decrement(m_referenceCount) > 0) {
+			return;
+		}
+		if (!localPool().release(this)) {
+			delete this;
 		}
 	}
 
+	void StackTrace::reset()
+	{
+		m_namesLoaded = false;
+		m_debugSmbolsLoaded = false;
+		m_interned = false;
+		m_hash = 0;
+		m_fingerprint = 0;
+		m_referenceCount = 1;
+		m_hits = 1;
+		m_compact.clear();
+		m_frames.clear();
+		m_debugFrames.clear();
+	}
+
 }
@@ -0,0 +1,280 @@
+#include "Breadcrumbs.h"
+
+#include "BackTrace.h"
+
+#include <algorithm>
+#include <string.h>
+
+#ifdef USE_CXX11
+	#include <atomic>
+#elif defined USE_QT
+	#include <QAtomicInt>
+	#include <QThreadStorage>
+#endif
+
+namespace {
+	using namespace Breadcrumbs;
+
+	// So a propria thread escreve no seu ring, entao nao precisa de lock
+	struct Ring {
+		uint32_t sequence;
+		uint32_t nextLog;
+		uint32_t nextException;
+		Entry logs[LOG_ENTRIES];
+		Entry exceptions[EXCEPTION_ENTRIES];
+
+		Ring() : sequence(0), nextLog(0), nextException(0) {
+			memset(logs, 0, sizeof(logs));
+			memset(exceptions, 0, sizeof(exceptions));
+		}
+	};
+
+	volatile bool recording = false;
+
+#ifdef USE_CXX11
+	// o ponteiro e lido pelo handler de crash, o holder existe para o destrutor
+	thread_local Ring* localRing = NULL;
+
+	struct RingHolder {
+		~RingHolder() {
+			delete localRing;
+			localRing = NULL;
+		}
+	};
+	thread_local RingHolder holder;
+
+	Ring* currentRing()
+	{
+		return localRing;
+	}
+
+	Ring* createRing()
+	{
+		// instancia o holder da thread
+		(void) &holder;
+		localRing = new Ring();
+		return localRing;
+	}
+#elif defined USE_QT
+	QThreadStorage<Ring*> rings;
+
+	Ring* currentRing()
+	{
+		return rings.hasLocalData() ? rings.localData() : NULL;
+	}
+
+	Ring* createRing()
+	{
+		Ring* ring = new Ring();
+		rings.setLocalData(ring);
+		return ring;
+	}
+#endif
+
+	Entry& nextEntry(Entry* ring, uint32_t* next, int size)
+	{
+		Entry& entry = ring[*next];
+		*next = (*next + 1) % size;
+		return entry;
+	}
+
+	void copyText(char* out, const char* text)
+	{
+		size_t i = 0;
+		for (; i < TEXT_SIZE - 1 && text[i] != '\0'; ++i) {
+			out[i] = text[i];
+		}
+		out[i] = '\0';
+	}
+
+	/* As linhas do log sao escritas por todas as threads. Cada linha tem a
+	 * sua sequencia, zerada enquanto o texto e escrito: quem le confere a
+	 * sequencia antes e depois de copiar o texto, como num seqlock.
+	 */
+#ifdef USE_CXX11
+	typedef std::atomic<uint32_t> sequence_t;
+
+	uint32_t nextSequence(sequence_t& s) { return s.fetch_add(1, std::memory_order_relaxed) + 1; }
+	uint32_t lastSequence(sequence_t& s) { return s.load(std::memory_order_relaxed); }
+	void invalidate(sequence_t& s)
+	{
+		s.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+	void publish(sequence_t& s, uint32_t value) { s.store(value, std::memory_order_release); }
+	uint32_t loadSequence(sequence_t& s) { return s.load(std::memory_order_acquire); }
+	// depois de copiar o texto
+	uint32_t recheckSequence(sequence_t& s)
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return s.load(std::memory_order_relaxed);
+	}
+#elif defined USE_QT
+	typedef QAtomicInt sequence_t;
+
+	uint32_t nextSequence(sequence_t& s) { return static_cast<uint32_t>(s.fetchAndAddRelaxed(1)) + 1; }
+	uint32_t lastSequence(sequence_t& s) { return static_cast<uint32_t>(s.fetchAndAddRelaxed(0)); }
+	void invalidate(sequence_t& s) { s.fetchAndStoreOrdered(0); }
+	void publish(sequence_t& s, uint32_t value) { s.fetchAndStoreRelease(static_cast<int>(value)); }
+	uint32_t loadSequence(sequence_t& s) { return static_cast<uint32_t>(s.fetchAndAddAcquire(0)); }
+	uint32_t recheckSequence(sequence_t& s) { return static_cast<uint32_t>(s.fetchAndAddOrdered(0)); }
+#endif
+
+	struct SharedLine {
+		sequence_t sequence;
+		LogLine line;
+	};
+
+	sequence_t lineCount;
+	SharedLine lines[LOG_LINES];
+
+	size_t appendText(char* out, size_t size, const char* text, size_t len)
+	{
+		for (size_t i = 0; i < len && size < LINE_SIZE - 1 && text[i] != '\n'; ++i) {
+			out[size++] = text[i];
+		}
+		return size;
+	}
+
+	// Entrada i do ring em ordem, as vazias ficam no comeco
+	const Entry& at(const Entry* ring, uint32_t next, int size, int i)
+	{
+		return ring[(next + i) % size];
+	}
+
+	int used(const Entry* ring, int size)
+	{
+		int n = 0;
+		for (int i = 0; i < size; ++i) {
+			if (ring[i].sequence != 0) {
+				++n;
+			}
+		}
+		return n;
+	}
+}
+
+namespace Breadcrumbs {
+
+	void enable(bool enabled)
+	{
+		recording = enabled;
+	}
+
+	bool enabled()
+	{
+		return recording;
+	}
+
+	void recordLog(int level, const char* fmt)
+	{
+		if (!recording) {
+			return;
+		}
+		Ring* ring = currentRing();
+		if (ring == NULL) {
+			ring = createRing();
+		}
+		Entry& entry = nextEntry(ring->logs, &ring->nextLog, LOG_ENTRIES);
+		entry.sequence = ++ring->sequence;
+		entry.kind = LOG;
+		entry.level = static_cast<uint8_t>(level);
+		entry.site = NULL;
+		entry.nFrames = 0;
+		copyText(entry.text, fmt);
+	}
+
+	void recordException(const char* type, void* site, void* const* frames, int nFrames)
+	{
+		if (!recording) {
+			return;
+		}
+		Ring* ring = currentRing();
+		if (ring == NULL) {
+			ring = createRing();
+		}
+		Entry& entry = nextEntry(ring->exceptions, &ring->nextException, EXCEPTION_ENTRIES);
+		entry.sequence = ++ring->sequence;
+		entry.kind = EXCEPTION;
+		entry.level = 0;
+		entry.site = site;
+		entry.nFrames = std::min(nFrames, MAX_FRAMES);
+		for (int i = 0; i < entry.nFrames; ++i) {
+			entry.frames[i] = frames[i];
+		}
+		copyText(entry.text, type);
+	}
+
+	int collect(Entry* out, int max)
+	{
+		const Ring* ring = currentRing();
+		if (ring == NULL) {
+			return 0;
+		}
+		// os dois rings, ja em ordem, sao intercalados pela sequencia
+		int l = LOG_ENTRIES - used(ring->logs, LOG_ENTRIES);
+		int e = EXCEPTION_ENTRIES - used(ring->exceptions, EXCEPTION_ENTRIES);
+		const int total = (LOG_ENTRIES - l) + (EXCEPTION_ENTRIES - e);
+		// os mais recentes, se nao couberem todos
+		int skip = (total > max) ? total - max : 0;
+		int n = 0;
+		while (l < LOG_ENTRIES || e < EXCEPTION_ENTRIES) {
+			const Entry* entry;
+			if (e == EXCEPTION_ENTRIES || (l < LOG_ENTRIES
+					&& at(ring->logs, ring->nextLog, LOG_ENTRIES, l).sequence < at(ring->exceptions, ring->nextException, EXCEPTION_ENTRIES, e).sequence)) {
+				entry = &at(ring->logs, ring->nextLog, LOG_ENTRIES, l++);
+			} else {
+				entry = &at(ring->exceptions, ring->nextException, EXCEPTION_ENTRIES, e++);
+			}
+			if (skip > 0) {
+				--skip;
+			} else {
+				out[n++] = *entry;
+			}
+		}
+		return n;
+	}
+
+	uint64_t fingerprint(const Entry& entry)
+	{
+		return entry.nFrames > 0 ? Backtrace::fingerprint(entry.frames, entry.nFrames) : 0;
+	}
+
+	void recordLine(int level, const char* logger, const char* message, int len)
+	{
+		if (!recording) {
+			return;
+		}
+		const uint32_t sequence = nextSequence(lineCount);
+		SharedLine& shared = lines[(sequence - 1) % LOG_LINES];
+		invalidate(shared.sequence);
+		LogLine& line = shared.line;
+		line.level = static_cast<uint8_t>(level);
+		line.threadId = Backtrace::currentThreadId();
+		size_t size = appendText(line.text, 0, logger, strlen(logger));
+		size = appendText(line.text, size, ": ", 2);
+		size = appendText(line.text, size, message, len);
+		line.text[size] = '\0';
+		publish(shared.sequence, sequence);
+	}
+
+	int collectLines(LogLine* out, int max)
+	{
+		const uint32_t last = lastSequence(lineCount);
+		const int count = static_cast<int>(std::min<uint32_t>(last, std::min(LOG_LINES, max)));
+		int n = 0;
+		for (int i = 0; i < count; ++i) {
+			const uint32_t sequence = last - count + 1 + i;
+			SharedLine& shared = lines[(sequence - 1) % LOG_LINES];
+			if (loadSequence(shared.sequence) != sequence) {
+				continue;
+			}
+			out[n] = shared.line;
+			if (recheckSequence(shared.sequence) != sequence) {
+				continue;
+			}
+			out[n++].sequence = sequence;
+		}
+		return n;
+	}
+}
@@ -0,0 +1,106 @@
+#ifndef BREADCRUMBS_H
+#define BREADCRUMBS_H
+
+/* Ultimos eventos de cada thread, para os relatorios de crash e de excecao.
+ *
+ * Each thread keeps its own log calls and throws, in the order it made
+ * them, and the formatted lines of all the threads share a ring with the
+ * tail of the log. Both are written without locks, so the crash handler can
+ * read them.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+
+namespace Breadcrumbs {
+
+	// Entries kept per thread, the log lines and the exceptions have separate
+	// rings so a burst of one kind doesn't push the other out
+	const int LOG_ENTRIES = 32;
+	const int EXCEPTION_ENTRIES = 16;
+	const int MAX_ENTRIES = LOG_ENTRIES + EXCEPTION_ENTRIES;
+	const int TEXT_SIZE = 80;
+	// Return addresses kept per exception, for its fingerprint. The
+	// fingerprint of a deeper trace only covers the first ones.
+	const int MAX_FRAMES = 32;
+
+	enum Kind {
+		LOG = 1,
+		EXCEPTION
+	};
+
+	struct Entry {
+		// Order of the event in its thread, starting at 1
+		uint32_t sequence;
+		uint8_t kind;
+		// Log::Level of the line
+		uint8_t level;
+		// Exceptions: the throw site and the first frames of the trace (none
+		// if it wasn't captured), see fingerprint(entry)
+		void* site;
+		int nFrames;
+		void* frames[MAX_FRAMES];
+		// Log lines: the format string, before the arguments are applied and
+		// cut at TEXT_SIZE-1. Exceptions: the mangled name of the type.
+		char text[TEXT_SIZE];
+	};
+
+	/* Starts or stops recording. It's off by default. While on, every
+	 * Logger::log() call is recorded, whatever the level of the logger, and
+	 * so is every exception captured by this library. Recording only copies
+	 * the format string (the arguments aren't formatted) to a ring of the
+	 * calling thread, without locks or allocations after the first event.
+	 */
+	void enable(bool enabled);
+
+	bool enabled();
+
+	void recordLog(int level, const char* fmt);
+
+	// Records a throw. Only the return addresses are copied, the
+	// fingerprint is computed when the breadcrumbs are printed.
+	void recordException(const char* type, void* site, void* const* frames, int nFrames);
+
+	/* Copies the events of the calling thread to out, oldest first, and
+	 * returns how many were copied. It doesn't allocate, the crash handler
+	 * uses it.
+	 */
+	int collect(Entry* out, int max);
+
+	// Backtrace::fingerprint() of the exception's trace, 0 if it wasn't
+	// captured. It looks up the modules of the frames, so it can't be
+	// called from a signal handler.
+	uint64_t fingerprint(const Entry& entry);
+
+	// Formatted log lines kept for the whole process, the tail of the log
+	// for the crash report
+	const int LOG_LINES = 32;
+	const int LINE_SIZE = 160;
+
+	struct LogLine {
+		// Order of the line in the process, starting at 1
+		uint32_t sequence;
+		// Log::Level of the line
+		uint8_t level;
+		int threadId;
+		// "<logger>: <message>", up to the first line break and cut at
+		// LINE_SIZE-1
+		char text[LINE_SIZE];
+	};
+
+	/* Records a line written by a Logger, with the arguments applied. Only
+	 * the lines that pass the level of the logger are recorded, and only
+	 * while enable(true). The lines of all the threads share one ring,
+	 * written without locks or allocations.
+	 */
+	void recordLine(int level, const char* logger, const char* message, int len);
+
+	/* Copies the last lines to out, oldest first, and returns how many were
+	 * copied. A line being overwritten by another thread at the time is left
+	 * out. It doesn't lock or allocate, the crash handler uses it.
+	 */
+	int collectLines(LogLine* out, int max);
+}
+
+#endif /* BREADCRUMBS_H */
@@ -0,0 +1,112 @@
+#ifndef CRASHREPORTFORMAT_H
+#define CRASHREPORTFORMAT_H
+
+/* Layout of the binary crash report (Backtrace::CRASH_REPORT_BINARY).
+ *
+ * The report starts with a Header followed by records. Each record is a
+ * RecordHeader and size bytes of payload, so readers skip the types they
+ * don't know. All the fields are in the byte order of the crashed process,
+ * readers check it with the magic. The last record is RECORD_END; a report
+ * without it was cut short (the process was killed while writing it).
+ */
+
+#include <stdint.h>
+
+namespace CrashReport {
+
+	// "EXCR" when read in the right byte order
+	const uint32_t MAGIC = 0x52435845;
+	const uint32_t VERSION = 1;
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+	};
+
+	enum RecordType {
+		RECORD_SIGNAL = 1,
+		RECORD_REGISTERS,
+		RECORD_MODULE,
+		RECORD_THREAD,
+		RECORD_END,
+		RECORD_BREADCRUMB,
+		RECORD_LOG_LINE
+	};
+
+	struct RecordHeader {
+		uint32_t type;
+		// bytes of payload after this header
+		uint32_t size;
+	};
+
+	struct SignalRecord {
+		int32_t signo;
+		int32_t code;
+		uint64_t address;
+		int32_t pid;
+		// thread that received the signal
+		int32_t tid;
+		// wall clock time, seconds since the epoch
+		int64_t time;
+	};
+
+	// Followed by count uint64_t values, in the order of the machine's
+	// ucontext: gregs for EM_X86_64 and EM_386, x0-x30, sp, pc and pstate
+	// for EM_AARCH64. machine is 0 (and count too) where it isn't supported.
+	struct RegistersRecord {
+		uint32_t machine;
+		uint32_t count;
+	};
+
+	// Followed by buildIdSize bytes of the GNU build-id and pathSize bytes
+	// of path, without the terminating null
+	struct ModuleRecord {
+		// Address in memory minus the address in the ELF file
+		uint64_t loadBias;
+		// Range covered by the loaded segments
+		uint64_t start;
+		uint64_t end;
+		uint32_t buildIdSize;
+		uint32_t pathSize;
+	};
+
+	// Followed by count uint64_t return addresses, innermost first. The
+	// first address of the crashed thread is the faulting instruction.
+	struct ThreadRecord {
+		int32_t tid;
+		uint32_t crashed;
+		uint32_t count;
+		uint32_t reserved;
+	};
+
+	// One event of the crashed thread (see Breadcrumbs.h), oldest first.
+	// Followed by textSize bytes of text and frameCount uint64_t return
+	// addresses of the exception's trace. The fingerprint can't be computed
+	// in the signal handler, readers compute it from the frames and the
+	// modules like Backtrace::fingerprint() when it's 0.
+	struct BreadcrumbRecord {
+		uint32_t sequence;
+		// Breadcrumbs::Kind
+		uint8_t kind;
+		uint8_t level;
+		uint16_t reserved;
+		uint64_t site;
+		uint64_t fingerprint;
+		uint32_t textSize;
+		uint32_t frameCount;
+	};
+
+	// One of the last lines written by the loggers of any thread (see
+	// Breadcrumbs::recordLine()), oldest first. Followed by textSize bytes
+	// of text.
+	struct LogLineRecord {
+		uint32_t sequence;
+		int32_t tid;
+		// Log::Level
+		uint8_t level;
+		uint8_t reserved[3];
+		uint32_t textSize;
+	};
+}
+
+#endif // CRASHREPORTFORMAT_H
@@ -13,6 +13,7 @@
 
 #include <iostream>
 #include <signal.h>
+#include <stdio.h>
 #include <time.h>
 #include <sstream>
 
@@ -117,17 +118,26 @@ void Error::abortPrivate(
 	unsigned int abortFileLine,
     const std::string & additionalInfo)
 {
-    errLog().log(Log::LERROR, "FATAL ERROR - The program will be aborted.\n"
-				 "%1\n"
-                 "File: %2\n"
-                 "Line: %3\n"
-				 "%4"
-				 "Stacktrace:\n%5",
-				 software,
-				 abortFilename,
-				 abortFileLine,
-				 additionalInfo,
-				 Log::BT);
+	// o erro pode ter sido a falta de memoria
+	releaseEmergencyReserve();
+	try {
+		errLog().log(Log::LERROR, "FATAL ERROR - The program will be aborted.\n"
+					 "%1\n"
+					 "File: %2\n"
+					 "Line: %3\n"
+					 "%4"
+					 "Stacktrace:\n%5",
+					 software,
+					 abortFilename,
+					 abortFileLine,
+					 additionalInfo,
+					 Log::BT);
+	} catch (...) {
+		char report[2048];
+		snprintf(report, sizeof(report), "FATAL ERROR - The program will be aborted.\nFile: %s\nLine: %u\n%s",
+				 abortFilename, abortFileLine, additionalInfo.c_str());
+		Backtrace::writeEmergencyReport(2, report);
+	}
 
 	if (s_abortCallback){
         (*s_abortCallback)(additionalInfo.c_str());
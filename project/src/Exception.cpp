@@ -1,6 +1,7 @@
 #include "Exception.h"
 
 #include "BackTrace.h"
+#include "Breadcrumbs.h"
 #include "Demangling.h"
 #include "StackAddressLoader.h"
 #include "DebugSymbolLoader.h"
@@ -17,30 +18,71 @@
 #include <stdexcept>
 #include <vector>
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <typeinfo>
+#include <map>
+
+#ifdef USE_CXX11
+	#include <atomic>
+	#include <chrono>
+	#include <mutex>
+#elif defined USE_QT
+	#include <QAtomicInt>
+	#include <QAtomicPointer>
+	#include <QDateTime>
+	#include <QMutex>
+#endif
 
 using namespace std;
 
 
 static bool initialized = false;
 
+namespace {
+	// Numero de niveis de heranca entre type e base, -1 se type nao deriva de base
+	int base_distance(const std::type_info& type, const std::type_info& base);
+
+	// Profundidade do stacktrace para excecoes do tipo, configurada com stacktraceDepth
+	int depth_for(const std::type_info& type, int defaultDepth);
+
+	// Profundidade para o throw corrente, 0 se o trace nao foi amostrado.
+	// Tambem gera o trace id do throw e conta o throw no site. Se o site
+	// estiver limitado a um frame, siteOnly fica true.
+	int capture_depth(const std::type_info& type, int defaultDepth, void* site, uint64_t* traceId, bool* siteOnly);
+
+	// true se throwSiteThrottling esta ativo, sem o lock
+	bool counting_sites();
+}
+
 #if __GNUC__
 
 #include <cxxabi.h>
+#include <unwind.h>
 
 struct padding {
 	void* ptr;
 };
 
-static const int MAX_FRAMES = 16;
+static const int MAX_FRAMES = 64;
 static const int INTERCEPT_SKIP = 1;
+static const int DEFAULT_INTERCEPT_DEPTH = 15;
 
 struct frames {
 	typedef void (*destructor)(void*);
 	int size;
+	bool namesLoaded;
+	// numero de frames visitados pela personality, -1 se a pilha foi percorrida no throw
+	int unwound;
+	// maximo de frames gravados pela personality
+	int limit;
+	uint64_t traceId;
+	// excecao cujos frames estao sendo gravados pela personality
+	void* recording;
+	// frame do __wrap___cxa_throw, os frames abaixo dele nao sao gravados
+	void* throwFrame;
 	Backtrace::StackFrame* frms;
 	destructor dtor;
 	union {
@@ -49,7 +91,9 @@ struct frames {
 	};
 };
 
-static __thread frames localFrames = { 0 , 0, 0, {{0}}};
+static __thread frames localFrames = { 0 , false, -1, 0, 0, 0, 0, 0, 0, {{0}}};
+
+static ExceptionLib::ThrowTraceMode traceMode = ExceptionLib::THROW_TRACE_WALK;
 
 namespace {
 	void create_frames()
@@ -57,6 +101,8 @@ namespace {
 		Backtrace::StackFrame* addr = reinterpret_cast<Backtrace::StackFrame*>(localFrames.buffer);
 		if (localFrames.frms != addr) {
 			// só um acaso muito grande ia fazer o ponteiro apontar exatamente para o lugar certo.
+			// Primeira excecao da thread
+			Backtrace::initializeThread();
 			localFrames.size = 0;
 			localFrames.frms = addr;
 			for (int i = 0; i < MAX_FRAMES;  ++i) {
@@ -77,6 +123,38 @@ namespace {
 		localFrames.size = -1;
 		localFrames.frms = NULL;
 		localFrames.dtor = NULL;
+		localFrames.recording = NULL;
+	}
+
+	void record_frame(void* addr)
+	{
+		if (localFrames.size >= localFrames.limit || (localFrames.size > 0 && localFrames.frms[localFrames.size-1].addr == addr)) {
+			return;
+		}
+		Backtrace::StackFrame& frame = localFrames.frms[localFrames.size++];
+		frame.addr = addr;
+		frame.function.clear();
+		frame.line = -1;
+		frame.sourceFile.clear();
+		frame.imageFile.clear();
+	}
+
+	// Copia os enderecos dos frames da thread, ate max
+	int local_addresses(void** addrs, int max)
+	{
+		int n = 0;
+		for (int i = 0; i < localFrames.size && n < max; ++i) {
+			addrs[n++] = localFrames.frms[i].addr;
+		}
+		return n;
+	}
+
+	// Backtrace::fingerprint() dos frames da thread
+	uint64_t local_fingerprint()
+	{
+		void* addrs[MAX_FRAMES];
+		const int n = local_addresses(addrs, MAX_FRAMES);
+		return n > 0 ? Backtrace::fingerprint(addrs, n) : 0;
 	}
 }
 
@@ -101,18 +179,55 @@ namespace ExceptionLib {
 				if (depth) *depth = 0;
 				return NULL;
 			}
-			if (depth) *depth = localFrames.size - INTERCEPT_SKIP;
+			if (depth) *depth = localFrames.size;
 			if (*depth > 0) {
 
+				if (!localFrames.namesLoaded) {
+					localFrames.namesLoaded = true;
+					Backtrace::loadSymbolNames(localFrames.frms, localFrames.size);
+				}
+
 				if (loadDebugSyms) {
 					Backtrace::getPlatformDebugSymbolLoader().findDebugInfo(localFrames.frms, localFrames.size);
 				}
 
-				return localFrames.frms+INTERCEPT_SKIP;
+				return localFrames.frms;
 			}
 		}
 		return NULL;
 	}
+
+	int getUnwoundFrames()
+	{
+		if (localFrames.frms != reinterpret_cast<Backtrace::StackFrame*>(localFrames.buffer)) {
+			return -1;
+		}
+		return localFrames.unwound;
+	}
+
+	uint64_t traceId(const std::exception& ex)
+	{
+		const ExceptionBase* base = dynamic_cast<const ExceptionBase*>(&ex);
+		if (base) {
+			return base->traceId();
+		}
+		if (localFrames.frms != reinterpret_cast<Backtrace::StackFrame*>(localFrames.buffer)) {
+			return 0;
+		}
+		return localFrames.traceId;
+	}
+
+	uint64_t stackFingerprint(const std::exception& ex)
+	{
+		const ExceptionBase* base = dynamic_cast<const ExceptionBase*>(&ex);
+		if (base) {
+			return base->stacktrace() ? base->stacktrace()->fingerprint() : 0;
+		}
+		if (localFrames.frms != reinterpret_cast<Backtrace::StackFrame*>(localFrames.buffer)) {
+			return 0;
+		}
+		return local_fingerprint();
+	}
 }
 
 
@@ -165,6 +280,39 @@ namespace {
 		return false;
 	}
 
+	int class_distance(const abi::__class_type_info* actual, const abi::__class_type_info* target)
+	{
+		if (*actual == *target) {
+			return 0;
+		}
+		int best = -1;
+		const abi::__vmi_class_type_info* vmactual = dynamic_cast<const abi::__vmi_class_type_info*>(actual);
+		if (vmactual) {
+			for (size_t i = 0; i < vmactual->__base_count; ++i) {
+				const int d = class_distance(vmactual->__base_info[i].__base_type, target);
+				if (d >= 0 && (best < 0 || d + 1 < best)) {
+					best = d + 1;
+				}
+			}
+			return best;
+		}
+		const abi::__si_class_type_info* sactual = dynamic_cast<const abi::__si_class_type_info*>(actual);
+		if (sactual) {
+			const int d = class_distance(sactual->__base_type, target);
+			return d < 0 ? -1 : d + 1;
+		}
+		return -1;
+	}
+
+	int base_distance(const std::type_info& type, const std::type_info& base)
+	{
+		const abi::__class_type_info* ctype = dynamic_cast<const abi::__class_type_info*>(&type);
+		const abi::__class_type_info* cbase = dynamic_cast<const abi::__class_type_info*>(&base);
+		if (ctype == NULL || cbase == NULL) {
+			return type == base ? 0 : -1;
+		}
+		return class_distance(ctype, cbase);
+	}
 }
 
 extern "C" void __real___cxa_throw( void* thrown_exception, const std::type_info* tinfo, void ( *dest )( void* ) ) __attribute__(( noreturn ));
@@ -185,9 +333,44 @@ extern "C" void __wrap___cxa_throw( void* thrown_exception,
 		const abi::__class_type_info& stdexclass = dynamic_cast<const abi::__class_type_info&>(typeid(std::exception));
 
 		if ( find_base(cinfo, &stdexclass, NULL)) {
+			void* site = __builtin_return_address(0);
+			uint64_t traceId = 0;
+			bool siteOnly = false;
+			const int depth = capture_depth(*tinfo, DEFAULT_INTERCEPT_DEPTH, site, &traceId, &siteOnly);
 			create_frames();
-			localFrames.size = Backtrace::getPlatformStackLoader().getStack(MAX_FRAMES, localFrames.frms);
+			localFrames.traceId = traceId;
+			if (siteOnly) {
+				localFrames.size = 0;
+				localFrames.limit = 1;
+				localFrames.unwound = -1;
+				localFrames.recording = NULL;
+				record_frame(site);
+			} else if (depth <= 0) {
+				// so o trace id
+				localFrames.size = 0;
+				localFrames.unwound = -1;
+				localFrames.recording = NULL;
+			} else if (traceMode == ExceptionLib::THROW_TRACE_UNWIND) {
+				// o resto dos frames vem da personality, durante a busca pelo catch
+				localFrames.size = 0;
+				localFrames.limit = std::min(depth, MAX_FRAMES);
+				localFrames.unwound = 0;
+				record_frame(__builtin_return_address(0));
+				localFrames.recording = thrown_exception;
+				localFrames.throwFrame = __builtin_frame_address(0);
+			} else {
+				localFrames.size = Backtrace::getPlatformStackLoader().getStack(std::min(depth, MAX_FRAMES), localFrames.frms, INTERCEPT_SKIP);
+				localFrames.unwound = -1;
+				localFrames.recording = NULL;
+			}
+			localFrames.namesLoaded = false;
 			localFrames.dtor = dest;
+			if (Breadcrumbs::enabled()) {
+				// no modo unwind os frames ainda nao foram gravados
+				void* addrs[Breadcrumbs::MAX_FRAMES];
+				const int n = localFrames.recording ? 0 : local_addresses(addrs, Breadcrumbs::MAX_FRAMES);
+				Breadcrumbs::recordException(tinfo->name(), site, addrs, n);
+			}
 			__real___cxa_throw( thrown_exception, tinfo, destroy_frames );
 			return;
 		}
@@ -195,6 +378,33 @@ extern "C" void __wrap___cxa_throw( void* thrown_exception,
 	__real___cxa_throw( thrown_exception, tinfo, dest );
 }
 
+#ifndef _WIN32
+
+extern "C" _Unwind_Reason_Code __real___gxx_personality_v0(int version, _Unwind_Action actions, _Unwind_Exception_Class exceptionClass,
+															struct _Unwind_Exception* ue, struct _Unwind_Context* context);
+
+// Called by the unwinder for each frame with a catch block or cleanups, first
+// to search for the handler and then to run the cleanups
+extern "C" _Unwind_Reason_Code __wrap___gxx_personality_v0(int version, _Unwind_Action actions, _Unwind_Exception_Class exceptionClass,
+														   struct _Unwind_Exception* ue, struct _Unwind_Context* context)
+{
+	const _Unwind_Reason_Code code = __real___gxx_personality_v0(version, actions, exceptionClass, ue, context);
+
+	// o objeto lancado fica logo depois do cabecalho do unwinder
+	if (localFrames.recording != NULL && (actions & _UA_SEARCH_PHASE) && static_cast<void*>(ue + 1) == localFrames.recording) {
+		if (_Unwind_GetCFA(context) > reinterpret_cast<uintptr_t>(localFrames.throwFrame)) {
+			record_frame(reinterpret_cast<void*>(_Unwind_GetIP(context)));
+			localFrames.unwound++;
+		}
+		if (code == _URC_HANDLER_FOUND) {
+			localFrames.recording = NULL;
+		}
+	}
+	return code;
+}
+
+#endif
+
 extern "C" void __real___cxa_bad_cast() __attribute__(( noreturn ));
 
 extern "C" void __wrap___cxa_bad_cast()
@@ -214,18 +424,387 @@ namespace ExceptionLib {
 		if (depth) * depth = 0;
 		return NULL;
 	}
+
+	int getUnwoundFrames()
+	{
+		return -1;
+	}
+
+	uint64_t traceId(const std::exception& ex)
+	{
+		const ExceptionBase* base = dynamic_cast<const ExceptionBase*>(&ex);
+		return base ? base->traceId() : 0;
+	}
+
+	uint64_t stackFingerprint(const std::exception& ex)
+	{
+		const ExceptionBase* base = dynamic_cast<const ExceptionBase*>(&ex);
+		return base && base->stacktrace() ? base->stacktrace()->fingerprint() : 0;
+	}
 }
 
+namespace {
+	int base_distance(const std::type_info& type, const std::type_info& base)
+	{
+		return type == base ? 0 : -1;
+	}
+}
+
+#endif
+
+namespace {
+	struct TypeInfoLess {
+		bool operator()(const std::type_info* a, const std::type_info* b) const {
+			return a->before(*b) != 0;
+		}
+	};
+
+	typedef std::map<const std::type_info*, int, TypeInfoLess> DepthMap;
+
+	// Estado de cada tipo ja lancado
+	struct TypeState {
+		int depth;
+		// inicio da janela de um segundo da amostragem
+		int64_t windowStart;
+		// throws na janela
+		unsigned thrown;
+		// um em cada interval throws tem o trace capturado
+		unsigned interval;
+		unsigned counter;
+
+		TypeState() : depth(0), windowStart(0), thrown(0), interval(1), counter(0) {}
+	};
+
+	typedef std::map<const std::type_info*, TypeState, TypeInfoLess> StateMap;
+
+	// Contadores de cada throw site
+	struct SiteState {
+		int64_t windowStart;
+		unsigned thrown;
+		unsigned lastRate;
+		uint64_t total;
+		bool throttled;
+
+		SiteState() : windowStart(0), thrown(0), lastRate(0), total(0), throttled(false) {}
+	};
+
+	typedef std::map<void*, SiteState> SiteMap;
+
+	// acima disso os sites novos nao sao contados
+	const size_t MAX_SITES = 4096;
+
+#ifdef USE_CXX11
+	int64_t nowMs()
+	{
+		std::chrono::steady_clock::duration duration = std::chrono::steady_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+	}
+#elif defined USE_QT
+	int64_t nowMs()
+	{
+		return QDateTime::currentMSecsSinceEpoch();
+	}
+#endif
+
+#ifdef USE_CXX11
+	typedef std::mutex depth_lock_t;
+	struct DepthLocker {
+		std::lock_guard<depth_lock_t> guard;
+		DepthLocker(depth_lock_t* l) : guard(*l) {}
+	};
+	typedef DepthLocker depth_locker_t;
+#elif defined USE_QT
+	typedef QMutex depth_lock_t;
+	typedef QMutexLocker depth_locker_t;
 #endif
 
+#ifdef USE_CXX11
+	typedef std::atomic<uint64_t> atomic_id_t;
+	typedef std::atomic<const std::type_info*> atomic_type_t;
+	typedef std::atomic<unsigned> atomic_flag_t;
+
+	inline uint64_t next_id(atomic_id_t& id) { return id.fetch_add(1, std::memory_order_relaxed) + 1; }
+	inline uint64_t load(const atomic_id_t& v) { return v.load(std::memory_order_acquire); }
+	inline const std::type_info* load(const atomic_type_t& v) { return v.load(std::memory_order_acquire); }
+	inline void store(atomic_id_t& v, uint64_t value) { v.store(value, std::memory_order_release); }
+	inline void store(atomic_type_t& v, const std::type_info* value) { v.store(value, std::memory_order_release); }
+#elif defined USE_QT
+	// o QAtomicInt do Qt4 tem 32 bits, os valores de 64 bits usam os builtins do GCC
+	struct atomic_id_t {
+		uint64_t value;
+		atomic_id_t(uint64_t v = 0) : value(v) {}
+	};
+	typedef QAtomicPointer<const std::type_info> atomic_type_t;
+	typedef QAtomicInt atomic_flag_t;
+
+	inline uint64_t next_id(atomic_id_t& id) { return __atomic_add_fetch(&id.value, 1, __ATOMIC_RELAXED); }
+	inline uint64_t load(const atomic_id_t& v) { return __atomic_load_n(&v.value, __ATOMIC_ACQUIRE); }
+	inline const std::type_info* load(const atomic_type_t& v) { return const_cast<atomic_type_t&>(v).fetchAndAddAcquire(0); }
+	inline void store(atomic_id_t& v, uint64_t value) { __atomic_store_n(&v.value, value, __ATOMIC_RELEASE); }
+	inline void store(atomic_type_t& v, const std::type_info* value) { v.fetchAndStoreRelease(value); }
+#endif
+
+	// Profundidades ja resolvidas, lidas sem o lock quando nao ha amostragem
+	// nem limite por site. A entrada de um tipo nunca muda de dono, o valor
+	// guarda a epoch da configuracao com que foi resolvido.
+	class DepthCache {
+	public:
+		DepthCache() : m_epoch(1) {
+			for (size_t i = 0; i < SIZE; ++i) {
+				m_entries[i].type = NULL;
+				m_entries[i].value = 0;
+			}
+		}
+
+		bool find(const std::type_info& type, int* depth) const {
+			const uint64_t epoch = load(m_epoch);
+			for (size_t i = 0, slot = first(type); i < PROBES; ++i, slot = (slot + 1) % SIZE) {
+				const std::type_info* owner = load(m_entries[slot].type);
+				if (owner == &type) {
+					const uint64_t value = load(m_entries[slot].value);
+					if ((value >> 32) != epoch) {
+						return false;
+					}
+					*depth = static_cast<int>(value & 0xffffffff);
+					return true;
+				}
+				if (owner == NULL) {
+					return false;
+				}
+			}
+			return false;
+		}
+
+		// chamado com o lock
+		void store(const std::type_info& type, int depth) {
+			const uint64_t value = (load(m_epoch) << 32) | static_cast<uint32_t>(depth);
+			for (size_t i = 0, slot = first(type); i < PROBES; ++i, slot = (slot + 1) % SIZE) {
+				const std::type_info* owner = load(m_entries[slot].type);
+				if (owner == &type) {
+					::store(m_entries[slot].value, value);
+					return;
+				}
+				if (owner == NULL) {
+					// o valor antes do dono, quem ler o dono ja ve o valor
+					::store(m_entries[slot].value, value);
+					::store(m_entries[slot].type, &type);
+					return;
+				}
+			}
+		}
+
+		// chamado com o lock, depois de mudar a configuracao
+		void invalidate() {
+			::store(m_epoch, load(m_epoch) + 1);
+		}
+
+	private:
+		static const size_t SIZE = 64;
+		static const size_t PROBES = 8;
+
+		static size_t first(const std::type_info& type) {
+			return (reinterpret_cast<uintptr_t>(&type) >> 4) % SIZE;
+		}
+
+		struct Entry {
+			atomic_type_t type;
+			// epoch << 32 | depth
+			atomic_id_t value;
+		};
+
+		atomic_id_t m_epoch;
+		Entry m_entries[SIZE];
+	};
+
+	struct DepthPolicy {
+		// -1 quando nao configurada, o default depende do tipo
+		int globalDepth;
+		// profundidades configuradas
+		DepthMap configured;
+		// estado de cada tipo ja lancado
+		StateMap resolved;
+		DepthCache cache;
+		// 0 quando todos os throws tem trace
+		unsigned tracesPerSecond;
+		atomic_id_t lastTraceId;
+		// 0 quando os sites nao sao contados, e lido sem o lock
+		atomic_flag_t maxSiteRate;
+		// amostragem ou limite por site, os throws precisam do lock
+		atomic_flag_t counting;
+		ExceptionLib::ThrottleMode throttleMode;
+		SiteMap sites;
+		depth_lock_t lock;
+
+		DepthPolicy()
+			: globalDepth(-1)
+			, tracesPerSecond(0)
+			, lastTraceId(0)
+			, maxSiteRate(0)
+			, counting(0)
+			, throttleMode(ExceptionLib::THROTTLE_ADDRESS_ONLY)
+		{}
+
+		// chamado com o lock depois de qualquer mudanca na configuracao
+		void changed() {
+			resolved.clear();
+			cache.invalidate();
+			counting = (tracesPerSecond != 0 || maxSiteRate != 0) ? 1 : 0;
+		}
+	};
+
+	DepthPolicy& depthPolicy()
+	{
+		static DepthPolicy policy;
+		return policy;
+	}
+
+	// Memoria reservada para os caminhos de erro fatal, liberada antes do
+	// relatorio ser formatado
+	struct EmergencyReserve {
+		void* memory;
+		size_t size;
+		// false ate init() ou emergencyReserve()
+		bool configured;
+		depth_lock_t lock;
+
+		EmergencyReserve() : memory(NULL), size(0), configured(false) {}
+	};
+
+	// nunca e destruida, o terminate pode rodar depois dos destrutores estaticos
+	EmergencyReserve& emergencyReserveState()
+	{
+		static EmergencyReserve* reserve = new EmergencyReserve();
+		return *reserve;
+	}
+
+	// chamado com o lock
+	TypeState& resolve(DepthPolicy& policy, const std::type_info& type, int defaultDepth)
+	{
+		StateMap::iterator state = policy.resolved.find(&type);
+		if (state != policy.resolved.end()) {
+			return state->second;
+		}
+
+		int depth = policy.globalDepth >= 0 ? policy.globalDepth : defaultDepth;
+		int nearest = -1;
+		for (DepthMap::const_iterator it = policy.configured.begin(); it != policy.configured.end(); ++it) {
+			const int distance = base_distance(type, *it->first);
+			if (distance >= 0 && (nearest < 0 || distance < nearest)) {
+				nearest = distance;
+				depth = it->second;
+			}
+		}
+		TypeState& newState = policy.resolved[&type];
+		newState.depth = depth;
+		return newState;
+	}
+
+	int depth_for(const std::type_info& type, int defaultDepth)
+	{
+		DepthPolicy& policy = depthPolicy();
+		int depth;
+		if (policy.cache.find(type, &depth)) {
+			return depth;
+		}
+		depth_locker_t locker(&policy.lock);
+		TypeState& state = resolve(policy, type, defaultDepth);
+		policy.cache.store(type, state.depth);
+		return state.depth;
+	}
+
+	// chamado com o lock, retorna true se o site esta acima da taxa maxima
+	bool count_site(DepthPolicy& policy, void* site, int64_t now)
+	{
+		SiteMap::iterator it = policy.sites.find(site);
+		if (it == policy.sites.end()) {
+			if (policy.sites.size() >= MAX_SITES) {
+				return false;
+			}
+			it = policy.sites.insert(std::make_pair(site, SiteState())).first;
+			it->second.windowStart = now;
+		}
+		SiteState& state = it->second;
+		const unsigned maxRate = policy.maxSiteRate;
+
+		const int64_t elapsed = now - state.windowStart;
+		if (elapsed >= 1000) {
+			state.lastRate = static_cast<unsigned>(state.thrown * 1000 / elapsed);
+			state.throttled = state.lastRate > maxRate;
+			state.thrown = 0;
+			state.windowStart = now;
+		}
+		++state.thrown;
+		++state.total;
+		if (state.thrown > maxRate) {
+			state.throttled = true;
+		}
+		return state.throttled;
+	}
+
+	bool counting_sites()
+	{
+		return depthPolicy().maxSiteRate != 0;
+	}
+
+	int capture_depth(const std::type_info& type, int defaultDepth, void* site, uint64_t* traceId, bool* siteOnly)
+	{
+		DepthPolicy& policy = depthPolicy();
+		*traceId = next_id(policy.lastTraceId);
+		*siteOnly = false;
+
+		int depth;
+		if (policy.counting == 0 && policy.cache.find(type, &depth)) {
+			return depth;
+		}
+
+		depth_locker_t locker(&policy.lock);
+		TypeState& state = resolve(policy, type, defaultDepth);
+		policy.cache.store(type, state.depth);
+		if (state.depth <= 0) {
+			return 0;
+		}
+		if (policy.tracesPerSecond == 0 && (policy.maxSiteRate == 0 || site == NULL)) {
+			return state.depth;
+		}
+
+		const int64_t now = nowMs();
+		if (policy.maxSiteRate != 0 && site != NULL && count_site(policy, site, now)) {
+			if (policy.throttleMode == ExceptionLib::THROTTLE_NO_TRACE) {
+				return 0;
+			}
+			*siteOnly = true;
+			return 1;
+		}
+		if (policy.tracesPerSecond == 0) {
+			return state.depth;
+		}
+
+		if (now - state.windowStart >= 1000) {
+			// o intervalo da proxima janela vem da taxa da que terminou
+			state.interval = std::max(1u, state.thrown / policy.tracesPerSecond);
+			state.thrown = 0;
+			state.windowStart = now;
+		}
+		++state.thrown;
+		if (state.thrown / state.interval > 2 * policy.tracesPerSecond) {
+			// a taxa subiu no meio da janela, nao espera ela terminar
+			state.interval *= 2;
+		}
+		return (state.counter++ % state.interval == 0) ? state.depth : 0;
+	}
+}
+
 namespace ExceptionLib {
 
 	static const size_t SKIP_FRAMES = 4;
+	static const int DEFAULT_DEPTH = 28;
 
 	static bool stackEnabled = true;
 
+	static const size_t DEFAULT_EMERGENCY_RESERVE = 1024*1024;
+
     //https://akrzemi1.wordpress.com/2011/10/05/using-stdterminate/
-	void terminate_handler()
+	static void log_unhandled()
 	{
 #ifdef USE_CXX11
         std::exception_ptr ptr = current_exception();
@@ -267,18 +846,78 @@ namespace ExceptionLib {
 #endif
 	}
 
-	void init(const char *argv0)
+	void terminate_handler()
+	{
+		// a excecao pode ser um bad_alloc, o log precisa de memoria
+		releaseEmergencyReserve();
+		try {
+			log_unhandled();
+		} catch (...) {
+			::Backtrace::writeEmergencyReport(2, "Unhandled exception, the log failed\n");
+		}
+	}
+
+	void init(const char *argv0, StackUnwinder unwinder)
 	{
 		::Backtrace::initialize(argv0);
+		switch (unwinder) {
+			case UNWIND_FRAME_POINTER:
+				::Backtrace::setStackLoader(::Backtrace::getFramePointerStackLoader());
+				break;
+			case UNWIND_CFI:
+				::Backtrace::setStackLoader(::Backtrace::getCfiStackLoader());
+				break;
+			default:
+				::Backtrace::setStackLoader(NULL);
+				break;
+		}
 		set_terminate(terminate_handler);
+		if (!emergencyReserveState().configured) {
+			emergencyReserve(DEFAULT_EMERGENCY_RESERVE);
+		}
 		initialized = true;
 	}
 
+	void emergencyReserve(size_t bytes)
+	{
+		void* memory = (bytes != 0) ? malloc(bytes) : NULL;
+		if (memory != NULL) {
+			// com overcommit as paginas so existem depois de escritas
+			memset(memory, 0, bytes);
+		}
+		EmergencyReserve& reserve = emergencyReserveState();
+		void* previous;
+		{
+			depth_locker_t locker(&reserve.lock);
+			previous = reserve.memory;
+			reserve.memory = memory;
+			reserve.size = memory ? bytes : 0;
+			reserve.configured = true;
+		}
+		free(previous);
+	}
+
+	void releaseEmergencyReserve()
+	{
+		EmergencyReserve& reserve = emergencyReserveState();
+		depth_locker_t locker(&reserve.lock);
+		free(reserve.memory);
+		reserve.memory = NULL;
+		reserve.size = 0;
+	}
+
+	void enableCrashReport(int fd, bool symbolize, CrashReportFormat format)
+	{
+		::Backtrace::enableCrashReport(fd, symbolize,
+			format == CRASH_REPORT_BINARY ? ::Backtrace::CRASH_REPORT_BINARY : ::Backtrace::CRASH_REPORT_TEXT);
+	}
+
 	ExceptionBase::ExceptionBase(const ExceptionBase& that)
 		: BaseExceptionType()
 		, m_raiser(that.m_raiser)
 		, m_cloner(that.m_cloner)
 		, st(NULL)
+		, m_traceId(that.m_traceId)
 		, m_what(that.m_what)
 		, m_nested(NULL)
 	{
@@ -332,22 +971,46 @@ namespace ExceptionLib {
 		}
 	}
 
-	void NOINLINE ExceptionBase::setup(bool enableTrace, const ExceptionBase* nested)
+	// O primeiro endereco e o site: o retorno para a funcao que lancou,
+	// depois do setup e dos construtores
+	static int NOINLINE throw_stack(int depth, void** addrs)
+	{
+		return ::Backtrace::getPlatformStackLoader().getStackAddresses(depth, addrs, SKIP_FRAMES);
+	}
+
+	void NOINLINE ExceptionBase::setup(bool enableTrace, const ExceptionBase* nested, const std::type_info& type)
 	{
 		if (nested) {
 			m_nested = nested->clone();
 		}
+		// a pilha e percorrida uma vez so, o site e o trace saem do mesmo buffer
+		void* addrs[::Backtrace::MAX_STACK_DEPTH];
+		int n = 0;
+		int traced = 0;
+		const bool needSite = counting_sites() || Breadcrumbs::enabled();
 		if (stackEnabled && enableTrace) {
-			st = ::Backtrace::trace();
-			if (st) {
-				std::vector<Backtrace::StackFrame>& frames = st->getFrames();
-				if (frames.size() > SKIP_FRAMES) {
-					rotate(frames.begin(), frames.begin()+SKIP_FRAMES, frames.end());
-					frames.resize(frames.size()-SKIP_FRAMES);
-				} else {
-					frames.resize(0);
+			bool siteOnly = false;
+			int depth;
+			if (needSite) {
+				// o site decide a profundidade, entao captura a do tipo antes
+				n = throw_stack(std::max(1, std::min(depth_for(type, DEFAULT_DEPTH), ::Backtrace::MAX_STACK_DEPTH)), addrs);
+				depth = capture_depth(type, DEFAULT_DEPTH, n > 0 ? addrs[0] : NULL, &m_traceId, &siteOnly);
+			} else {
+				depth = capture_depth(type, DEFAULT_DEPTH, NULL, &m_traceId, &siteOnly);
+				if (depth > 0) {
+					n = throw_stack(std::min(depth, ::Backtrace::MAX_STACK_DEPTH), addrs);
 				}
 			}
+			traced = std::min(n, siteOnly ? 1 : depth);
+			if (traced > 0) {
+				// as excecoes lancadas do mesmo lugar compartilham o trace
+				st = ::Backtrace::internedTrace(addrs, traced);
+			}
+		} else if (needSite) {
+			n = throw_stack(1, addrs);
+		}
+		if (Breadcrumbs::enabled()) {
+			Breadcrumbs::recordException(type.name(), n > 0 ? addrs[0] : NULL, addrs, std::min(traced, Breadcrumbs::MAX_FRAMES));
 		}
 	}
 
@@ -359,4 +1022,69 @@ namespace ExceptionLib {
 	void stacktraceEnabled(bool enable) {
 		stackEnabled = enable;
 	}
+
+	void stacktraceSampling(unsigned tracesPerSecond) {
+		DepthPolicy& policy = depthPolicy();
+		depth_locker_t locker(&policy.lock);
+		policy.tracesPerSecond = tracesPerSecond;
+		policy.changed();
+	}
+
+	void throwSiteThrottling(unsigned maxPerSecond, ThrottleMode mode) {
+		DepthPolicy& policy = depthPolicy();
+		depth_locker_t locker(&policy.lock);
+		policy.maxSiteRate = maxPerSecond;
+		policy.throttleMode = mode;
+		policy.sites.clear();
+		policy.changed();
+	}
+
+	std::vector<ThrowSiteStats> throwSiteStats() {
+		DepthPolicy& policy = depthPolicy();
+		depth_locker_t locker(&policy.lock);
+		std::vector<ThrowSiteStats> stats;
+		stats.reserve(policy.sites.size());
+		for (SiteMap::const_iterator it = policy.sites.begin(); it != policy.sites.end(); ++it) {
+			ThrowSiteStats site;
+			site.site = it->first;
+			site.throws = it->second.total;
+			site.rate = it->second.lastRate;
+			site.throttled = it->second.throttled;
+			stats.push_back(site);
+		}
+		return stats;
+	}
+
+	void stacktraceDepth(int depth) {
+		DepthPolicy& policy = depthPolicy();
+		depth_locker_t locker(&policy.lock);
+		policy.globalDepth = std::max(depth, 0);
+		policy.changed();
+	}
+
+	void stacktraceDepth(const std::type_info& type, int depth) {
+		DepthPolicy& policy = depthPolicy();
+		depth_locker_t locker(&policy.lock);
+		policy.configured[&type] = std::max(depth, 0);
+		policy.changed();
+	}
+
+	int stacktraceDepthFor(const std::type_info& type) {
+		int defaultDepth = DEFAULT_DEPTH;
+#if __GNUC__
+		if (base_distance(type, typeid(ExceptionBase)) < 0) {
+			defaultDepth = DEFAULT_INTERCEPT_DEPTH;
+		}
+#endif
+		return depth_for(type, defaultDepth);
+	}
+
+#if __GNUC__
+	void throwTraceMode(ThrowTraceMode mode) {
+		traceMode = mode;
+	}
+#else
+	void throwTraceMode(ThrowTraceMode) {
+	}
+#endif
 }
@@ -12,6 +12,9 @@
 #include <exception>
 #include <stdexcept>
 #include <ostream>
+#include <typeinfo>
+#include <vector>
+#include <stdint.h>
 
 #ifdef SUPPORT_QT
 #include <QtCore>
@@ -110,10 +113,11 @@ namespace ExceptionLib {
 			: m_raiser(ExceptionFactory<Ex>::raise)
 			, m_cloner(ExceptionFactory<Ex>::clone)
 			, st(NULL)
+			, m_traceId(0)
 			, m_what(what)
 			, m_nested(NULL)
 		{
-			setup(enableTrace, nested);
+			setup(enableTrace, nested, typeid(Ex));
 		}
 
 		~ExceptionBase() throw();
@@ -140,6 +144,12 @@ namespace ExceptionLib {
 		 */
 		Backtrace::StackTrace* stacktrace() const;
 
+		/* Identifies this throw, it's also given to the exceptions whose
+		 * stacktrace wasn't captured because of the sampling (see
+		 * stacktraceSampling). 0 if the trace was disabled.
+		 */
+		uint64_t traceId() const { return m_traceId; }
+
 	private:
 		ExceptionBase();
 		ExceptionBase& operator=(const ExceptionBase&);
@@ -148,11 +158,12 @@ namespace ExceptionLib {
 		cloner m_cloner;
 
 		mutable ::Backtrace::StackTrace * st;
+		uint64_t m_traceId;
 
 		std::string m_what;
 		ExceptionBase* m_nested;
 
-		void NOINLINE setup(bool enableTrace, const ExceptionBase* nested);
+		void NOINLINE setup(bool enableTrace, const ExceptionBase* nested, const std::type_info& type);
 	};
 
 
@@ -362,14 +373,160 @@ namespace ExceptionLib {
     */
   void stacktraceEnabled(bool enable);
 
+  /* Number of frames captured in the stacktraces of exceptions. The depth set
+   * for a type applies to its subclasses, and when more than one ancestor has
+   * a depth the nearest one is used. Types without a depth use the global one.
+   * If it wasn't set either, ExceptionBase subclasses capture 28 frames and
+   * other std::exceptions 15. A depth of 0 disables the stacktrace. Cheap,
+   * expected exceptions can be limited to a few frames:
+   *
+   * ExceptionLib::stacktraceDepth<IOException>(4);
+   * ExceptionLib::stacktraceDepth<ProgrammingError>(64);
+   *
+   * The depth is limited to Backtrace::MAX_STACK_DEPTH (128) frames, or 64 for
+   * other std::exceptions.
+   */
+  void stacktraceDepth(int depth);
+  void stacktraceDepth(const std::type_info& type, int depth);
+
+  template <class Ex>
+  void stacktraceDepth(int depth) {
+	  stacktraceDepth(typeid(Ex), depth);
+  }
+
+  /* The depth that will be used for exceptions of the type */
+  int stacktraceDepthFor(const std::type_info& type);
+
+  /* Sampling of stacktraces, for when a few exception types are thrown so
+   * often that capturing all their traces is too expensive. With a rate
+   * greater than zero, only 1 in N throws of each type has its stacktrace
+   * captured, with N adjusted every second so that about tracesPerSecond
+   * traces of the type are captured. Rare exceptions are always traced. The
+   * other throws get only a trace id, which the logger prints in place of
+   * the trace. 0, the default, captures all of them.
+   */
+  void stacktraceSampling(unsigned tracesPerSecond);
+
+  /* What happens to the throws of a site that is above the maximum rate */
+  enum ThrottleMode {
+	  /* The stacktrace has only the address of the throw site */
+	  THROTTLE_ADDRESS_ONLY = 0,
+	  /* No stacktrace, only the trace id */
+	  THROTTLE_NO_TRACE
+  };
+
+  /* Counts the throws of each site (the return address in the throwing
+   * function) and stops capturing the full stacktrace of the sites thrown
+   * more than maxPerSecond times per second, until their rate drops. This
+   * keeps a failing dependency from turning an error storm into a CPU storm.
+   * 0, the default, disables the counters. For ExceptionBase subclasses the
+   * site is read from the stack, past the frames of the constructors, so
+   * the throws of one type from two functions are two sites.
+   */
+  void throwSiteThrottling(unsigned maxPerSecond, ThrottleMode mode = THROTTLE_ADDRESS_ONLY);
+
+  struct ThrowSiteStats {
+	  void* site;
+	  /* total since the counters were enabled */
+	  uint64_t throws;
+	  /* throws per second in the last complete window */
+	  unsigned rate;
+	  bool throttled;
+  };
+
+  /* The counters of the sites seen since throwSiteThrottling was called */
+  std::vector<ThrowSiteStats> throwSiteStats();
+
+  /* The trace id of the exception, see ExceptionBase::traceId(). For
+   * exceptions that don't derive from ExceptionBase, it can only be called
+   * inside a catch block, like getBT().
+   */
+  uint64_t traceId(const std::exception& ex);
+
+  /* Backtrace::fingerprint() of the stacktrace returned by getBT(), to group
+   * exceptions without loading their symbols. 0 if there's no stacktrace.
+   * The same restrictions of getBT() apply.
+   */
+  uint64_t stackFingerprint(const std::exception& ex);
+
+  /* Backends that can be used to walk the stack when a trace is captured.
+   */
+  enum StackUnwinder {
+	  /* The platform default, on linux it's glibc's backtrace() */
+	  UNWIND_DEFAULT = 0,
+	  /* Follows the chain of frame pointers. It's about an order of magnitude
+	   * faster than the default, but the trace stops at the first function
+	   * compiled without -fno-omit-frame-pointer. Where it isn't supported the
+	   * default is used.
+	   */
+	  UNWIND_FRAME_POINTER,
+	  /* Interprets the DWARF call frame information (.eh_frame), like the C++
+	   * runtime does, so it doesn't depend on frame pointers. The rule for each
+	   * address is cached, so repeated throws from the same paths are cheap.
+	   */
+	  UNWIND_CFI
+  };
+
   /* Enable global error handling. This function will overwite any handlers for
    * SIGSEGV, SIGFPE, SIGILL and SIGBUS. The C++ terminate handler will also
    * be overwritten.
    */
-  void init(const char *argv0);
+  void init(const char *argv0, StackUnwinder unwinder = UNWIND_DEFAULT);
+
+  /* Memory kept for the fatal error paths (Error::abort() and the terminate
+   * handler). They free it before logging the report, so the report still
+   * gets through when the process is out of memory, which is a common cause
+   * of the failure. If the log fails anyway, a plain report is written to
+   * stderr without allocating, see Backtrace::writeEmergencyReport().
+   *
+   * init() reserves 1 MB unless this was called before. The pages are
+   * touched, so they are really held by the process. 0 frees the reserve.
+   */
+  void emergencyReserve(size_t bytes);
+
+  /* Frees the reserve, for the fatal paths. The reserve isn't renewed. */
+  void releaseEmergencyReserve();
+
+  /* Formats of the crash report, see Backtrace::enableCrashReport() */
+  enum CrashReportFormat {
+	  CRASH_REPORT_TEXT = 0,
+	  /* Compact record to be decoded by the crash_reader tool */
+	  CRASH_REPORT_BINARY
+  };
+
+  /* Fatal signals are reported to fd (stderr by default) and terminate the
+   * process, instead of being thrown as SegmentationFault and the like. See
+   * Backtrace::enableCrashReport().
+   */
+  void enableCrashReport(int fd = 2, bool symbolize = true, CrashReportFormat format = CRASH_REPORT_TEXT);
+
+  /* How the backtrace of exceptions that don't derive from ExceptionBase
+   * (std::exception and its subclasses) is captured.
+   */
+  enum ThrowTraceMode {
+	  /* The stack is walked with the stack loader when the exception is thrown */
+	  THROW_TRACE_WALK = 0,
+	  /* The frames are recorded while the C++ runtime searches for the catch
+	   * block, so the stack isn't walked twice. The runtime only visits the
+	   * frames that have a catch block or objects to destroy, the other ones
+	   * don't appear in the trace. The trace also ends at the catch block. The
+	   * program must be linked with -Wl,--wrap,__gxx_personality_v0, otherwise
+	   * only the frame of the throw is recorded.
+	   */
+	  THROW_TRACE_UNWIND
+  };
+
+  void throwTraceMode(ThrowTraceMode mode);
 
   /* Get the backtrace for the current exception. This method can only be called inside a catch block. */
   const Backtrace::StackFrame* getBT(const std::exception& ex, size_t* depth, bool loadDebugSyms = false);
+
+  /* Number of frames visited by the C++ runtime between the throw and the catch
+   * block of the current exception, including the latter, or -1 if the trace
+   * wasn't recorded in the THROW_TRACE_UNWIND mode. Like getBT(), it can only be
+   * called inside a catch block.
+   */
+  int getUnwoundFrames();
 }
 
 inline std::ostream& operator<< (std::ostream& o, const ExceptionLib::Exception& e)
@@ -2,6 +2,8 @@
 
 #include "Exception.h"
 #include "BackTrace.h"
+#include "Breadcrumbs.h"
+#include "Demangling.h"
 
 #include <VectorIO.h>
 #include <vector>
@@ -316,6 +318,7 @@ namespace Log {
 		};
 
 		m_output->write(*this, level, vec, 7);
+		Breadcrumbs::recordLine(level, m_name.c_str(), str, len);
 	}
 }
 
@@ -323,6 +326,33 @@ namespace {
 
 #define MAX_NESTED 10
 
+	void formatBreadcrumbs(std::stringstream& result)
+	{
+		Breadcrumbs::Entry entries[Breadcrumbs::MAX_ENTRIES];
+		const int n = Breadcrumbs::collect(entries, Breadcrumbs::MAX_ENTRIES);
+		if (n == 0) {
+			return;
+		}
+		result << "\nBreadcrumbs:";
+		for (int i = 0; i < n; ++i) {
+			const Breadcrumbs::Entry& entry = entries[i];
+			result << "\n" << entry.sequence << ": ";
+			if (entry.kind == Breadcrumbs::LOG) {
+				result << levelNames[std::min<int>(entry.level, Log::LDEBUG2)] << " " << entry.text;
+			} else {
+				std::string type;
+				if (!Demangling::demangle(entry.text, type)) {
+					type = entry.text;
+				}
+				result << "throw " << type << " at " << entry.site;
+				const uint64_t fingerprint = Breadcrumbs::fingerprint(entry);
+				if (fingerprint != 0) {
+					result << ", fingerprint " << std::hex << fingerprint << std::dec;
+				}
+			}
+		}
+	}
+
     std::string formatException(int depth, const std::exception& t, const Log::Logger* l) {
 		using namespace Backtrace;
 
@@ -331,7 +361,13 @@ namespace {
 		if (l->getExceptionOpts() >= Log::LOG_ST) {
 			size_t depth = 0;
 			const StackFrame* frames = ExceptionLib::getBT(t, &depth, (l->getExceptionOpts() >= Log::LOG_ST_DBG));
-            result << t.what() << ":\n" << Backtrace::StackTrace::asString(depth, frames);
+			const uint64_t traceId = ExceptionLib::traceId(t);
+			if (depth == 0 && traceId != 0) {
+				// o trace desse throw nao foi amostrado
+				result << t.what() << ":\n[stacktrace not sampled, trace id " << traceId << "]";
+			} else {
+				result << t.what() << ":\n" << Backtrace::StackTrace::asString(depth, frames);
+			}
 		} else {
             result << t.what();
 		}
@@ -342,6 +378,10 @@ namespace {
             result << "\nNested exception: \n" << formatException(depth+1, *ex->nested(), l);
 		}
 
+		if (depth == 0 && Breadcrumbs::enabled()) {
+			formatBreadcrumbs(result);
+		}
+
         return result.str();
 	}
 
@@ -356,8 +396,31 @@ namespace Log {
 	BTPlaceHolder BT;
 
 	Formatter<BTPlaceHolder>::ret_type Formatter<BTPlaceHolder>::format(const BTPlaceHolder& , const Log::Logger*)	{
-		std::auto_ptr<Backtrace::StackTrace> trace(Backtrace::trace());
-        return trace->asString(true, 4 /* skip */);
+		// trace(), este metodo, F::doIt e Logger::log
+		Backtrace::StackTrace* trace = Backtrace::trace(32, 4);
+		const std::string str = trace->asString(true);
+		trace->decreaseCount();
+		return str;
+	}
+
+	ThreadsPlaceHolder ALL_THREADS;
+
+	Formatter<ThreadsPlaceHolder>::ret_type Formatter<ThreadsPlaceHolder>::format(const ThreadsPlaceHolder& , const Log::Logger* l)	{
+		// os nomes so sao carregados depois que todas as threads voltaram a rodar
+		std::vector<Backtrace::ThreadStack> stacks = Backtrace::snapshotAllThreads();
+		const bool loadDebug = l->getExceptionOpts() >= Log::LOG_ST_DBG;
+
+		std::stringstream result;
+		for (size_t i = 0; i < stacks.size(); ++i) {
+			result << "Thread " << stacks[i].threadId;
+			if (stacks[i].trace == NULL) {
+				result << ": stack not captured\n";
+				continue;
+			}
+			result << ":\n" << stacks[i].trace->asString(loadDebug);
+			stacks[i].trace->decreaseCount();
+		}
+		return result.str();
 	}
 
 	TimeMS NowMS;
@@ -5,6 +5,7 @@
 
 #include "ArrayPtr.h"
 #include "BackTrace.h"
+#include "Breadcrumbs.h"
 #include "Exception.h"
 #include "svector.h"
 #include "TypeManip.h"
@@ -67,6 +68,11 @@ namespace Log {
 
 	extern BTPlaceHolder BT;
 
+	// placeholder para o stack de todas as threads, ver Backtrace::snapshotAllThreads
+	struct ThreadsPlaceHolder {};
+
+	extern ThreadsPlaceHolder ALL_THREADS;
+
 	struct TimeMS {
         TimeMS(int64_t relativeTo = 0) : m_rel(relativeTo) {}
         int64_t m_rel;
@@ -98,6 +104,12 @@ namespace Log {
 		static ret_type format(const BTPlaceHolder& , const Log::Logger* l);
 	};
 
+	template<>
+	struct Formatter<ThreadsPlaceHolder> {
+        typedef std::string ret_type;
+		static ret_type format(const ThreadsPlaceHolder& , const Log::Logger* l);
+	};
+
 	template<>
 	struct Formatter<TimeMS> {
         typedef int64_t ret_type;
@@ -470,8 +482,11 @@ namespace Log {
 
 		void changeExceptionOpts(ExceptOpts o) { m_exOpts = o; }
 
+		// Every call is recorded in the thread's breadcrumbs, if enabled, even
+		// when the level filters it out
 		void log(Level l, const char* fmt) {
 			using namespace LogImpl;
+			Breadcrumbs::recordLog(l, fmt);
 			if (m_level >= l) {
 				output(l, fmt, strlen(fmt));
 			}
@@ -480,6 +495,7 @@ namespace Log {
 		template <class T1>
 		void log(Level l, const char* fmt, const T1& t1) {
 			using namespace LogImpl;
+			Breadcrumbs::recordLog(l, fmt);
             if (m_level >= l) {
                 std::string result = string_format::format(fmt, F<T1>::doIt(t1, this));
                 output(l, result.c_str(), result.size());
@@ -489,6 +505,7 @@ namespace Log {
 		template <class T1, class T2>
 		void log(Level l, const char* fmt, const T1& t1, const T2& t2) {
 			using namespace LogImpl;
+			Breadcrumbs::recordLog(l, fmt);
             if (m_level >= l) {
                 std::string result = string_format::format(fmt, F<T1>::doIt(t1, this), F<T2>::doIt(t2, this));
                 output(l, result.c_str(), result.size());
@@ -498,6 +515,7 @@ namespace Log {
 		template <class T1, class T2, class T3>
 		void log(Level l, const char* fmt, const T1& t1, const T2& t2, const T3& t3) {
 			using namespace LogImpl;
+			Breadcrumbs::recordLog(l, fmt);
             if (m_level >= l) {
                 std::string result = string_format::format(fmt, F<T1>::doIt(t1, this), F<T2>::doIt(t2, this), F<T3>::doIt(t3, this));
                 output(l, result.c_str(), result.size());
@@ -507,6 +525,7 @@ namespace Log {
 		template <class T1, class T2, class T3, class T4>
 		void log(Level l, const char* fmt, const T1& t1, const T2& t2, const T3& t3, const T4& t4) {
 			using namespace LogImpl;
+			Breadcrumbs::recordLog(l, fmt);
             if (m_level >= l) {
                 std::string result = string_format::format(fmt, F<T1>::doIt(t1, this), F<T2>::doIt(t2, this), F<T3>::doIt(t3, this), F<T4>::doIt(t4, this));
                 output(l, result.c_str(), result.size());
@@ -516,6 +535,7 @@ namespace Log {
 		template <class T1, class T2, class T3, class T4, class T5>
 		void log(Level l, const char* fmt, const T1& t1, const T2& t2, const T3& t3, const T4& t4, const T5& t5) {
 			using namespace LogImpl;
+			Breadcrumbs::recordLog(l, fmt);
             if (m_level >= l) {
                 std::string result = string_format::format(fmt, F<T1>::doIt(t1, this), F<T2>::doIt(t2, this), F<T3>::doIt(t3, this), F<T4>::doIt(t4, this), F<T5>::doIt(t5, this));
                 output(l, result.c_str(), result.size());
@@ -525,6 +545,7 @@ namespace Log {
 		template <class T1, class T2, class T3, class T4, class T5, class T6>
 		void log(Level l, const char* fmt, const T1& t1, const T2& t2, const T3& t3, const T4& t4, const T5& t5, const T6& t6) {
 			using namespace LogImpl;
+			Breadcrumbs::recordLog(l, fmt);
             if (m_level >= l) {
                 std::string result = string_format::format(fmt, F<T1>::doIt(t1, this), F<T2>::doIt(t2, this), F<T3>::doIt(t3, this), F<T4>::doIt(t4, this), F<T5>::doIt(t5, this), F<T6>::doIt(t6, this));
                 output(l, result.c_str(), result.size());
@@ -534,6 +555,7 @@ namespace Log {
 		template <class T1, class T2, class T3, class T4, class T5, class T6, class T7>
 		void log(Level l, const char* fmt, const T1& t1, const T2& t2, const T3& t3, const T4& t4, const T5& t5, const T6& t6, const T7& t7) {
 			using namespace LogImpl;
+			Breadcrumbs::recordLog(l, fmt);
             if (m_level >= l) {
                 std::string result = string_format::format(fmt, F<T1>::doIt(t1, this), F<T2>::doIt(t2, this), F<T3>::doIt(t3, this), F<T4>::doIt(t4, this), F<T5>::doIt(t5, this), F<T6>::doIt(t6, this), F<T7>::doIt(t7, this));
                 output(l, result.c_str(), result.size());
@@ -543,6 +565,7 @@ namespace Log {
 		template <class T1, class T2, class T3, class T4, class T5, class T6, class T7, class T8>
 		void log(Level l, const char* fmt, const T1& t1, const T2& t2, const T3& t3, const T4& t4, const T5& t5, const T6& t6, const T7& t7, const T8& t8) {
 			using namespace LogImpl;
+			Breadcrumbs::recordLog(l, fmt);
             if (m_level >= l) {
                 std::string result = string_format::format(fmt, F<T1>::doIt(t1, this), F<T2>::doIt(t2, this), F<T3>::doIt(t3, this), F<T4>::doIt(t4, this), F<T5>::doIt(t5, this), F<T6>::doIt(t6, this), F<T7>::doIt(t7, this), F<T8>::doIt(t8, this));
                 output(l, result.c_str(), result.size());
@@ -552,6 +575,7 @@ namespace Log {
 		template <class T1, class T2, class T3, class T4, class T5, class T6, class T7, class T8, class T9>
 		void log(Level l, const char* fmt, const T1& t1, const T2& t2, const T3& t3, const T4& t4, const T5& t5, const T6& t6, const T7& t7, const T8& t8, const T9& t9) {
 			using namespace LogImpl;
+			Breadcrumbs::recordLog(l, fmt);
             if (m_level >= l) {
                 std::string result = string_format::format(fmt, F<T1>::doIt(t1, this), F<T2>::doIt(t2, this), F<T3>::doIt(t3, this), F<T4>::doIt(t4, this), F<T5>::doIt(t5, this), F<T6>::doIt(t6, this), F<T7>::doIt(t7, this), F<T8>::doIt(t8, this), F<T9>::doIt(t9, this));
                 output(l, result.c_str(), result.size());
@@ -561,6 +585,7 @@ namespace Log {
 		template <class T1, class T2, class T3, class T4, class T5, class T6, class T7, class T8, class T9, class T10>
 		void log(Level l, const char* fmt, const T1& t1, const T2& t2, const T3& t3, const T4& t4, const T5& t5, const T6& t6, const T7& t7, const T8& t8, const T9& t9, const T10& t10) {
 			using namespace LogImpl;
+			Breadcrumbs::recordLog(l, fmt);
             if (m_level >= l) {
                 std::string result = string_format::format(fmt, F<T1>::doIt(t1, this), F<T2>::doIt(t2, this), F<T3>::doIt(t3, this), F<T4>::doIt(t4, this), F<T5>::doIt(t5, this), F<T6>::doIt(t6, this), F<T7>::doIt(t7, this), F<T8>::doIt(t8, this), F<T9>::doIt(t9, this), F<T10>::doIt(t10, this));
                 output(l, result.c_str(), result.size());
@@ -7,6 +7,14 @@
 
 namespace Backtrace {
 
+	// The loaders never return more frames than this
+	const int MAX_STACK_DEPTH = 128;
+
+	// Skip count that drops the frames at the top of the stack that are in
+	// the code of this library. It only works when the library is a shared
+	// object: if it was linked statically nothing is skipped.
+	const int SKIP_LIBRARY = -1;
+
 	// Interface for the stack provide backend.
 
 	class IStackAddresLoader {
@@ -16,14 +24,63 @@ namespace Backtrace {
 		// Returns the current callstack starting at the calling function
 		// At most depth addresses are loaded. The return value is the
         // actual number of stack addresses loaded. Only the addresses are
-        // guaranteed to be loaded, But implementations can load the function
-        // name and the module file name.
-		virtual int getStack(int depth, StackFrame* frames) = 0;
+        // guaranteed to be loaded, the function and module names can be
+        // filled later with loadSymbolNames. The first skip frames (or
+        // SKIP_LIBRARY) are dropped during the walk, they don't use any of
+        // the depth.
+		virtual int getStack(int depth, StackFrame* frames, int skip) = 0;
+
+		// Same as getStack, but only the return addresses are written to the
+		// array. Implementations must not allocate memory or take locks, so
+		// this can be called from signal handlers (crash reporting, sampling
+		// profilers). Backtrace::initialize() and initializeThread() load
+		// anything that would be loaded lazily.
+		virtual int getStackAddresses(int depth, void** addrs, int skip) = 0;
 
 	};
 
+	// Fills the function and module file names of frames captured by a
+	// stack loader. This is kept out of the capture because most traces
+	// are never printed.
+	void loadSymbolNames(StackFrame* frames, int nFrames);
+
+	// For each address, its offset in the file of the module that contains it
+	// and a hash of the module's file name, which don't change with ASLR or
+	// between runs. Unknown modules get a hash of 0 and the address itself.
+	// Doesn't load any symbols.
+	void moduleOffsets(void* const* addrs, int n, uintptr_t* offsets, uint64_t* modules);
+
+	// Like moduleOffsets, but the module is identified by its build-id where
+	// there is one (the whole path otherwise), so the same (module, offset)
+	// is the same code in any process and an address reused by another
+	// library after a dlclose gets a different key. This is the key of the
+	// symbol cache, and the traces record it when captured. If names isn't
+	// NULL it gets the hashes of moduleOffsets() from the same lookup.
+	void moduleAddresses(void* const* addrs, int n, uintptr_t* offsets, uint64_t* modules, uint64_t* names = NULL);
+
+	// Returns the backend currently in use. Unless another one was selected
+	// with setStackLoader this is the platform default.
 	IStackAddresLoader& getPlatformStackLoader();
 
+	// The default backend of the platform (glibc's backtrace on linux).
+	IStackAddresLoader& getDefaultStackLoader();
+
+	// Backend that walks the frame pointer chain. It is much cheaper than the
+	// default one but stops at the first function compiled without
+	// -fno-omit-frame-pointer. Returns NULL if the platform doesn't support it.
+	IStackAddresLoader* getFramePointerStackLoader();
+
+	// Backend that interprets the DWARF call frame information, so it also
+	// works with code compiled without frame pointers. The rule for each
+	// address is cached, repeated traces through the same code are almost as
+	// cheap as with the frame pointer backend. Returns NULL if the platform
+	// doesn't support it.
+	IStackAddresLoader* getCfiStackLoader();
+
+	// Changes the backend used by trace() and by the exception hooks. It should
+	// be called before other threads are started. NULL restores the default.
+	void setStackLoader(IStackAddresLoader* loader);
+
 }
 
 #endif // ISTACKADDRESSLOADER_H
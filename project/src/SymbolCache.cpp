@@ -1,4 +1,5 @@
 #include "SymbolCache.h"
+#include "StackAddressLoader.h"
 
 
 namespace BacktracePrivate {
@@ -13,24 +14,73 @@ namespace BacktracePrivate {
 		return inst;
 	}
 
-	const SymbolCache::CachedFrame* SymbolCache::cachedFor(void* address) const {
+	SymbolCache::Key SymbolCache::keyFor(void* address)
+	{
+		Key key;
+		moduleAddresses(&address, 1, &key.offset, &key.module);
+		return key;
+	}
+
+	bool SymbolCache::copyEntry(uint32_t id, StackFrame* frame, CacheState atLeast) const
+	{
+		if (id == 0 || id > m_symbols.size() || m_symbols[id - 1].state < atLeast) {
+			return false;
+		}
+		void* addr = frame->addr;
+		*frame = m_symbols[id - 1];
+		frame->addr = addr;
+		return true;
+	}
+
+	bool SymbolCache::fill(uint32_t id, StackFrame* frame, CacheState atLeast) const {
+        read_locker_t locker(&m_lock);
+		return copyEntry(id, frame, atLeast);
+	}
+
+	bool SymbolCache::fill(const Key& key, StackFrame* frame, CacheState atLeast) const {
+        read_locker_t locker(&m_lock);
+		Cache::const_iterator it = m_cache.find(key);
+		if (it == m_cache.end()) {
+			return false;
+		}
+#ifdef USE_CXX11
+		return copyEntry(it->second, frame, atLeast);
+#elif defined USE_QT
+		return copyEntry(*it, frame, atLeast);
+#endif
+	}
+
+	uint32_t SymbolCache::find(const Key& key) const {
 
         read_locker_t locker(&m_lock);
-		Cache::const_iterator it = m_cache.find(address);
+		Cache::const_iterator it = m_cache.find(key);
 		if (it == m_cache.end()) {
-			return NULL;
+			return 0;
 		} else {
 #ifdef USE_CXX11
-            return &(it->second);
+            return it->second;
 #elif defined USE_QT
-            return &(*it);
+            return *it;
 #endif
 		}
 	}
 
 	void SymbolCache::updateCache(StackFrame* frame, CacheState state) {
+		intern(keyFor(frame->addr), frame, state);
+	}
+
+	uint32_t SymbolCache::intern(const Key& key, const StackFrame* frame, CacheState state) {
+		// o offset e o proprio endereco, que pode ser de outro codigo depois
+		if (key.module == 0) {
+			return 0;
+		}
         write_locker_t locker(&m_lock);
-		CachedFrame& cframe = m_cache[frame->addr];
+		uint32_t& id = m_cache[key];
+		if (id == 0) {
+			m_symbols.push_back(CachedFrame());
+			id = static_cast<uint32_t>(m_symbols.size());
+		}
+		CachedFrame& cframe = m_symbols[id - 1];
 
 		if (state > cframe.state) {
 			cframe.state = state;
@@ -44,6 +94,7 @@ namespace BacktracePrivate {
 				cframe.sourceFile = frame->sourceFile;
 			}
 		}
+		return id;
 	}
 
 }
@@ -4,6 +4,8 @@
 #include "config.h"
 #include "BackTrace.h"
 
+#include <deque>
+
 
 #ifdef USE_CXX11
     #include <unordered_map>
@@ -27,6 +29,22 @@ namespace BacktracePrivate {
 			SymbolsLoaded = 2
 		};
 
+		/* The entries are keyed by the module and the offset of the address in
+		 * its file (see moduleAddresses()), not by the address: they stay
+		 * right when a library is unloaded and another one takes its place,
+		 * and they mean the same in any run of the same binaries.
+		 */
+		struct Key {
+			uint64_t module;
+			uintptr_t offset;
+
+			Key() : module(0), offset(0) {}
+			Key(uint64_t m, uintptr_t o) : module(m), offset(o) {}
+			bool operator==(const Key& that) const { return module == that.module && offset == that.offset; }
+		};
+
+		static Key keyFor(void* address);
+
 		struct CachedFrame: public StackFrame {
 			CacheState state;
 
@@ -35,16 +53,42 @@ namespace BacktracePrivate {
 			CachedFrame(const CachedFrame& that) : StackFrame(that), state(that.state) {}
 		};
 
-		const CachedFrame* cachedFor(void* address) const;
+		/* Copies the names of the entry to the frame if the entry has at least
+		 * the given state, under the lock: intern() updates the entries in
+		 * place. The frame keeps its own address, the entry may come from a
+		 * run where the module was elsewhere. Returns false, and the frame is
+		 * left alone, if there is no such entry.
+		 */
+		bool fill(uint32_t id, StackFrame* frame, CacheState atLeast) const;
+		bool fill(const Key& key, StackFrame* frame, CacheState atLeast) const;
+
 		void updateCache(StackFrame* frame, CacheState state);
 
+		/* The entries are kept in an append-only table and never move, so the
+		 * traces keep only the 32 bit id of the entry of each address. The id
+		 * 0 is never used. The addresses outside of any module (module 0, the
+		 * offset is the address itself) aren't cached, the code there may be
+		 * replaced without a dlclose: they get the id 0.
+		 */
+		uint32_t intern(const Key& key, const StackFrame* frame, CacheState state);
+		// 0 if there is no entry for the key
+		uint32_t find(const Key& key) const;
+
 		static SymbolCache& instance();
 
 	private:
 		SymbolCache();
 
+		// chamado com o lock
+		bool copyEntry(uint32_t id, StackFrame* frame, CacheState atLeast) const;
+
 #ifdef USE_CXX11
-        typedef std::unordered_map<void*, CachedFrame> Cache;
+        struct KeyHash {
+            size_t operator()(const Key& key) const {
+                return static_cast<size_t>(key.module * 31 + key.offset);
+            }
+        };
+        typedef std::unordered_map<Key, uint32_t, KeyHash> Cache;
         // we'll have to wait for c++14 to use de shared_timed_mutex for read and write locks
         typedef std::mutex lock_t;
         struct Locker {
@@ -54,16 +98,26 @@ namespace BacktracePrivate {
         typedef Locker read_locker_t;
         typedef Locker write_locker_t;
 #elif defined USE_QT
-        typedef QHash<void*, CachedFrame> Cache;
+        typedef QHash<Key, uint32_t> Cache;
         typedef QReadWriteLock lock_t;
         typedef QReadLocker read_locker_t;
-        typedef QReadLocker write_locker_t;
+        typedef QWriteLocker write_locker_t;
 #endif
 
+		// id de cada modulo e offset
 		Cache m_cache;
+		// o deque nao move os elementos quando cresce
+		std::deque<CachedFrame> m_symbols;
         mutable lock_t m_lock;
 	};
 
+#ifdef USE_QT
+	inline uint qHash(const SymbolCache::Key& key)
+	{
+		return ::qHash(static_cast<quint64>(key.module * 31 + key.offset));
+	}
+#endif
+
 }
 
 #endif // SYMBOLCACHE_H
@@ -0,0 +1,344 @@
+#include "Watchdog.h"
+
+#include "BackTrace.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef USE_CXX11
+	#include <atomic>
+	#include <chrono>
+	#include <condition_variable>
+	#include <mutex>
+	#include <thread>
+#elif defined USE_QT
+	#include <QAtomicInt>
+	#include <QDateTime>
+	#include <QMutex>
+	#include <QThread>
+	#include <QThreadStorage>
+	#include <QWaitCondition>
+#endif
+
+namespace {
+
+	const int MAX_THREADS = 256;
+	const int MAX_NAME = 32;
+	const int MIN_CHECK_INTERVAL_MS = 10;
+
+#ifdef USE_CXX11
+	typedef std::atomic<int> beat_t;
+	typedef std::mutex lock_t;
+	struct Locker {
+		std::lock_guard<lock_t> guard;
+		Locker(lock_t* l) : guard(*l) {}
+	};
+	typedef Locker locker_t;
+
+	// ms de um relogio monotonico, so as diferencas importam
+	uint32_t nowMs()
+	{
+		std::chrono::steady_clock::duration duration = std::chrono::steady_clock::now().time_since_epoch();
+		return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+	}
+
+	int loadBeat(beat_t& beat) { return beat.load(std::memory_order_relaxed); }
+	void storeBeat(beat_t& beat, int value) { beat.store(value, std::memory_order_relaxed); }
+#elif defined USE_QT
+	typedef QAtomicInt beat_t;
+	typedef QMutex lock_t;
+	typedef QMutexLocker locker_t;
+
+	uint32_t nowMs()
+	{
+		return static_cast<uint32_t>(QDateTime::currentMSecsSinceEpoch());
+	}
+
+	int loadBeat(beat_t& beat) { return beat.fetchAndAddRelaxed(0); }
+	void storeBeat(beat_t& beat, int value) { beat.fetchAndStoreRelaxed(value); }
+#endif
+
+	struct Slot {
+		// so esse campo e acessado sem o lock
+		beat_t lastBeat;
+		// 0 quando o slot esta livre
+		int threadId;
+		bool reported;
+		char name[MAX_NAME];
+	};
+
+	struct State {
+		Slot slots[MAX_THREADS];
+		int deadlineMs;
+		std::string loggerName;
+		bool running;
+		lock_t lock;
+#ifdef USE_CXX11
+		std::thread thread;
+		std::condition_variable wakeUp;
+#elif defined USE_QT
+		QThread* thread;
+		QWaitCondition wakeUp;
+#endif
+
+		State() : deadlineMs(0), running(false)
+#ifdef USE_QT
+			, thread(NULL)
+#endif
+		{
+			for (int i = 0; i < MAX_THREADS; ++i) {
+				slots[i].threadId = 0;
+				slots[i].reported = false;
+				slots[i].name[0] = '\0';
+			}
+		}
+	};
+
+	// nunca e destruido, a thread do watchdog e as Registrations podem
+	// terminar depois dos destrutores estaticos
+	State& state()
+	{
+		static State* instance = new State();
+		return *instance;
+	}
+
+	struct Stalled {
+		int threadId;
+		std::string name;
+		uint32_t age;
+	};
+
+	void report(const Stalled& stalled, const std::string& loggerName)
+	{
+		Log::Logger& logger = Log::LoggerFactory::getLogger(loggerName);
+		Backtrace::StackTrace* trace = Backtrace::snapshotThread(stalled.threadId);
+		if (trace == NULL) {
+			logger.log(Log::LWARN, "Thread %1 (%2) sent no heartbeat for %3 ms, stack not captured",
+				stalled.threadId, stalled.name, stalled.age);
+			return;
+		}
+		const std::string stack = trace->asString(logger.getExceptionOpts() >= Log::LOG_ST_DBG);
+		trace->decreaseCount();
+		logger.log(Log::LWARN, "Thread %1 (%2) sent no heartbeat for %3 ms:\n%4",
+			stalled.threadId, stalled.name, stalled.age, stack);
+	}
+
+	// Procura as threads atrasadas com o lock, mas captura e loga sem ele
+	void check()
+	{
+		State& s = state();
+		std::vector<Stalled> stalled;
+		std::string loggerName;
+		{
+			locker_t locker(&s.lock);
+			const uint32_t now = nowMs();
+			for (int i = 0; i < MAX_THREADS; ++i) {
+				Slot& slot = s.slots[i];
+				if (slot.threadId == 0) {
+					continue;
+				}
+				const uint32_t age = now - static_cast<uint32_t>(loadBeat(slot.lastBeat));
+				if (age <= static_cast<uint32_t>(s.deadlineMs)) {
+					slot.reported = false;
+				} else if (!slot.reported) {
+					slot.reported = true;
+					Stalled st;
+					st.threadId = slot.threadId;
+					st.name = slot.name;
+					st.age = age;
+					stalled.push_back(st);
+				}
+			}
+			loggerName = s.loggerName;
+		}
+
+		for (size_t i = 0; i < stalled.size(); ++i) {
+			report(stalled[i], loggerName);
+		}
+	}
+
+	int checkInterval(int deadlineMs)
+	{
+		return std::max(MIN_CHECK_INTERVAL_MS, deadlineMs / 4);
+	}
+
+#ifdef USE_CXX11
+	void run()
+	{
+		State& s = state();
+		std::unique_lock<lock_t> locker(s.lock);
+		while (s.running) {
+			s.wakeUp.wait_for(locker, std::chrono::milliseconds(checkInterval(s.deadlineMs)));
+			if (!s.running) {
+				break;
+			}
+			locker.unlock();
+			check();
+			locker.lock();
+		}
+	}
+#elif defined USE_QT
+	class WatchdogThread : public QThread {
+	protected:
+		void run() {
+			State& s = state();
+			s.lock.lock();
+			while (s.running) {
+				s.wakeUp.wait(&s.lock, checkInterval(s.deadlineMs));
+				if (!s.running) {
+					break;
+				}
+				s.lock.unlock();
+				check();
+				s.lock.lock();
+			}
+			s.lock.unlock();
+		}
+	};
+#endif
+
+	void wakeUp(State& s)
+	{
+#ifdef USE_CXX11
+		s.wakeUp.notify_all();
+#elif defined USE_QT
+		s.wakeUp.wakeAll();
+#endif
+	}
+
+	void release(int index)
+	{
+		if (index < 0) {
+			return;
+		}
+		State& s = state();
+		locker_t locker(&s.lock);
+		s.slots[index].threadId = 0;
+		s.slots[index].reported = false;
+	}
+
+	// Libera o slot quando a thread termina
+	struct Registration {
+		int slot;
+		Registration() : slot(-1) {}
+		~Registration() { release(slot); }
+	};
+
+#ifdef USE_CXX11
+	// o heartbeat so le o ponteiro, a Registration existe para o destrutor
+	thread_local Slot* localSlot = NULL;
+	thread_local Registration registration;
+
+	Registration* localRegistration() { return &registration; }
+	Slot* currentSlot() { return localSlot; }
+	void setCurrentSlot(Slot* slot) { localSlot = slot; }
+#elif defined USE_QT
+	QThreadStorage<Registration*> registrations;
+
+	Registration* localRegistration()
+	{
+		if (!registrations.hasLocalData()) {
+			registrations.setLocalData(new Registration());
+		}
+		return registrations.localData();
+	}
+
+	Slot* currentSlot()
+	{
+		if (!registrations.hasLocalData() || registrations.localData()->slot < 0) {
+			return NULL;
+		}
+		return &state().slots[registrations.localData()->slot];
+	}
+
+	void setCurrentSlot(Slot*) {}
+#endif
+}
+
+namespace Watchdog {
+
+	void start(int deadlineMs, const char* loggerName)
+	{
+		State& s = state();
+		locker_t locker(&s.lock);
+		s.deadlineMs = std::max(1, deadlineMs);
+		s.loggerName = loggerName;
+		if (s.running) {
+			wakeUp(s);
+			return;
+		}
+		s.running = true;
+#ifdef USE_CXX11
+		s.thread = std::thread(run);
+#elif defined USE_QT
+		s.thread = new WatchdogThread();
+		s.thread->start();
+#endif
+	}
+
+	void stop()
+	{
+		State& s = state();
+		{
+			locker_t locker(&s.lock);
+			if (!s.running) {
+				return;
+			}
+			s.running = false;
+			wakeUp(s);
+		}
+#ifdef USE_CXX11
+		s.thread.join();
+#elif defined USE_QT
+		s.thread->wait();
+		delete s.thread;
+		s.thread = NULL;
+#endif
+	}
+
+	void registerThread(const char* name)
+	{
+		Registration* registration = localRegistration();
+		if (registration->slot >= 0) {
+			return;
+		}
+
+		State& s = state();
+		locker_t locker(&s.lock);
+		for (int i = 0; i < MAX_THREADS; ++i) {
+			Slot& slot = s.slots[i];
+			if (slot.threadId != 0) {
+				continue;
+			}
+			slot.threadId = Backtrace::currentThreadId();
+			slot.reported = false;
+			strncpy(slot.name, name, MAX_NAME - 1);
+			slot.name[MAX_NAME - 1] = '\0';
+			storeBeat(slot.lastBeat, static_cast<int>(nowMs()));
+
+			registration->slot = i;
+			setCurrentSlot(&slot);
+			return;
+		}
+	}
+
+	void unregisterThread()
+	{
+		Registration* registration = localRegistration();
+		setCurrentSlot(NULL);
+		release(registration->slot);
+		registration->slot = -1;
+	}
+
+	void heartbeat()
+	{
+		Slot* slot = currentSlot();
+		if (slot != NULL) {
+			storeBeat(slot->lastBeat, static_cast<int>(nowMs()));
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+/* Detector de threads travadas: as threads registradas chamam heartbeat()
+ * no seu loop e uma thread do watchdog loga a pilha das que passam do prazo.
+ */
+
+#include "config.h"
+
+namespace Watchdog {
+
+	/* Starts the watchdog thread. A registered thread that doesn't call
+	 * heartbeat() for more than deadlineMs is reported once per stall: its
+	 * stack is captured with Backtrace::snapshotThread() and logged as a
+	 * warning to the named logger, formatted like Log::BT. Calling it again
+	 * changes the deadline.
+	 */
+	void start(int deadlineMs, const char* loggerName = "watchdog");
+
+	void stop();
+
+	/* Registers the calling thread, with a name for the reports. The thread
+	 * is unregistered when it finishes. At most 256 threads can be registered,
+	 * after that the call is ignored.
+	 */
+	void registerThread(const char* name = "");
+
+	void unregisterThread();
+
+	/* Tells the watchdog that the calling thread is alive. It doesn't lock
+	 * and doesn't allocate, so it can be called in every iteration of the
+	 * main loop of the thread. Does nothing if the thread isn't registered.
+	 */
+	void heartbeat();
+}
+
+#endif /* WATCHDOG_H */
@@ -1,6 +1,9 @@
 #include "DebugSymbolLoader.h"
 
 #include "SymbolCache.h"
+#ifdef __linux__
+#include "linux/Modules.h"
+#endif
 
 #include <bfd.h>
 #include <string>
@@ -64,18 +67,22 @@ namespace Backtrace {
 		{
 			for (int i = 0; i < nFrames; ++i) {
 
-				const SymbolCache::CachedFrame* frame = SymbolCache::instance().cachedFor(frames[i].addr);
+				SymbolCache& cache = SymbolCache::instance();
 
-				if (frame && frame->state == SymbolCache::SymbolsLoaded) {
-					frames[i] = *frame;
-				} else {
-					BFD_context& ctx = getBFD(frames[i].imageFile);
+				if (!cache.fill(SymbolCache::keyFor(frames[i].addr), &frames[i], SymbolCache::SymbolsLoaded)) {
+					string key;
+					string path;
+					bfd_vma addr;
+					if (!locate(frames[i], &key, &path, &addr)) {
+						continue;
+					}
+					BFD_context& ctx = getBFD(key, path);
 					if (ctx.valid) {
 						string source;
 						string function;
 						int line;
 
-						find(ctx, frames[i].addr, source, function, line);
+						find(ctx, addr, source, function, line);
 						if (function != ""){
 							frames[i].sourceFile = source;
 							frames[i].line = line;
@@ -83,6 +90,9 @@ namespace Backtrace {
 							if (!Demangling::demangle(function.c_str(), frames[i].function)) {
 								frames[i].function = function;
 							}
+							if (frames[i].imageFile.empty()) {
+								frames[i].imageFile = path;
+							}
 							SymbolCache::instance().updateCache(&frames[i], SymbolCache::SymbolsLoaded);
 						}
 					}
@@ -95,16 +105,37 @@ namespace Backtrace {
 		context_map m_contexts;
         mutex_t m_mutex;
 
-		BFD_context& getBFD(const std::string& moduleName) {
+		// Arquivo do modulo do frame e o endereco relativo a ele
+		static bool locate(const StackFrame& frame, string* key, string* path, bfd_vma* addr)
+		{
+#ifdef __linux__
+			// o endereco de retorno pode ser o inicio da proxima linha
+			const uintptr_t pc = reinterpret_cast<uintptr_t>(frame.addr) - 1;
+			ModuleInfo module;
+			if (frame.addr == NULL || !findModule(pc, &module)) {
+				return false;
+			}
+			*key = moduleKey(module);
+			*path = module.path;
+			*addr = pc - module.loadBias;
+#else
+			*key = frame.imageFile;
+			*path = frame.imageFile;
+			*addr = reinterpret_cast<bfd_vma>(frame.addr);
+#endif
+			return true;
+		}
+
+		BFD_context& getBFD(const std::string& key, const std::string& path) {
             mutex_locker_t locker(&m_mutex);
-			context_map::iterator it = m_contexts.find(moduleName);
+			context_map::iterator it = m_contexts.find(key);
 			if (it != m_contexts.end()) {
 				return it->second;
 			} else {
 
-				BFD_context& ctx = m_contexts[moduleName]; // chama o ctor default
+				BFD_context& ctx = m_contexts[key]; // chama o ctor default
 
-				bfd* context = bfd_openr(moduleName.c_str(), NULL);
+				bfd* context = bfd_openr(path.c_str(), NULL);
 
 				if (context) {
 
@@ -163,12 +194,12 @@ namespace Backtrace {
 		}
 
 
-		void find(BFD_context b, void* offset, string& file, string& func, int& line)
+		void find(BFD_context b, bfd_vma offset, string& file, string& func, int& line)
 		{
 			struct find_info data;
 			data.func = NULL;
 			data.symbols = &b.symbols[0];
-			data.counter = reinterpret_cast<bfd_vma>(offset);
+			data.counter = offset;
 			data.file = NULL;
 			data.func = NULL;
 			data.line = 0;
@@ -1,5 +1,7 @@
 #include "StackAddressLoader.h"
 
+#include <algorithm>
+
 namespace Backtrace {
 
     // Interface for the stack provide backend.
@@ -11,14 +13,44 @@ namespace Backtrace {
         // At most depth addresses are loaded. The return value is the
         // actual number of stack addresses loaded. The complete filesystem path
         // for each module is loaded as well, if possible
-        virtual int getStack(int, StackFrame*) { return 0; }
+        virtual int getStack(int, StackFrame*, int) { return 0; }
+
+        virtual int getStackAddresses(int, void**, int) { return 0; }
 
     };
 
-    IStackAddresLoader& getPlatformStackLoader()
+    void loadSymbolNames(StackFrame*, int) {}
+
+    void moduleOffsets(void* const* addrs, int n, uintptr_t* offsets, uint64_t* modules)
+    {
+        for (int i = 0; i < n; ++i) {
+            offsets[i] = reinterpret_cast<uintptr_t>(addrs[i]);
+            modules[i] = 0;
+        }
+    }
+
+    void moduleAddresses(void* const* addrs, int n, uintptr_t* offsets, uint64_t* modules, uint64_t* names)
+    {
+        // sem modulos, o proprio endereco
+        moduleOffsets(addrs, n, offsets, modules);
+        if (names) {
+            std::copy(modules, modules + n, names);
+        }
+    }
+
+    IStackAddresLoader& getDefaultStackLoader()
     {
         static DefaultStackLoader instance;
         return instance;
     }
 
+    IStackAddresLoader* getFramePointerStackLoader()
+    {
+        return NULL;
+    }
+
+    IStackAddresLoader* getCfiStackLoader()
+    {
+        return NULL;
+    }
 }
@@ -2,18 +2,28 @@
 #include "../Exception.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <execinfo.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 #include <cxxabi.h>
 
+#include <algorithm>
 #include <iterator>
 #include <vector>
 #include <sstream>
 #include <memory>
 
 #include "StackAddressLoader.h"
+#include "StackLoaderPrivate.h"
 #include "DebugSymbolLoader.h"
 
 using namespace std;
@@ -21,8 +31,117 @@ using namespace ExceptionLib;
 
 namespace {
 
-	void segfaulthandler(int signum, siginfo_t * info, void*)
+	using namespace Backtrace;
+
+	// Pilha alternativa dos handlers. Alem de formatar e lancar a excecao, o
+	// processo filho do relatorio de crash simboliza o trace nela.
+	const size_t ALT_STACK_SIZE = 256*1024;
+	// Falhas ate essa distancia abaixo da pilha sao consideradas stack overflow
+	const uintptr_t OVERFLOW_MARGIN = 256*1024;
+
+	static __thread bool threadInitialized = false;
+
+	pthread_once_t altStackOnce = PTHREAD_ONCE_INIT;
+	pthread_key_t altStackKey;
+
+	size_t pageSize()
+	{
+		static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		return size;
+	}
+
+	size_t altStackSize()
+	{
+		// SIGSTKSZ nao e constante nas versoes novas da glibc
+		const size_t size = std::max(ALT_STACK_SIZE, static_cast<size_t>(SIGSTKSZ));
+		return (size + pageSize() - 1) & ~(pageSize() - 1);
+	}
+
+	// destrutor da chave, roda na thread que esta terminando
+	void freeAltStack(void* memory)
 	{
+		stack_t disable;
+		disable.ss_sp = NULL;
+		disable.ss_size = 0;
+		disable.ss_flags = SS_DISABLE;
+		sigaltstack(&disable, NULL);
+		munmap(memory, altStackSize() + pageSize());
+	}
+
+	void createAltStackKey()
+	{
+		pthread_key_create(&altStackKey, freeAltStack);
+	}
+
+	// As paginas so sao alocadas de fato quando um handler usa a pilha, entao
+	// o custo por thread e so o do mmap
+	void setupAltStack()
+	{
+		stack_t current;
+		if (sigaltstack(NULL, &current) == 0 && !(current.ss_flags & SS_DISABLE)) {
+			// a aplicacao ja instalou uma
+			return;
+		}
+
+		const size_t size = altStackSize();
+		void* memory = mmap(NULL, size + pageSize(), PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+		if (memory == MAP_FAILED) {
+			return;
+		}
+		// pagina de guarda, o overflow da pilha alternativa tambem e detectado
+		mprotect(memory, pageSize(), PROT_NONE);
+
+		stack_t stack;
+		stack.ss_sp = static_cast<char*>(memory) + pageSize();
+		stack.ss_size = size;
+		stack.ss_flags = 0;
+		if (sigaltstack(&stack, NULL) != 0) {
+			munmap(memory, size + pageSize());
+			return;
+		}
+
+		pthread_once(&altStackOnce, createAltStackKey);
+		pthread_setspecific(altStackKey, memory);
+	}
+
+	bool isStackOverflow(void* addr)
+	{
+		stack_t current;
+		if (sigaltstack(NULL, &current) != 0 || !(current.ss_flags & SS_ONSTACK)) {
+			// sem a pilha alternativa o handler nem teria rodado
+			return false;
+		}
+		uintptr_t low, high;
+		BacktracePrivate::signalSafeStackBounds(&low, &high);
+		const uintptr_t fault = reinterpret_cast<uintptr_t>(addr);
+		return fault < low + pageSize() && fault + OVERFLOW_MARGIN >= low;
+	}
+
+	// O handler sai com a excecao e nao pelo sigreturn, entao a mascara do
+	// handler precisa ser desfeita antes, senao a proxima falha mata o processo
+	void unblockCrashSignals()
+	{
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGSEGV);
+		sigaddset(&set, SIGBUS);
+		sigaddset(&set, SIGILL);
+		sigaddset(&set, SIGFPE);
+		pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+	}
+
+	void segfaulthandler(int signum, siginfo_t * info, void* context)
+	{
+		// Nao da para lancar a excecao no stack overflow, o catch rodaria na
+		// pilha que estourou. Nesse caso, ou quando o relatorio foi habilitado,
+		// o crash e escrito sem alocar e o sinal volta para a acao padrao.
+		const bool overflow = (signum == SIGSEGV && isStackOverflow(info->si_addr));
+		if (overflow || BacktracePrivate::crashReportEnabled()) {
+			BacktracePrivate::reportCrash(signum, info, context, overflow ? "stack overflow" : NULL);
+			return;
+		}
+
 		stringstream ss;
 
 		void * addr = info->si_addr;
@@ -37,6 +156,7 @@ namespace {
 				} else if (code & SEGV_ACCERR) {
 					ss << ", invalid permissions for mapped object";
 				}
+				unblockCrashSignals();
 				throw SegmentationFault(ss.str());
 				break;
 			}
@@ -50,6 +170,7 @@ namespace {
 				} else if (code & BUS_OBJERR) {
 					ss << ", object-specific hardware error";
 				}
+				unblockCrashSignals();
 				throw SegmentationFault(ss.str());
 				break;
 			}
@@ -73,6 +194,7 @@ namespace {
 				} else if (code & FPE_FLTSUB) {
 					ss << ", subscript out of range";
 				}
+				unblockCrashSignals();
 				throw FloatingPointException(ss.str());
 				break;
 			}
@@ -96,18 +218,257 @@ namespace {
 				} else if (code & ILL_BADSTK) {
 					ss << ", internal stack error";
 				}
+				unblockCrashSignals();
 				throw IllegalInstruction(ss.str());
 				break;
 			}
 			default:
 			{
 				ss << "Caught unexpected signal: " << info->si_signo << addr;
+				unblockCrashSignals();
 				throw Exception(ss.str());
 				break;
 			}
 		}
 	}
 
+
+	// Estado do snapshot de todas as threads. O handler nao aloca nada, cada
+	// thread escreve so no seu slot, alocado antes dos sinais serem enviados.
+
+	// frames do handler e do trampolim do sinal
+	const int SNAPSHOT_SKIP = 2;
+	const int SNAPSHOT_TIMEOUT_MS = 200;
+
+	using BacktracePrivate::ThreadSlot;
+
+	struct Snapshot {
+		ThreadSlot* slots;
+		int nSlots;
+		int depth;
+	};
+
+	Snapshot* currentSnapshot = NULL;
+	// handlers que podem estar usando currentSnapshot
+	volatile int activeHandlers = 0;
+	pthread_mutex_t snapshotLock = PTHREAD_MUTEX_INITIALIZER;
+
+	// -1 enquanto for o padrao, SIGRTMIN nao e constante
+	int configuredSignal = -1;
+
+	int snapshotSignal()
+	{
+		const int signum = __atomic_load_n(&configuredSignal, __ATOMIC_RELAXED);
+		return signum < 0 ? SIGRTMIN + 3 : signum;
+	}
+
+	void snapshotHandler(int, siginfo_t*, void*)
+	{
+		const int savedErrno = errno;
+		__sync_fetch_and_add(&activeHandlers, 1);
+
+		Snapshot* snapshot = __atomic_load_n(&currentSnapshot, __ATOMIC_SEQ_CST);
+		if (snapshot != NULL) {
+			const pid_t tid = currentThreadId();
+			for (int i = 0; i < snapshot->nSlots; ++i) {
+				ThreadSlot& slot = snapshot->slots[i];
+				if (slot.tid == tid) {
+					if (!slot.done) {
+						slot.size = getPlatformStackLoader().getStackAddresses(snapshot->depth, slot.addrs, SNAPSHOT_SKIP);
+						__atomic_store_n(&slot.done, 1, __ATOMIC_RELEASE);
+					}
+					break;
+				}
+			}
+		}
+
+		__sync_fetch_and_sub(&activeHandlers, 1);
+		errno = savedErrno;
+	}
+
+	/* O handler so e instalado se o sinal esta com a acao padrao, um handler
+	 * do programa nao e trocado. sigaction() e segura dentro do handler de
+	 * crash, que tambem chama isso.
+	 */
+	bool installSnapshotHandler(int signum)
+	{
+		struct sigaction old;
+		if (signum <= 0 || sigaction(signum, NULL, &old) != 0) {
+			return false;
+		}
+		if ((old.sa_flags & SA_SIGINFO) && old.sa_sigaction == snapshotHandler) {
+			return true;
+		}
+		if (old.sa_handler != SIG_DFL) {
+			return false;
+		}
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_sigaction = snapshotHandler;
+		sigemptyset(&action.sa_mask);
+		action.sa_flags = SA_SIGINFO | SA_RESTART;
+		return sigaction(signum, &action, NULL) == 0;
+	}
+
+	bool allDone(const ThreadSlot* slots, int n)
+	{
+		for (int i = 0; i < n; ++i) {
+			if (!__atomic_load_n(&slots[i].done, __ATOMIC_ACQUIRE)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// o opendir() aloca, o crash report tambem lista as threads
+	struct LinuxDirent64 {
+		uint64_t d_ino;
+		int64_t d_off;
+		unsigned short d_reclen;
+		unsigned char d_type;
+		char d_name[1];
+	};
+}
+
+namespace BacktracePrivate {
+
+	int listThreadIds(pid_t* tids, int max)
+	{
+		const int dir = open("/proc/self/task", O_RDONLY | O_DIRECTORY);
+		if (dir < 0) {
+			return 0;
+		}
+		int n = 0;
+		char buffer[4096];
+		for (;;) {
+			const long size = syscall(SYS_getdents64, dir, buffer, sizeof(buffer));
+			if (size <= 0) {
+				break;
+			}
+			for (long pos = 0; pos < size;) {
+				const LinuxDirent64* entry = reinterpret_cast<const LinuxDirent64*>(buffer + pos);
+				pos += entry->d_reclen;
+
+				pid_t tid = 0;
+				for (const char* c = entry->d_name; *c >= '0' && *c <= '9'; ++c) {
+					tid = tid*10 + (*c - '0');
+				}
+				if (tid <= 0) {
+					continue;
+				}
+				// continua contando para o chamador saber quantas sao
+				if (n < max) {
+					tids[n] = tid;
+				}
+				++n;
+			}
+		}
+		close(dir);
+		return n;
+	}
+
+	bool signalThreads(ThreadSlot* slots, int n, int depth, int timeoutMs, bool tryOnly)
+	{
+		if (tryOnly) {
+			if (pthread_mutex_trylock(&snapshotLock) != 0) {
+				return false;
+			}
+		} else {
+			pthread_mutex_lock(&snapshotLock);
+		}
+
+		const int signum = snapshotSignal();
+		if (!installSnapshotHandler(signum)) {
+			pthread_mutex_unlock(&snapshotLock);
+			return false;
+		}
+
+		Snapshot snapshot = { slots, n, std::max(1, std::min(depth, MAX_STACK_DEPTH)) };
+		__atomic_store_n(&currentSnapshot, &snapshot, __ATOMIC_SEQ_CST);
+
+		const pid_t pid = getpid();
+		for (int i = 0; i < n; ++i) {
+			ThreadSlot& slot = slots[i];
+			if (!slot.done && syscall(SYS_tgkill, pid, slot.tid, signum) != 0) {
+				// a thread terminou antes do sinal
+				slot.size = -1;
+				slot.done = 1;
+			}
+		}
+
+		for (int waited = 0; waited < timeoutMs && !allDone(slots, n); ++waited) {
+			struct timespec ms = { 0, 1000000 };
+			nanosleep(&ms, NULL);
+		}
+
+		// os sinais que ainda nao foram tratados nao encontram mais o snapshot
+		__atomic_store_n(&currentSnapshot, static_cast<Snapshot*>(NULL), __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&activeHandlers, __ATOMIC_SEQ_CST) != 0) {
+			sched_yield();
+		}
+
+		pthread_mutex_unlock(&snapshotLock);
+		return true;
+	}
+}
+
+namespace {
+
+	void listThreads(std::vector<pid_t>& tids)
+	{
+		tids.resize(64);
+		for (;;) {
+			const int n = BacktracePrivate::listThreadIds(&tids[0], tids.size());
+			if (n <= static_cast<int>(tids.size())) {
+				tids.resize(n);
+				return;
+			}
+			// threads novas podem aparecer entre as chamadas
+			tids.resize(2*n);
+		}
+	}
+
+	// inline para que so o frame da funcao publica seja pulado na thread corrente
+	inline __attribute__((always_inline)) std::vector<ThreadStack> snapshotThreads(const std::vector<pid_t>& tids, int depth)
+	{
+		depth = std::max(1, std::min(depth, MAX_STACK_DEPTH));
+
+		std::vector<ThreadSlot> slots(tids.size());
+		const pid_t self = currentThreadId();
+		for (size_t i = 0; i < tids.size(); ++i) {
+			ThreadSlot& slot = slots[i];
+			slot.tid = tids[i];
+			slot.size = 0;
+			slot.done = 0;
+			if (slot.tid == self) {
+				// pula o frame da funcao publica
+				slot.size = getPlatformStackLoader().getStackAddresses(depth, slot.addrs, 1);
+				slot.done = 1;
+			}
+		}
+
+		if (!slots.empty()) {
+			BacktracePrivate::signalThreads(&slots[0], slots.size(), depth, SNAPSHOT_TIMEOUT_MS, false);
+		}
+
+		std::vector<ThreadStack> stacks;
+		stacks.reserve(slots.size());
+		for (size_t i = 0; i < slots.size(); ++i) {
+			const ThreadSlot& slot = slots[i];
+			if (slot.size < 0) {
+				continue;
+			}
+			ThreadStack stack;
+			stack.threadId = slot.tid;
+			stack.trace = NULL;
+			if (slot.done) {
+				stack.trace = trace(slot.addrs, slot.size);
+			}
+			stacks.push_back(stack);
+		}
+		return stacks;
+	}
+
 }
 
 
@@ -115,6 +476,7 @@ namespace Backtrace {
 	void initialize(const char* argv0)
 	{
 		initializeExecutablePath(argv0);
+		initializeThread();
 
 		struct sigaction action;
 
@@ -125,7 +487,8 @@ namespace Backtrace {
 		sigaddset(&action.sa_mask, SIGBUS);
 		sigaddset(&action.sa_mask, SIGILL);
 		sigaddset(&action.sa_mask, SIGFPE);
-		action.sa_flags = SA_SIGINFO;
+		// na pilha alternativa, para o stack overflow tambem ser reportado
+		action.sa_flags = SA_SIGINFO | SA_ONSTACK;
 
 		sigaction(SIGSEGV, &action, NULL);
 		sigaction(SIGBUS, &action, NULL);
@@ -134,6 +497,57 @@ namespace Backtrace {
 	}
 
 
+	void initializeThread()
+	{
+		if (threadInitialized) {
+			return;
+		}
+		threadInitialized = true;
+
+		setupAltStack();
+
+		// the first call to backtrace() loads libgcc, after that it's safe
+		void* addrs[2];
+		backtrace(addrs, 2);
+
+		uintptr_t low, high;
+		BacktracePrivate::currentStackBounds(&low, &high);
+		BacktracePrivate::loadLibraryRange();
+
+		// a regra de cada pc e calculada uma vez, depois vem do cache sem locks
+		IStackAddresLoader* cfi = getCfiStackLoader();
+		if (cfi != NULL) {
+			void* frames[32];
+			cfi->getStackAddresses(32, frames, 0);
+		}
+	}
+
+	std::vector<ThreadStack> snapshotAllThreads(int depth)
+	{
+		std::vector<pid_t> tids;
+		listThreads(tids);
+		return snapshotThreads(tids, depth);
+	}
+
+	StackTrace* snapshotThread(int threadId, int depth)
+	{
+		std::vector<ThreadStack> stacks = snapshotThreads(std::vector<pid_t>(1, threadId), depth);
+		return stacks.empty() ? NULL : stacks[0].trace;
+	}
+
+	void setSnapshotSignal(int signum)
+	{
+		// o handler fica no sinal anterior, um sinal atrasado ainda chega nele
+		pthread_mutex_lock(&snapshotLock);
+		__atomic_store_n(&configuredSignal, std::max(signum, 0), __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&snapshotLock);
+	}
+
+	int currentThreadId()
+	{
+		return static_cast<int>(syscall(SYS_gettid));
+	}
+
 	bool backtraceSupported()
 	{
 		return true;
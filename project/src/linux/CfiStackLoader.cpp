@@ -0,0 +1,832 @@
+#include "StackAddressLoader.h"
+#include "StackLoaderPrivate.h"
+#include "Modules.h"
+#include "DwarfReader.h"
+
+#include <algorithm>
+#include <string.h>
+#include <ucontext.h>
+
+/* Unwinder that interprets the DWARF call frame information (.eh_frame)
+ * of the modules, the same tables used by the C++ runtime to unwind the
+ * stack when an exception is thrown, so it works with code compiled
+ * without frame pointers.
+ *
+ * The FDE of each pc is found with a binary search over the table in
+ * .eh_frame_hdr. Interpreting the CFI program is the expensive part, so the
+ * resulting rule (how to compute the CFA, where the return address and the
+ * caller's rbp were saved) is kept in a lock-free hash table keyed by pc
+ * and by the unload epoch (see unloadEpoch()) it was computed in, so the
+ * rules from before a dlclose are computed again. A full neighbourhood
+ * replaces one of its rules, the cache holds the pcs seen last.
+ *
+ * Only x86_64 is supported. Frames whose rules depend on DWARF expressions
+ * end the trace, except for the signal trampoline of the kernel/glibc, which
+ * is recognized by its code and unwound through the saved ucontext.
+ */
+
+#if defined(__x86_64__)
+
+namespace {
+	using namespace Backtrace;
+	using namespace BacktracePrivate;
+
+	const int MAX_STACK = MAX_STACK_DEPTH;
+
+	// Numeracao dos registradores no DWARF do x86_64
+	const unsigned DWARF_RBP = 6;
+	const unsigned DWARF_RSP = 7;
+
+	enum RuleFlags {
+		RULE_VALID = 1,
+		RULE_RBP_SAVED = 2,
+		RULE_CFA_RBP = 4,
+		// the return address is undefined, it's the outermost frame
+		RULE_LAST_FRAME = 8,
+		// pc + 1 is the signal trampoline, the ucontext is on the stack
+		RULE_SIGNAL_FRAME = 16
+	};
+
+	// Packed in 64 bits so it can be stored and read in one go
+	struct Rule {
+		int32_t cfaOffset;
+		int8_t raOffset;  // in words, relative to the CFA
+		int8_t rbpOffset; // in words, relative to the CFA
+		uint8_t flags;
+		uint8_t reserved;
+	};
+
+	union PackedRule {
+		Rule rule;
+		uint64_t bits;
+	};
+
+	/*************************************************************************
+	 * Cache
+	 */
+
+	const size_t CACHE_SIZE = 4096; // must be a power of 2
+	const int MAX_PROBES = 8;
+	const uintptr_t SLOT_BUSY = 1;
+	// os enderecos de usuario do x86_64 tem 47 bits, o epoch vai nos bits de cima
+	const int EPOCH_SHIFT = 48;
+	const uintptr_t PC_MASK = (static_cast<uintptr_t>(1) << EPOCH_SHIFT) - 1;
+
+	/* The key of an entry is the pc with the low 16 bits of the unload epoch
+	 * it was computed in on top, so the rules from before a dlclose don't
+	 * match. A writer takes the slot by replacing its key with SLOT_BUSY,
+	 * and a reader checks the key again after reading the value, like a
+	 * seqlock. Only the rules of the same pc are published under a key, so a
+	 * slot that got the same key back in between still gives a good rule.
+	 */
+	struct CacheEntry {
+		uintptr_t key;
+		uint64_t value;
+	};
+
+	CacheEntry ruleCache[CACHE_SIZE];
+
+	inline size_t slotFor(uintptr_t pc)
+	{
+		return static_cast<size_t>((pc * 0x9E3779B97F4A7C15ULL) >> 52) & (CACHE_SIZE - 1);
+	}
+
+	inline uintptr_t keyFor(uintptr_t pc, unsigned epoch)
+	{
+		return (pc & PC_MASK) | (static_cast<uintptr_t>(epoch & 0xffff) << EPOCH_SHIFT);
+	}
+
+	// Regras de antes do ultimo dlclose contam como ausentes
+	bool cachedRule(uintptr_t pc, unsigned epoch, Rule* rule)
+	{
+		const uintptr_t wanted = keyFor(pc, epoch);
+		const size_t slot = slotFor(pc);
+		for (int i = 0; i < MAX_PROBES; ++i) {
+			CacheEntry& entry = ruleCache[(slot + i) & (CACHE_SIZE - 1)];
+			const uintptr_t key = __atomic_load_n(&entry.key, __ATOMIC_ACQUIRE);
+			if (key == wanted) {
+				PackedRule packed;
+				packed.bits = __atomic_load_n(&entry.value, __ATOMIC_RELAXED);
+				__atomic_thread_fence(__ATOMIC_ACQUIRE);
+				if (__atomic_load_n(&entry.key, __ATOMIC_RELAXED) != wanted) {
+					// o slot foi tomado por outra regra durante a leitura
+					return false;
+				}
+				*rule = packed.rule;
+				return true;
+			}
+			if (key == 0) {
+				return false;
+			}
+		}
+		return false;
+	}
+
+	/* The rule goes to an empty slot of the neighbourhood, or replaces the
+	 * rule of the same pc or one from another epoch. With all of them in use
+	 * by the current epoch, it replaces one chosen by the pc, so a hot pc
+	 * that collides isn't computed again on every unwind.
+	 */
+	void cacheRule(uintptr_t pc, unsigned epoch, const Rule& rule)
+	{
+		PackedRule packed;
+		packed.bits = 0;
+		packed.rule = rule;
+
+		const uintptr_t newKey = keyFor(pc, epoch);
+		const uintptr_t current = keyFor(0, epoch);
+		const size_t slot = slotFor(pc);
+		int victim = -1;
+		for (int i = 0; i < MAX_PROBES && victim < 0; ++i) {
+			const size_t index = (slot + i) & (CACHE_SIZE - 1);
+			const uintptr_t key = __atomic_load_n(&ruleCache[index].key, __ATOMIC_RELAXED);
+			const bool stale = key != SLOT_BUSY && ((key & PC_MASK) == (pc & PC_MASK) || (key & ~PC_MASK) != current);
+			if (key == 0 || stale) {
+				victim = static_cast<int>(index);
+			}
+		}
+		if (victim < 0) {
+			victim = static_cast<int>((slot + ((pc >> 4) & (MAX_PROBES - 1))) & (CACHE_SIZE - 1));
+		}
+
+		CacheEntry& entry = ruleCache[victim];
+		uintptr_t key = __atomic_load_n(&entry.key, __ATOMIC_RELAXED);
+		// outra thread esta escrevendo no slot, a regra nao sera guardada
+		if (key == SLOT_BUSY || !__atomic_compare_exchange_n(&entry.key, &key, SLOT_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			return;
+		}
+		// quem ler o valor novo ve o SLOT_BUSY ao conferir a chave
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		__atomic_store_n(&entry.value, packed.bits, __ATOMIC_RELAXED);
+		__atomic_store_n(&entry.key, newKey, __ATOMIC_RELEASE);
+	}
+
+	/*************************************************************************
+	 * Leitura do .eh_frame
+	 */
+
+	enum {
+		DW_EH_PE_absptr = 0x00,
+		DW_EH_PE_uleb128 = 0x01,
+		DW_EH_PE_udata2 = 0x02,
+		DW_EH_PE_udata4 = 0x03,
+		DW_EH_PE_udata8 = 0x04,
+		DW_EH_PE_sleb128 = 0x09,
+		DW_EH_PE_sdata2 = 0x0a,
+		DW_EH_PE_sdata4 = 0x0b,
+		DW_EH_PE_sdata8 = 0x0c,
+		DW_EH_PE_pcrel = 0x10,
+		DW_EH_PE_datarel = 0x30,
+		DW_EH_PE_indirect = 0x80,
+		DW_EH_PE_omit = 0xff
+	};
+
+	// Os valores codificados do .eh_frame, relativos ao proprio campo ou a .eh_frame_hdr
+	class Reader: public DwarfReader {
+	public:
+		Reader(const uint8_t* p, const uint8_t* end, uintptr_t dataBase = 0)
+			: DwarfReader(p, end), m_dataBase(dataBase) {}
+
+		uintptr_t encoded(uint8_t encoding) {
+			if (encoding == DW_EH_PE_omit) {
+				return 0;
+			}
+			const uintptr_t fieldAddr = reinterpret_cast<uintptr_t>(m_p);
+			uintptr_t value = 0;
+
+			switch (encoding & 0x0f) {
+				case DW_EH_PE_absptr: value = read<uintptr_t>(); break;
+				case DW_EH_PE_uleb128: value = uleb(); break;
+				case DW_EH_PE_udata2: value = read<uint16_t>(); break;
+				case DW_EH_PE_udata4: value = read<uint32_t>(); break;
+				case DW_EH_PE_udata8: value = read<uint64_t>(); break;
+				case DW_EH_PE_sleb128: value = sleb(); break;
+				case DW_EH_PE_sdata2: value = read<int16_t>(); break;
+				case DW_EH_PE_sdata4: value = read<int32_t>(); break;
+				case DW_EH_PE_sdata8: value = read<int64_t>(); break;
+				default: m_ok = false; return 0;
+			}
+			if (value == 0) {
+				return 0;
+			}
+
+			switch (encoding & 0x70) {
+				case 0: break;
+				case DW_EH_PE_pcrel: value += fieldAddr; break;
+				case DW_EH_PE_datarel: value += m_dataBase; break;
+				default: m_ok = false; return 0;
+			}
+
+			if (encoding & DW_EH_PE_indirect) {
+				value = *reinterpret_cast<const uintptr_t*>(value);
+			}
+			return value;
+		}
+
+	private:
+		uintptr_t m_dataBase;
+	};
+
+	// Reads the header of a CIE or FDE, returns the end of the entry
+	const uint8_t* entryBounds(const uint8_t* entry, const uint8_t** contents)
+	{
+		uint64_t length;
+		memcpy(&length, entry, 4);
+		length &= 0xffffffff;
+		entry += 4;
+		if (length == 0xffffffff) {
+			memcpy(&length, entry, 8);
+			entry += 8;
+		}
+		*contents = entry;
+		return entry + length;
+	}
+
+	struct Cie {
+		uint64_t codeAlign;
+		int64_t dataAlign;
+		uint64_t raRegister;
+		uint8_t fdeEncoding;
+		bool hasAugmentationData;
+		const uint8_t* instructions;
+		const uint8_t* end;
+	};
+
+	bool parseCie(const uint8_t* entry, Cie* cie)
+	{
+		const uint8_t* contents;
+		const uint8_t* end = entryBounds(entry, &contents);
+		Reader r(contents, end);
+
+		if (r.read<uint32_t>() != 0) {
+			return false;
+		}
+		const uint8_t version = r.read<uint8_t>();
+
+		const char* augmentation = reinterpret_cast<const char*>(r.pos());
+		const size_t augLen = strnlen(augmentation, end - r.pos());
+		r.skip(augLen + 1);
+
+		if (augmentation[0] == 'e' && augmentation[1] == 'h') {
+			r.read<uintptr_t>();
+		}
+
+		cie->codeAlign = r.uleb();
+		cie->dataAlign = r.sleb();
+		cie->raRegister = (version == 1) ? r.read<uint8_t>() : r.uleb();
+		cie->fdeEncoding = DW_EH_PE_absptr;
+		cie->hasAugmentationData = false;
+
+		if (augmentation[0] == 'z') {
+			cie->hasAugmentationData = true;
+			const uint64_t augDataLen = r.uleb();
+			const uint8_t* augDataEnd = r.pos() + augDataLen;
+
+			for (const char* a = augmentation + 1; *a != '\0' && r.ok(); ++a) {
+				switch (*a) {
+					case 'L':
+						r.read<uint8_t>();
+						break;
+					case 'P':
+					{
+						const uint8_t encoding = r.read<uint8_t>();
+						// the personality itself isn't needed, skip it without
+						// following indirections
+						r.encoded(encoding & ~DW_EH_PE_indirect);
+						break;
+					}
+					case 'R':
+						cie->fdeEncoding = r.read<uint8_t>();
+						break;
+					case 'S':
+					case 'B':
+						break;
+					default:
+						// desconhecido, mas o tamanho dos dados permite pular
+						break;
+				}
+			}
+			r.skip(augDataEnd - r.pos());
+		}
+		cie->instructions = r.pos();
+		cie->end = end;
+		return r.ok();
+	}
+
+	/*************************************************************************
+	 * Interpretacao das instrucoes de CFA
+	 */
+
+	enum RegRuleType {
+		REG_SAME = 0,
+		REG_UNDEFINED,
+		REG_OFFSET,
+		REG_UNSUPPORTED
+	};
+
+	struct RegRule {
+		RegRuleType type;
+		int64_t offset;
+	};
+
+	struct CfaState {
+		uint64_t cfaRegister;
+		int64_t cfaOffset;
+		bool cfaUnsupported;
+		RegRule rbp;
+		RegRule ra;
+	};
+
+	class CfaInterpreter {
+	public:
+		CfaInterpreter(const Cie& cie, uintptr_t targetPc, uintptr_t dataBase)
+			: m_cie(cie), m_target(targetPc), m_dataBase(dataBase), m_loc(0), m_stackDepth(0)
+		{
+			m_state.cfaRegister = DWARF_RSP;
+			m_state.cfaOffset = 0;
+			m_state.cfaUnsupported = false;
+			m_state.rbp.type = REG_SAME;
+			m_state.rbp.offset = 0;
+			m_state.ra.type = REG_SAME;
+			m_state.ra.offset = 0;
+		}
+
+		bool runCie() {
+			const bool ok = run(m_cie.instructions, m_cie.end, true);
+			m_initial = m_state;
+			return ok;
+		}
+
+		bool runFde(const uint8_t* begin, const uint8_t* end, uintptr_t start) {
+			m_loc = start;
+			return run(begin, end, false);
+		}
+
+		const CfaState& state() const { return m_state; }
+
+	private:
+		RegRule* ruleFor(uint64_t reg) {
+			if (reg == DWARF_RBP) return &m_state.rbp;
+			if (reg == m_cie.raRegister) return &m_state.ra;
+			return NULL;
+		}
+
+		RegRule initialFor(uint64_t reg) {
+			if (reg == DWARF_RBP) return m_initial.rbp;
+			return m_initial.ra;
+		}
+
+		void setOffset(uint64_t reg, int64_t offset) {
+			RegRule* rule = ruleFor(reg);
+			if (rule) {
+				rule->type = REG_OFFSET;
+				rule->offset = offset;
+			}
+		}
+
+		void setType(uint64_t reg, RegRuleType type) {
+			RegRule* rule = ruleFor(reg);
+			if (rule) {
+				rule->type = type;
+			}
+		}
+
+		// retorna false quando a instrucao passa do pc procurado
+		bool advance(uint64_t delta, bool inCie) {
+			if (inCie) {
+				return true;
+			}
+			m_loc += delta * m_cie.codeAlign;
+			return m_loc <= m_target;
+		}
+
+		bool run(const uint8_t* begin, const uint8_t* end, bool inCie) {
+			Reader r(begin, end, m_dataBase);
+
+			while (!r.atEnd() && r.ok()) {
+				const uint8_t op = r.read<uint8_t>();
+				const uint8_t high = op & 0xc0;
+				const uint8_t low = op & 0x3f;
+
+				if (high == 0x40) { // DW_CFA_advance_loc
+					if (!advance(low, inCie)) return true;
+					continue;
+				}
+				if (high == 0x80) { // DW_CFA_offset
+					setOffset(low, static_cast<int64_t>(r.uleb()) * m_cie.dataAlign);
+					continue;
+				}
+				if (high == 0xc0) { // DW_CFA_restore
+					RegRule* rule = ruleFor(low);
+					if (rule) *rule = initialFor(low);
+					continue;
+				}
+
+				switch (op) {
+					case 0x00: // DW_CFA_nop
+						break;
+					case 0x01: // DW_CFA_set_loc
+					{
+						const uintptr_t loc = r.encoded(m_cie.fdeEncoding);
+						if (!inCie) {
+							m_loc = loc;
+							if (m_loc > m_target) return true;
+						}
+						break;
+					}
+					case 0x02: // DW_CFA_advance_loc1
+						if (!advance(r.read<uint8_t>(), inCie)) return true;
+						break;
+					case 0x03: // DW_CFA_advance_loc2
+						if (!advance(r.read<uint16_t>(), inCie)) return true;
+						break;
+					case 0x04: // DW_CFA_advance_loc4
+						if (!advance(r.read<uint32_t>(), inCie)) return true;
+						break;
+					case 0x05: // DW_CFA_offset_extended
+					{
+						const uint64_t reg = r.uleb();
+						setOffset(reg, static_cast<int64_t>(r.uleb()) * m_cie.dataAlign);
+						break;
+					}
+					case 0x06: // DW_CFA_restore_extended
+					{
+						const uint64_t reg = r.uleb();
+						RegRule* rule = ruleFor(reg);
+						if (rule) *rule = initialFor(reg);
+						break;
+					}
+					case 0x07: // DW_CFA_undefined
+						setType(r.uleb(), REG_UNDEFINED);
+						break;
+					case 0x08: // DW_CFA_same_value
+						setType(r.uleb(), REG_SAME);
+						break;
+					case 0x09: // DW_CFA_register
+					{
+						const uint64_t reg = r.uleb();
+						r.uleb();
+						setType(reg, REG_UNSUPPORTED);
+						break;
+					}
+					case 0x0a: // DW_CFA_remember_state
+						if (m_stackDepth == STATE_STACK) return false;
+						m_stack[m_stackDepth++] = m_state;
+						break;
+					case 0x0b: // DW_CFA_restore_state
+						if (m_stackDepth == 0) return false;
+						m_state = m_stack[--m_stackDepth];
+						break;
+					case 0x0c: // DW_CFA_def_cfa
+						m_state.cfaRegister = r.uleb();
+						m_state.cfaOffset = r.uleb();
+						m_state.cfaUnsupported = false;
+						break;
+					case 0x0d: // DW_CFA_def_cfa_register
+						m_state.cfaRegister = r.uleb();
+						m_state.cfaUnsupported = false;
+						break;
+					case 0x0e: // DW_CFA_def_cfa_offset
+						m_state.cfaOffset = r.uleb();
+						break;
+					case 0x0f: // DW_CFA_def_cfa_expression
+						r.skip(r.uleb());
+						m_state.cfaUnsupported = true;
+						break;
+					case 0x10: // DW_CFA_expression
+					case 0x16: // DW_CFA_val_expression
+					{
+						const uint64_t reg = r.uleb();
+						r.skip(r.uleb());
+						setType(reg, REG_UNSUPPORTED);
+						break;
+					}
+					case 0x11: // DW_CFA_offset_extended_sf
+					{
+						const uint64_t reg = r.uleb();
+						setOffset(reg, r.sleb() * m_cie.dataAlign);
+						break;
+					}
+					case 0x12: // DW_CFA_def_cfa_sf
+						m_state.cfaRegister = r.uleb();
+						m_state.cfaOffset = r.sleb() * m_cie.dataAlign;
+						m_state.cfaUnsupported = false;
+						break;
+					case 0x13: // DW_CFA_def_cfa_offset_sf
+						m_state.cfaOffset = r.sleb() * m_cie.dataAlign;
+						break;
+					case 0x14: // DW_CFA_val_offset
+					{
+						const uint64_t reg = r.uleb();
+						r.uleb();
+						setType(reg, REG_UNSUPPORTED);
+						break;
+					}
+					case 0x15: // DW_CFA_val_offset_sf
+					{
+						const uint64_t reg = r.uleb();
+						r.sleb();
+						setType(reg, REG_UNSUPPORTED);
+						break;
+					}
+					case 0x2e: // DW_CFA_GNU_args_size
+						r.uleb();
+						break;
+					case 0x2f: // DW_CFA_GNU_negative_offset_extended
+					{
+						const uint64_t reg = r.uleb();
+						setOffset(reg, -static_cast<int64_t>(r.uleb()) * m_cie.dataAlign);
+						break;
+					}
+					default:
+						return false;
+				}
+			}
+			return r.ok();
+		}
+
+		static const int STATE_STACK = 8;
+
+		const Cie& m_cie;
+		uintptr_t m_target;
+		uintptr_t m_dataBase;
+		uintptr_t m_loc;
+		CfaState m_state;
+		CfaState m_initial;
+		CfaState m_stack[STATE_STACK];
+		int m_stackDepth;
+	};
+
+	// Binary search in the table of .eh_frame_hdr. Returns the FDE covering pc
+	const uint8_t* findFde(uintptr_t hdrAddr, uintptr_t pc)
+	{
+		const uint8_t* hdr = reinterpret_cast<const uint8_t*>(hdrAddr);
+		if (hdr[0] != 1) {
+			return NULL;
+		}
+		const uint8_t ehFramePtrEnc = hdr[1];
+		const uint8_t fdeCountEnc = hdr[2];
+		const uint8_t tableEnc = hdr[3];
+
+		// o ld sempre gera a tabela com datarel|sdata4
+		if (tableEnc != (DW_EH_PE_datarel | DW_EH_PE_sdata4) || fdeCountEnc == DW_EH_PE_omit) {
+			return NULL;
+		}
+
+		Reader r(hdr + 4, hdr + 4 + 64, hdrAddr);
+		r.encoded(ehFramePtrEnc);
+		const uintptr_t count = r.encoded(fdeCountEnc);
+		if (!r.ok() || count == 0) {
+			return NULL;
+		}
+
+		const int32_t* table = reinterpret_cast<const int32_t*>(r.pos());
+		size_t lo = 0;
+		size_t hi = count;
+
+		while (hi - lo > 1) {
+			const size_t mid = lo + (hi - lo) / 2;
+			const uintptr_t start = hdrAddr + static_cast<intptr_t>(table[2*mid]);
+			if (pc < start) {
+				hi = mid;
+			} else {
+				lo = mid;
+			}
+		}
+
+		if (pc < hdrAddr + static_cast<intptr_t>(table[2*lo])) {
+			return NULL;
+		}
+		return reinterpret_cast<const uint8_t*>(hdrAddr + static_cast<intptr_t>(table[2*lo+1]));
+	}
+
+	bool toWords(int64_t bytes, int8_t* words)
+	{
+		if (bytes % static_cast<int64_t>(sizeof(void*)) != 0) {
+			return false;
+		}
+		const int64_t w = bytes / static_cast<int64_t>(sizeof(void*));
+		if (w < -128 || w > 127) {
+			return false;
+		}
+		*words = static_cast<int8_t>(w);
+		return true;
+	}
+
+	// __restore_rt: mov $__NR_rt_sigreturn, %rax; syscall
+	const uint8_t TRAMPOLINE_CODE[] = { 0x48, 0xc7, 0xc0, 0x0f, 0x00, 0x00, 0x00, 0x0f, 0x05 };
+
+	// Interprets the CFI of pc. Rules that can't be used are returned without RULE_VALID
+	Rule computeRule(uintptr_t pc)
+	{
+		Rule rule;
+		memset(&rule, 0, sizeof(rule));
+
+		ModuleInfo module;
+		// pode estar num handler de sinal, sem atualizar a tabela de modulos
+		if (!findModule(pc, &module, false)) {
+			return rule;
+		}
+
+		// pc e o endereco de retorno - 1, o codigo so e lido dentro do modulo
+		// (o trampolim fica na libc ou no vdso)
+		const uintptr_t ra = pc + 1;
+		if (ra + sizeof(TRAMPOLINE_CODE) <= module.textEnd
+				&& memcmp(reinterpret_cast<const void*>(ra), TRAMPOLINE_CODE, sizeof(TRAMPOLINE_CODE)) == 0) {
+			rule.flags = RULE_VALID | RULE_SIGNAL_FRAME;
+			return rule;
+		}
+
+		if (module.ehFrameHdr == 0) {
+			return rule;
+		}
+
+		const uint8_t* fde = findFde(module.ehFrameHdr, pc);
+		if (fde == NULL) {
+			return rule;
+		}
+
+		const uint8_t* contents;
+		const uint8_t* end = entryBounds(fde, &contents);
+		uint32_t ciePointer;
+		memcpy(&ciePointer, contents, 4);
+		if (ciePointer == 0) {
+			return rule; // e um CIE, nao um FDE
+		}
+		const uint8_t* cieEntry = contents - ciePointer;
+
+		Cie cie;
+		if (!parseCie(cieEntry, &cie)) {
+			return rule;
+		}
+
+		Reader r(contents + 4, end, module.ehFrameHdr);
+		const uintptr_t start = r.encoded(cie.fdeEncoding);
+		const uintptr_t range = r.encoded(cie.fdeEncoding & 0x0f);
+		if (!r.ok() || pc < start || pc >= start + range) {
+			return rule;
+		}
+		if (cie.hasAugmentationData) {
+			r.skip(r.uleb());
+		}
+
+		CfaInterpreter interpreter(cie, pc, module.ehFrameHdr);
+		if (!interpreter.runCie() || !interpreter.runFde(r.pos(), end, start)) {
+			return rule;
+		}
+
+		const CfaState& state = interpreter.state();
+
+		if (state.ra.type == REG_UNDEFINED) {
+			rule.flags = RULE_VALID | RULE_LAST_FRAME;
+			return rule;
+		}
+
+		if (state.cfaUnsupported || (state.cfaRegister != DWARF_RSP && state.cfaRegister != DWARF_RBP)) {
+			return rule;
+		}
+		if (static_cast<int32_t>(state.cfaOffset) != state.cfaOffset) {
+			return rule;
+		}
+		if (state.ra.type != REG_OFFSET || !toWords(state.ra.offset, &rule.raOffset)) {
+			return rule;
+		}
+
+		rule.cfaOffset = static_cast<int32_t>(state.cfaOffset);
+		if (state.cfaRegister == DWARF_RBP) {
+			rule.flags |= RULE_CFA_RBP;
+		}
+
+		if (state.rbp.type == REG_OFFSET) {
+			if (!toWords(state.rbp.offset, &rule.rbpOffset)) {
+				return rule;
+			}
+			rule.flags |= RULE_RBP_SAVED;
+		} else if (state.rbp.type != REG_SAME) {
+			return rule;
+		}
+
+		rule.flags |= RULE_VALID;
+		return rule;
+	}
+
+	int unwind(uintptr_t pc, uintptr_t sp, uintptr_t fp, uintptr_t stackLow, uintptr_t stackHigh, int depth, int skip, void** addrs)
+	{
+		depth = std::min(MAX_STACK, depth);
+		int n = 0;
+		const unsigned epoch = unloadEpoch();
+
+		while (n < depth) {
+			Rule rule;
+			if (!cachedRule(pc, epoch, &rule)) {
+				rule = computeRule(pc);
+				cacheRule(pc, epoch, rule);
+			}
+			if (!(rule.flags & RULE_VALID) || (rule.flags & RULE_LAST_FRAME)) {
+				break;
+			}
+
+			if (rule.flags & RULE_SIGNAL_FRAME) {
+				// o handler retorna para o trampolim com o ucontext no topo da pilha
+				if (sp + sizeof(ucontext_t) > stackHigh) {
+					break;
+				}
+				const ucontext_t* uc = reinterpret_cast<const ucontext_t*>(sp);
+				// a instrucao interrompida, nao um endereco de retorno
+				pc = uc->uc_mcontext.gregs[REG_RIP];
+				sp = uc->uc_mcontext.gregs[REG_RSP];
+				fp = uc->uc_mcontext.gregs[REG_RBP];
+				if (!skipFrame(reinterpret_cast<void*>(pc), &skip)) {
+					addrs[n++] = reinterpret_cast<void*>(pc);
+				}
+				continue;
+			}
+
+			const uintptr_t cfa = ((rule.flags & RULE_CFA_RBP) ? fp : sp) + rule.cfaOffset;
+			const uintptr_t raAddr = cfa + rule.raOffset * static_cast<intptr_t>(sizeof(void*));
+			if (cfa <= sp || raAddr < stackLow || raAddr + sizeof(void*) > stackHigh) {
+				break;
+			}
+
+			if (rule.flags & RULE_RBP_SAVED) {
+				const uintptr_t rbpAddr = cfa + rule.rbpOffset * static_cast<intptr_t>(sizeof(void*));
+				if (rbpAddr < stackLow || rbpAddr + sizeof(void*) > stackHigh) {
+					break;
+				}
+				fp = *reinterpret_cast<const uintptr_t*>(rbpAddr);
+			}
+
+			const uintptr_t ra = *reinterpret_cast<const uintptr_t*>(raAddr);
+			if (ra == 0) {
+				break;
+			}
+			if (!skipFrame(reinterpret_cast<void*>(ra), &skip)) {
+				addrs[n++] = reinterpret_cast<void*>(ra);
+			}
+
+			sp = cfa;
+			// o endereco de retorno pode estar apos o fim da funcao se a
+			// ultima instrucao for uma chamada noreturn
+			pc = ra - 1;
+		}
+		return n;
+	}
+}
+
+// The CFI row of the instruction after the asm describes the frame of the
+// function using the macro, so the unwind starts at its caller
+#define CAPTURE_REGISTERS(pc, sp, fp) \
+	__asm__ volatile ( \
+		"lea 0(%%rip), %0\n\t" \
+		"mov %%rsp, %1\n\t" \
+		"mov %%rbp, %2" \
+		: "=r" (pc), "=r" (sp), "=r" (fp))
+
+namespace Backtrace {
+
+	class CfiStackLoader: public Backtrace::IStackAddresLoader {
+
+		virtual int __attribute__((noinline)) getStack(int depth, StackFrame* frames, int skip) {
+			uintptr_t stackLow, stackHigh;
+			if (!currentStackBounds(&stackLow, &stackHigh)) {
+				return 0;
+			}
+			uintptr_t pc, sp, fp;
+			CAPTURE_REGISTERS(pc, sp, fp);
+
+			void* addrs[MAX_STACK];
+			const int n = unwind(pc, sp, fp, stackLow, stackHigh, depth, skip, addrs);
+			setAddresses(addrs, n, frames);
+			return n;
+		}
+
+		// Doesn't allocate, but a miss in the cache takes the dynamic
+		// loader's lock to find the module
+		virtual int __attribute__((noinline)) getStackAddresses(int depth, void** addrs, int skip) {
+			uintptr_t stackLow, stackHigh;
+			signalSafeStackBounds(&stackLow, &stackHigh);
+			uintptr_t pc, sp, fp;
+			CAPTURE_REGISTERS(pc, sp, fp);
+
+			return unwind(pc, sp, fp, stackLow, stackHigh, depth, skip, addrs);
+		}
+	};
+
+	IStackAddresLoader* getCfiStackLoader()
+	{
+		static CfiStackLoader instance;
+		return &instance;
+	}
+}
+
+#else
+
+namespace Backtrace {
+
+	IStackAddresLoader* getCfiStackLoader()
+	{
+		return NULL;
+	}
+}
+
+#endif
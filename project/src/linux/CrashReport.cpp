@@ -0,0 +1,553 @@
+#include "StackAddressLoader.h"
+#include "StackLoaderPrivate.h"
+#include "DebugSymbolLoader.h"
+#include "CrashReportFormat.h"
+#include "Modules.h"
+#include "../Breadcrumbs.h"
+
+#include <elf.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+// Relatorio de crash escrito de dentro do handler. So usa funcoes
+// async-signal-safe e buffers estaticos, o que precisa de malloc roda num
+// processo filho que continua depois que o processo termina.
+
+namespace {
+	using namespace Backtrace;
+	using namespace BacktracePrivate;
+
+	const int CRASH_DEPTH = 64;
+	// reportCrash, o handler e o trampolim do sinal, se o pc nao for achado
+	const int CRASH_SKIP = 3;
+	const int MAX_HANDLER_FRAMES = 8;
+	const unsigned SYMBOLIZE_TIMEOUT_S = 3;
+
+	// as outras threads ja estao num estado qualquer, nao da para esperar muito
+	const int THREADS_TIMEOUT_MS = 100;
+	const int MAX_THREADS = 64;
+
+	int reportFd = -1;
+	bool reportSymbolize = true;
+	CrashReportFormat reportFormat = CRASH_REPORT_TEXT;
+
+	// so a primeira thread que falha escreve o relatorio
+	volatile int crashing = 0;
+
+	void* crashAddrs[CRASH_DEPTH];
+	char copyBuffer[4096];
+	pid_t threadIds[MAX_THREADS];
+	ThreadSlot threadSlots[MAX_THREADS];
+	Breadcrumbs::Entry breadcrumbs[Breadcrumbs::MAX_ENTRIES];
+	int breadcrumbCount = 0;
+	Breadcrumbs::LogLine logLines[Breadcrumbs::LOG_LINES];
+
+	// Formata sem alocar, o buffer e escrito com write()
+	class Writer {
+	public:
+		explicit Writer(int fd) : m_fd(fd), m_len(0) {}
+
+		~Writer() { flush(); }
+
+		Writer& bytes(const void* data, size_t size) {
+			const char* c = static_cast<const char*>(data);
+			for (size_t i = 0; i < size; ++i) {
+				put(c[i]);
+			}
+			return *this;
+		}
+
+		template <class T>
+		Writer& record(CrashReport::RecordType type, const T& payload, size_t extra) {
+			CrashReport::RecordHeader header;
+			header.type = type;
+			header.size = static_cast<uint32_t>(sizeof(payload) + extra);
+			return bytes(&header, sizeof(header)).bytes(&payload, sizeof(payload));
+		}
+
+		Writer& str(const char* s) {
+			while (*s) {
+				put(*s++);
+			}
+			return *this;
+		}
+
+		Writer& hex(uint64_t value) {
+			char digits[2*sizeof(value)];
+			int n = 0;
+			do {
+				digits[n++] = "0123456789abcdef"[value & 0xf];
+				value >>= 4;
+			} while (value != 0);
+			str("0x");
+			while (n > 0) {
+				put(digits[--n]);
+			}
+			return *this;
+		}
+
+		Writer& dec(long value) {
+			char digits[24];
+			int n = 0;
+			const bool negative = value < 0;
+			unsigned long abs = negative ? -static_cast<unsigned long>(value) : value;
+			do {
+				digits[n++] = '0' + abs % 10;
+				abs /= 10;
+			} while (abs != 0);
+			if (negative) {
+				put('-');
+			}
+			while (n > 0) {
+				put(digits[--n]);
+			}
+			return *this;
+		}
+
+		void flush() {
+			writeAll(m_fd, m_buffer, m_len);
+			m_len = 0;
+		}
+
+		static void writeAll(int fd, const char* data, size_t len) {
+			while (len > 0) {
+				const ssize_t written = write(fd, data, len);
+				if (written < 0 && errno == EINTR) {
+					continue;
+				}
+				if (written <= 0) {
+					return;
+				}
+				data += written;
+				len -= written;
+			}
+		}
+
+	private:
+		void put(char c) {
+			if (m_len == sizeof(m_buffer)) {
+				flush();
+			}
+			m_buffer[m_len++] = c;
+		}
+
+		int m_fd;
+		size_t m_len;
+		char m_buffer[512];
+	};
+
+	const char* signalName(int signum)
+	{
+		switch (signum) {
+			case SIGSEGV: return "SIGSEGV";
+			case SIGBUS: return "SIGBUS";
+			case SIGILL: return "SIGILL";
+			case SIGFPE: return "SIGFPE";
+			case SIGABRT: return "SIGABRT";
+			default: return "signal";
+		}
+	}
+
+	// Para a simbolizacao offline, com os enderecos de carga dos modulos
+	void copyMaps(int fd)
+	{
+		const int maps = open("/proc/self/maps", O_RDONLY);
+		if (maps < 0) {
+			return;
+		}
+		for (;;) {
+			const ssize_t n = read(maps, copyBuffer, sizeof(copyBuffer));
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				break;
+			}
+			Writer::writeAll(fd, copyBuffer, n);
+		}
+		close(maps);
+	}
+
+	pid_t forkUnsafe()
+	{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+		// nao roda os handlers do pthread_atfork
+		return _Fork();
+#else
+		return fork();
+#endif
+	}
+
+	// O filho roda sozinho com a copia do espaco de enderecos, o pai nao
+	// espera por ele. Os locks herdados podem estar com a thread que falhou (o
+	// crash pode ter sido dentro do malloc), entao o filho morre com o alarme
+	// se nao terminar a tempo, e morre direto se falhar de novo.
+	void startSymbolizer(int fd, int n)
+	{
+		const pid_t crashed = getpid();
+		const pid_t child = forkUnsafe();
+		if (child != 0) {
+			return;
+		}
+
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = SIG_DFL;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGSEGV, &action, NULL);
+		sigaction(SIGBUS, &action, NULL);
+		sigaction(SIGILL, &action, NULL);
+		sigaction(SIGFPE, &action, NULL);
+		sigaction(SIGALRM, &action, NULL);
+		sigset_t all;
+		sigemptyset(&all);
+		sigprocmask(SIG_SETMASK, &all, NULL);
+		alarm(SYMBOLIZE_TIMEOUT_S);
+
+		StackFrame* frames = new StackFrame[n];
+		for (int i = 0; i < n; ++i) {
+			frames[i].addr = crashAddrs[i];
+		}
+		loadSymbolNames(frames, n);
+		getPlatformDebugSymbolLoader().findDebugInfo(frames, n);
+		const std::string text = StackTrace::asString(n, frames);
+		Writer out(fd);
+		out.str("Symbolized stack of ").dec(crashed).str(":\n").str(text.c_str());
+		for (int i = 0; i < breadcrumbCount; ++i) {
+			if (breadcrumbs[i].kind == Breadcrumbs::EXCEPTION && breadcrumbs[i].nFrames > 0) {
+				out.str("Breadcrumb ").dec(breadcrumbs[i].sequence).str(" fingerprint ")
+					.hex(Breadcrumbs::fingerprint(breadcrumbs[i])).str("\n");
+			}
+		}
+		out.flush();
+		_exit(0);
+	}
+
+	void writeBreadcrumbs(Writer& out)
+	{
+		const int n = Breadcrumbs::collect(breadcrumbs, Breadcrumbs::MAX_ENTRIES);
+		breadcrumbCount = n;
+		if (n == 0) {
+			return;
+		}
+		out.str("Breadcrumbs:\n");
+		for (int i = 0; i < n; ++i) {
+			const Breadcrumbs::Entry& entry = breadcrumbs[i];
+			out.dec(entry.sequence).str(": ");
+			if (entry.kind == Breadcrumbs::LOG) {
+				out.str("log level ").dec(entry.level).str(" ").str(entry.text);
+			} else {
+				// o nome do tipo nao e demangled e o fingerprint fica para o
+				// simbolizador, os dois alocam
+				out.str("throw ").str(entry.text).str(" at ").hex(reinterpret_cast<uintptr_t>(entry.site));
+				if (entry.nFrames > 0) {
+					out.str(", frames");
+				}
+				for (int f = 0; f < entry.nFrames; ++f) {
+					out.str(" ").hex(reinterpret_cast<uintptr_t>(entry.frames[f]));
+				}
+			}
+			out.str("\n");
+		}
+	}
+
+	void writeLogLines(Writer& out)
+	{
+		const int n = Breadcrumbs::collectLines(logLines, Breadcrumbs::LOG_LINES);
+		if (n == 0) {
+			return;
+		}
+		out.str("Last log lines:\n");
+		for (int i = 0; i < n; ++i) {
+			const Breadcrumbs::LogLine& line = logLines[i];
+			out.dec(line.sequence).str(": thread ").dec(line.threadId).str(" level ").dec(line.level)
+				.str(" ").str(line.text).str("\n");
+		}
+	}
+
+	// Instrucao que falhou, 0 onde o contexto nao e suportado
+	uintptr_t faultingPc(void* context)
+	{
+		const ucontext_t* uc = static_cast<const ucontext_t*>(context);
+		if (uc == NULL) {
+			return 0;
+		}
+#if defined(__x86_64__)
+		return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+		return uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+		return uc->uc_mcontext.pc;
+#else
+		return 0;
+#endif
+	}
+
+	/* Drops the frames of the handler, up to the faulting instruction. How
+	 * many there are depends on what the compiler inlined, so they are
+	 * found by the pc of the context and CRASH_SKIP is only the fallback.
+	 */
+	int dropHandlerFrames(void* context, int n)
+	{
+		const uintptr_t pc = faultingPc(context);
+		int skip = CRASH_SKIP;
+		for (int i = 0; i < n && i < MAX_HANDLER_FRAMES; ++i) {
+			if (reinterpret_cast<uintptr_t>(crashAddrs[i]) == pc) {
+				skip = i;
+				break;
+			}
+		}
+		skip = skip < n ? skip : n;
+		memmove(crashAddrs, crashAddrs + skip, (n - skip) * sizeof(void*));
+		return n - skip;
+	}
+
+	// Registros do relatorio binario, ver CrashReportFormat.h
+
+	void writeRegisters(Writer& out, void* context)
+	{
+		CrashReport::RegistersRecord registers;
+		uint64_t values[40];
+		registers.machine = 0;
+		registers.count = 0;
+		const ucontext_t* uc = static_cast<const ucontext_t*>(context);
+#if defined(__x86_64__) || defined(__i386__)
+		registers.machine = sizeof(void*) == 8 ? EM_X86_64 : EM_386;
+		for (int i = 0; i < NGREG; ++i) {
+			values[registers.count++] = static_cast<uint64_t>(uc->uc_mcontext.gregs[i]);
+		}
+#elif defined(__aarch64__)
+		registers.machine = EM_AARCH64;
+		for (int i = 0; i < 31; ++i) {
+			values[registers.count++] = uc->uc_mcontext.regs[i];
+		}
+		values[registers.count++] = uc->uc_mcontext.sp;
+		values[registers.count++] = uc->uc_mcontext.pc;
+		values[registers.count++] = uc->uc_mcontext.pstate;
+#else
+		(void) uc;
+#endif
+		out.record(CrashReport::RECORD_REGISTERS, registers, registers.count*sizeof(uint64_t))
+			.bytes(values, registers.count*sizeof(uint64_t));
+	}
+
+	void writeModule(const LoadedModule& module, void* data)
+	{
+		Writer& out = *static_cast<Writer*>(data);
+		const char* path = module.path;
+		char exe[256];
+		if (path[0] == '\0' && module.start != 0) {
+			// o primeiro modulo sem nome e o executavel (o vdso tem nome)
+			const ssize_t size = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+			exe[size > 0 ? size : 0] = '\0';
+			path = exe;
+		}
+		CrashReport::ModuleRecord record;
+		record.loadBias = module.loadBias;
+		record.start = module.start;
+		record.end = module.end;
+		record.buildIdSize = module.buildIdSize;
+		record.pathSize = strlen(path);
+		out.record(CrashReport::RECORD_MODULE, record, record.buildIdSize + record.pathSize)
+			.bytes(module.buildId, record.buildIdSize).bytes(path, record.pathSize);
+	}
+
+	void writeThread(Writer& out, pid_t tid, bool crashed, void* const* addrs, int n)
+	{
+		CrashReport::ThreadRecord thread;
+		thread.tid = tid;
+		thread.crashed = crashed ? 1 : 0;
+		thread.count = n;
+		thread.reserved = 0;
+		out.record(CrashReport::RECORD_THREAD, thread, n*sizeof(uint64_t));
+		for (int i = 0; i < n; ++i) {
+			const uint64_t addr = reinterpret_cast<uintptr_t>(addrs[i]);
+			out.bytes(&addr, sizeof(addr));
+		}
+	}
+
+	// As outras threads capturam as proprias pilhas com o sinal do snapshot.
+	// Se um snapshot ja estava rodando elas ficam de fora.
+	void writeOtherThreads(Writer& out, pid_t self)
+	{
+		const int listed = std::min(listThreadIds(threadIds, MAX_THREADS), MAX_THREADS);
+		int n = 0;
+		for (int i = 0; i < listed; ++i) {
+			if (threadIds[i] != self) {
+				threadSlots[n].tid = threadIds[i];
+				threadSlots[n].size = 0;
+				threadSlots[n].done = 0;
+				++n;
+			}
+		}
+		if (n == 0 || !signalThreads(threadSlots, n, CRASH_DEPTH, THREADS_TIMEOUT_MS, true)) {
+			return;
+		}
+		for (int i = 0; i < n; ++i) {
+			const ThreadSlot& slot = threadSlots[i];
+			if (slot.size >= 0) {
+				writeThread(out, slot.tid, false, slot.addrs, slot.done ? slot.size : 0);
+			}
+		}
+	}
+
+	void writeBinaryReport(int fd, int signum, siginfo_t* info, void* context, int n)
+	{
+		Writer out(fd);
+		const CrashReport::Header header = { CrashReport::MAGIC, CrashReport::VERSION };
+		out.bytes(&header, sizeof(header));
+
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		const pid_t self = syscall(SYS_gettid);
+		CrashReport::SignalRecord signal;
+		signal.signo = signum;
+		signal.code = info->si_code;
+		signal.address = reinterpret_cast<uintptr_t>(info->si_addr);
+		signal.pid = getpid();
+		signal.tid = self;
+		signal.time = now.tv_sec;
+		out.record(CrashReport::RECORD_SIGNAL, signal, 0);
+
+		writeRegisters(out, context);
+		forEachModule(writeModule, &out);
+		writeThread(out, self, true, crashAddrs, n);
+
+		const int nBreadcrumbs = Breadcrumbs::collect(breadcrumbs, Breadcrumbs::MAX_ENTRIES);
+		for (int i = 0; i < nBreadcrumbs; ++i) {
+			const Breadcrumbs::Entry& entry = breadcrumbs[i];
+			CrashReport::BreadcrumbRecord record;
+			memset(&record, 0, sizeof(record));
+			record.sequence = entry.sequence;
+			record.kind = entry.kind;
+			record.level = entry.level;
+			record.site = reinterpret_cast<uintptr_t>(entry.site);
+			record.textSize = strlen(entry.text);
+			record.frameCount = entry.nFrames;
+			out.record(CrashReport::RECORD_BREADCRUMB, record, record.textSize + record.frameCount*sizeof(uint64_t))
+				.bytes(entry.text, record.textSize);
+			for (int f = 0; f < entry.nFrames; ++f) {
+				const uint64_t addr = reinterpret_cast<uintptr_t>(entry.frames[f]);
+				out.bytes(&addr, sizeof(addr));
+			}
+		}
+
+		const int nLines = Breadcrumbs::collectLines(logLines, Breadcrumbs::LOG_LINES);
+		for (int i = 0; i < nLines; ++i) {
+			const Breadcrumbs::LogLine& line = logLines[i];
+			CrashReport::LogLineRecord record;
+			memset(&record, 0, sizeof(record));
+			record.sequence = line.sequence;
+			record.tid = line.threadId;
+			record.level = line.level;
+			record.textSize = strlen(line.text);
+			out.record(CrashReport::RECORD_LOG_LINE, record, record.textSize).bytes(line.text, record.textSize);
+		}
+		out.flush();
+
+		writeOtherThreads(out, self);
+
+		const CrashReport::RecordHeader end = { CrashReport::RECORD_END, 0 };
+		out.bytes(&end, sizeof(end));
+	}
+
+	// A acao padrao do sinal termina o processo (com o core dump) assim que o
+	// handler retorna, ou quando a instrucao que falhou for executada de novo
+	void reraise(int signum)
+	{
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = SIG_DFL;
+		sigemptyset(&action.sa_mask);
+		sigaction(signum, &action, NULL);
+		raise(signum);
+	}
+}
+
+namespace BacktracePrivate {
+
+	bool crashReportEnabled()
+	{
+		return reportFd >= 0;
+	}
+
+	void __attribute__((noinline)) reportCrash(int signum, siginfo_t* info, void* context, const char* reason)
+	{
+		if (__sync_lock_test_and_set(&crashing, 1)) {
+			// outra thread esta escrevendo o relatorio e vai terminar o processo
+			for (;;) {
+				pause();
+			}
+		}
+
+		const int fd = reportFd >= 0 ? reportFd : STDERR_FILENO;
+
+		// o backtrace() da glibc atravessa o frame do sinal para a pilha original
+		const int n = dropHandlerFrames(context, getDefaultStackLoader().getStackAddresses(CRASH_DEPTH, crashAddrs, 0));
+
+		if (reportFd >= 0 && reportFormat == CRASH_REPORT_BINARY) {
+			writeBinaryReport(fd, signum, info, context, n);
+			reraise(signum);
+			return;
+		}
+
+		{
+			Writer out(fd);
+			out.str("*** Crash: ");
+			if (reason) {
+				out.str(reason).str(", ");
+			}
+			out.str(signalName(signum)).str(" (").dec(signum).str(", code ").dec(info->si_code)
+				.str(") at ").hex(reinterpret_cast<uintptr_t>(info->si_addr))
+				.str(", pid ").dec(getpid()).str(", thread ").dec(syscall(SYS_gettid)).str("\n");
+			out.str("Stack:\n");
+			for (int i = 0; i < n; ++i) {
+				out.hex(reinterpret_cast<uintptr_t>(crashAddrs[i])).str("\n");
+			}
+			writeBreadcrumbs(out);
+			writeLogLines(out);
+		}
+
+		if (reportFd >= 0) {
+			Writer(fd).str("Maps:\n");
+			copyMaps(fd);
+		}
+
+		// o filho escreve depois de tudo, a posicao no arquivo e compartilhada
+		if (reportSymbolize && n > 0) {
+			startSymbolizer(fd, n);
+		}
+
+		reraise(signum);
+	}
+}
+
+namespace Backtrace {
+
+	void __attribute__((noinline)) writeEmergencyReport(int fd, const char* message)
+	{
+		void* addrs[CRASH_DEPTH];
+		// pula este frame
+		const int n = getDefaultStackLoader().getStackAddresses(CRASH_DEPTH, addrs, 1);
+		Writer(fd).str(message).str("Stack:\n");
+		backtrace_symbols_fd(addrs, n, fd);
+	}
+
+	void enableCrashReport(int fd, bool symbolize, CrashReportFormat format)
+	{
+		reportSymbolize = symbolize;
+		reportFormat = format;
+		reportFd = fd;
+	}
+}
@@ -1,19 +1,13 @@
 #include "DebugSymbolLoader.h"
 #include "SymbolCache.h"
+#include "Modules.h"
 
-#include <cxxabi.h>
-
-#include <iterator>
+#include <map>
 #include <vector>
 #include <sstream>
 #include <stdio.h>
 #include <unistd.h>
-#include <stdlib.h>
-#include <errno.h>
-#include <execinfo.h>
-#include <string.h>
 
-#include <sys/stat.h>
 #include <fstream>
 #include <memory>
 #include <ext/stdio_filebuf.h>
@@ -23,93 +17,6 @@
 using namespace std;
 
 namespace {
-	static bool executable_found = false;
-	static string executable;
-
-	char * opt_getcwd (char * stack_buf, int stack_size)
-	{
-		if (getcwd (stack_buf, stack_size) == stack_buf)
-			return stack_buf;
-		size_t size = stack_size;
-
-		while (1)
-		{
-			char *buffer = (char *) malloc (size);
-			if (getcwd (buffer, size) == buffer)
-				return buffer;
-			free (buffer);
-			if (errno != ERANGE)
-				return 0;
-			size *= 2;
-		}
-	}
-
-	class Finder {
-	private:
-		vector<string> pathv;
-	public:
-		Finder() {
-			string path(getenv("PATH"));
-			const int size = path.size();
-			for (int i = 0; i < size; ++i) {
-				if (path[i] == ':') path[i] = ' ';
-			}
-			stringstream splitter;
-			splitter << path;
-
-			istream_iterator<string> it(splitter);
-			istream_iterator<string> _end;
-			for (; it != _end; ++it) {
-				pathv.push_back(*it + "/");
-			}
-		}
-		inline bool check_exe_file(const string& path) {
-			struct stat statbuf;
-			if(!stat(path.c_str(), &statbuf)) {
-				if ((statbuf.st_mode & S_IXUSR) || (statbuf.st_mode & S_IXGRP) || (statbuf.st_mode & S_IXOTH)) {
-					return true;
-				}
-			}
-			return false;
-		}
-		bool whereis(const string& file, string& resolved) {
-
-			if (file.size() > 0 && file[0] == '/') {
-				if (check_exe_file(file)) {
-					resolved = file;
-					return true;
-				}
-				return false;
-			}
-
-			char stack_buf[100];
-			char * cwd = opt_getcwd(stack_buf, 100);
-			string local_path(cwd);
-			if (cwd != stack_buf)
-				free(cwd);
-			local_path += '/';
-			local_path += file;
-			if (check_exe_file(local_path)) {
-				resolved = local_path;
-				return true;
-			}
-
-			vector<string>::iterator it = pathv.begin();
-			vector<string>::iterator end = pathv.end();
-
-			for (; it != end; ++it) {
-				string name(*it + file);
-				if (check_exe_file(name)) {
-					resolved = name;
-					return true;
-				}
-			}
-
-			return false;
-		}
-	};
-
-
 	bool bidirectional_popen(std::vector<const char*>& command, int* in, int*out) {
 
 		int pipein[2];
@@ -159,27 +66,27 @@ namespace Backtrace {
 
 	class Addr2LineSymbolLoader: public IDebugSymbolLoader {
 
-		ostream a2lout;
-		istream a2lin;
+		// Um addr2line para cada arquivo, os enderecos sao relativos a ele
+		struct Addr2Line {
+			ostream out;
+			istream in;
 
-		auto_ptr<__gnu_cxx::stdio_filebuf<char> > outfb;
-		auto_ptr<__gnu_cxx::stdio_filebuf<char> > infb;
+			auto_ptr<__gnu_cxx::stdio_filebuf<char> > outfb;
+			auto_ptr<__gnu_cxx::stdio_filebuf<char> > infb;
 
-	public:
+			Addr2Line() : out(NULL), in(NULL) {}
 
-		Addr2LineSymbolLoader() : a2lout(NULL), a2lin(NULL) {
-			//initializePipes();
-		}
-		~Addr2LineSymbolLoader() {
-		}
-
-		void initializePipes() {
-			if (executable_found) {
+			void start(const char* path) {
+				// o addr2line sairia logo e a escrita no pipe mataria o processo
+				if (access(path, R_OK) != 0 || access("/usr/bin/addr2line", X_OK) != 0) {
+					return;
+				}
 				std::vector<const char*> command;
 				command.push_back("/usr/bin/addr2line");
 				command.push_back("addr2line");
-				command.push_back("-Cife");
-				command.push_back(executable.c_str());
+				// sem -i, sempre duas linhas por endereco
+				command.push_back("-Cfe");
+				command.push_back(path);
 
 				int in, out;
 
@@ -187,70 +94,124 @@ namespace Backtrace {
 					outfb.reset(new  __gnu_cxx::stdio_filebuf<char>(out, ios_base::out));
 					infb.reset(new __gnu_cxx::stdio_filebuf<char>(in, ios_base::in));
 
-					a2lout.rdbuf(outfb.get());
-					a2lin.rdbuf(infb.get());
+					this->out.rdbuf(outfb.get());
+					this->in.rdbuf(infb.get());
 				}
 			}
-		}
+		};
+
+		typedef std::map<string, Addr2Line*> process_map;
 
+		struct Miss {
+			size_t frame;
+			Addr2Line* process;
+			string path;
+		};
+
+		process_map m_processes;
+
+	public:
+
+		Addr2LineSymbolLoader() {
+		}
+		~Addr2LineSymbolLoader() {
+			process_map::iterator it = m_processes.begin();
+			for (; it != m_processes.end(); ++it) {
+				delete it->second;
+			}
+		}
 
 		virtual bool findDebugInfo(StackFrame* frames, int nFrames) {
 
-			if (executable_found && nFrames > 0) {
-				if (!a2lout.good() || !a2lin.good()) {
-					initializePipes();
+			std::vector<Miss> misses;
+			misses.reserve(nFrames);
+
+			for (int i = 0; i < nFrames; i++) {
+				SymbolCache& cache = SymbolCache::instance();
+				if (cache.fill(SymbolCache::keyFor(frames[i].addr), &frames[i], SymbolCache::SymbolsLoaded)) {
+					continue;
 				}
 
-				std::vector<size_t> misses;
-				misses.reserve(nFrames);
+				// o endereco de retorno pode ser o inicio da proxima linha
+				const uintptr_t pc = reinterpret_cast<uintptr_t>(frames[i].addr) - 1;
+				ModuleInfo module;
+				if (frames[i].addr == NULL || !findModule(pc, &module)) {
+					continue;
+				}
+				Addr2Line* process = processFor(module);
+				if (!process->out.good() || !process->in.good()) {
+					continue;
+				}
+				Miss miss = { static_cast<size_t>(i), process, module.path };
+				misses.push_back(miss);
+				process->out << reinterpret_cast<void*>(pc - module.loadBias) << "\n";
+			}
 
-				for (int i = 0; i < nFrames; i++) {
-					misses.push_back(i);
-					a2lout << frames[i].addr << "\n";
+			if (misses.size() == 0) {
+				return true;
+			}
+			process_map::iterator it = m_processes.begin();
+			for (; it != m_processes.end(); ++it) {
+				it->second->out.flush();
+			}
 
-					const SymbolCache::CachedFrame* frame = SymbolCache::instance().cachedFor(frames[i].addr);
-					if (frame && frame->state == SymbolCache::SymbolsLoaded) {
-						frames[i] = *frame;
-					} else {
-						misses.push_back(i);
-						a2lout << frames[i].addr << "\n";
-					}
+			// cada processo responde na ordem em que recebeu os enderecos
+			bool status = false;
+			for (size_t i = 0; i < misses.size(); ++i) {
+				istream& in = misses[i].process->in;
+				if (!in.good()) {
+					continue;
 				}
-				a2lout.flush();
+				try {
+					StackFrame& frame = frames[misses[i].frame];
 
-				if (misses.size() == 0) {
-					return true;
-				}
-				bool status = false;
-				for (size_t i = 0; a2lin.good() && i < misses.size(); ++i) {
-					try {
-						StackFrame& frame = frames[misses[i]];
-
-						string function;
-						getline(a2lin, function);
-
-						string lineinfo;
-						getline(a2lin, lineinfo);
-						int colon = lineinfo.find_last_of(':');
-						lineinfo.replace(colon, 1, 1, ' ');
-						stringstream ss(lineinfo);
-
-						ss >> frame.sourceFile;
-						ss >> frame.line;
-						std::swap(function, frame.function);
-						frame.imageFile = executable;
-						SymbolCache::instance().updateCache(&frame, SymbolCache::SymbolsLoaded);
-						status = true;
-					} catch (...) {
-						// o stream pode ter fechado nesse frame
+					string function;
+					getline(in, function);
+
+					string lineinfo;
+					getline(in, lineinfo);
+					const size_t colon = lineinfo.find_last_of(':');
+					if (colon == string::npos) {
+						continue;
 					}
+					lineinfo.replace(colon, 1, 1, ' ');
+					stringstream ss(lineinfo);
+
+					string source;
+					int line = -1;
+					ss >> source;
+					ss >> line;
+					if (source != "??" && line > 0) {
+						frame.sourceFile = source;
+						frame.line = line;
+					}
+					// o nome da tabela de simbolos tem os parametros
+					if (frame.function.empty() && function != "??") {
+						frame.function = function;
+					}
+					if (frame.imageFile.empty()) {
+						frame.imageFile = misses[i].path;
+					}
+					SymbolCache::instance().updateCache(&frame, SymbolCache::SymbolsLoaded);
+					status = true;
+				} catch (...) {
+					// o stream pode ter fechado nesse frame
 				}
-				return status;
+			}
+			return status;
+		}
 
-			} else {
-				return true;
+	private:
+		Addr2Line* processFor(const ModuleInfo& module) {
+			const string key = moduleKey(module);
+			process_map::iterator it = m_processes.find(key);
+			if (it != m_processes.end()) {
+				return it->second;
 			}
-			return false;
+			Addr2Line* process = new Addr2Line();
+			process->start(module.path);
+			m_processes[key] = process;
+			return process;
 		}
 	};
 
@@ -272,10 +233,8 @@ namespace Backtrace {
 	}
 #endif
 
-	void initializeExecutablePath(const char* argv0) {
-		Finder finder;
-		string rel_path(argv0);
-		executable_found = finder.whereis(rel_path, executable);
+	// o executavel vem da tabela de modulos
+	void initializeExecutablePath(const char*) {
 	}
 }
 
@@ -0,0 +1,134 @@
+#ifndef DWARFREADER_H
+#define DWARFREADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Bounds checked reader of the DWARF encodings, shared by the CFI unwinder
+// (.eh_frame) and the debug symbol loader (.debug_info, .debug_line)
+
+namespace BacktracePrivate {
+
+	/* Reads the data between p and end. A read past the end, or an
+	 * unterminated LEB128 or string, returns 0 (NULL) and clears ok(); the
+	 * following reads return 0 too, so the callers check ok() only after a
+	 * group of reads.
+	 */
+	class DwarfReader {
+	public:
+		DwarfReader(const uint8_t* p, const uint8_t* end) : m_p(p), m_end(end), m_ok(true) {}
+
+		bool ok() const { return m_ok; }
+		bool atEnd() const { return m_p >= m_end; }
+		const uint8_t* pos() const { return m_p; }
+
+		void skip(uint64_t n) {
+			if (n > static_cast<uint64_t>(m_end - m_p)) {
+				fail();
+			} else {
+				m_p += n;
+			}
+		}
+
+		template<class T>
+		T read() {
+			T value = 0;
+			if (static_cast<size_t>(m_end - m_p) < sizeof(T)) {
+				fail();
+				return 0;
+			}
+			memcpy(&value, m_p, sizeof(T));
+			m_p += sizeof(T);
+			return value;
+		}
+
+		// Unsigned value of 1 to 8 bytes
+		uint64_t sized(int size) {
+			switch (size) {
+				case 1: return read<uint8_t>();
+				case 2: return read<uint16_t>();
+				case 4: return read<uint32_t>();
+				case 8: return read<uint64_t>();
+			}
+			uint64_t value = 0;
+			for (int i = 0; i < size; ++i) {
+				value |= static_cast<uint64_t>(read<uint8_t>()) << (8 * i);
+			}
+			return value;
+		}
+
+		uint64_t uleb() {
+			uint64_t result = 0;
+			unsigned shift = 0;
+			while (m_p < m_end) {
+				const uint8_t byte = *m_p++;
+				if (shift < 64) {
+					result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+				}
+				shift += 7;
+				if ((byte & 0x80) == 0) {
+					return result;
+				}
+			}
+			m_ok = false;
+			return 0;
+		}
+
+		int64_t sleb() {
+			int64_t result = 0;
+			unsigned shift = 0;
+			while (m_p < m_end) {
+				const uint8_t byte = *m_p++;
+				if (shift < 64) {
+					result |= static_cast<int64_t>(byte & 0x7f) << shift;
+				}
+				shift += 7;
+				if ((byte & 0x80) == 0) {
+					if (shift < 64 && (byte & 0x40)) {
+						result |= -(static_cast<int64_t>(1) << shift);
+					}
+					return result;
+				}
+			}
+			m_ok = false;
+			return 0;
+		}
+
+		const char* cstring() {
+			const void* nul = memchr(m_p, '\0', m_end - m_p);
+			if (nul == NULL) {
+				fail();
+				return NULL;
+			}
+			const char* result = reinterpret_cast<const char*>(m_p);
+			m_p = static_cast<const uint8_t*>(nul) + 1;
+			return result;
+		}
+
+		/* Length of a unit (.debug_info, .debug_line), the offsets inside it
+		 * have 8 bytes in the 64 bit format
+		 */
+		uint64_t unitLength(int* offsetSize) {
+			uint64_t length = read<uint32_t>();
+			*offsetSize = 4;
+			if (length == 0xffffffff) {
+				length = read<uint64_t>();
+				*offsetSize = 8;
+			}
+			return length;
+		}
+
+	protected:
+		void fail() {
+			m_ok = false;
+			m_p = m_end;
+		}
+
+		const uint8_t* m_p;
+		const uint8_t* m_end;
+		bool m_ok;
+	};
+}
+
+#endif // DWARFREADER_H
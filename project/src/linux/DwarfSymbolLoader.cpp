@@ -0,0 +1,1244 @@
+#include "DebugSymbolLoader.h"
+#include "SymbolCache.h"
+#include "Demangling.h"
+#include "DwarfReader.h"
+#include "ElfFile.h"
+#include "Modules.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <string.h>
+
+#ifdef USE_CXX11
+#include <mutex>
+#elif defined USE_QT
+#include <QMutex>
+#include <QMutexLocker>
+#endif
+
+/* Debug symbol loader that reads the DWARF of each module directly from the
+ * ELF file mapped in memory, without libbfd or an addr2line process.
+ *
+ * The first lookup in a module decodes all of its line programs
+ * (.debug_line) into a table of rows sorted by address and collects the
+ * ranges of the functions (DW_TAG_subprogram in .debug_info), flattened
+ * into disjoint ranges that point to the innermost one. After that each
+ * frame is a binary search in both tables. The function names are only
+ * read, from the DIE, when a range is hit.
+ *
+ * Like addr2line -f, the line of code inlined in a frame is the line of the
+ * inlined function, but the function is the one that owns the frame.
+ *
+ * DWARF 2 to 5 are supported. Split DWARF (.dwo), type units, supplementary
+ * files (dwz) and compressed sections aren't, the frames of such modules
+ * keep the names given by the StackAddressLoader.
+ */
+
+using namespace std;
+
+namespace {
+	using namespace BacktracePrivate;
+
+	enum {
+		DW_TAG_subprogram = 0x2e
+	};
+
+	enum {
+		DW_AT_name = 0x03,
+		DW_AT_stmt_list = 0x10,
+		DW_AT_low_pc = 0x11,
+		DW_AT_high_pc = 0x12,
+		DW_AT_comp_dir = 0x1b,
+		DW_AT_abstract_origin = 0x31,
+		DW_AT_specification = 0x47,
+		DW_AT_ranges = 0x55,
+		DW_AT_linkage_name = 0x6e,
+		DW_AT_str_offsets_base = 0x72,
+		DW_AT_addr_base = 0x73,
+		DW_AT_rnglists_base = 0x74,
+		DW_AT_MIPS_linkage_name = 0x2007
+	};
+
+	enum {
+		DW_FORM_addr = 0x01,
+		DW_FORM_block2 = 0x03,
+		DW_FORM_block4 = 0x04,
+		DW_FORM_data2 = 0x05,
+		DW_FORM_data4 = 0x06,
+		DW_FORM_data8 = 0x07,
+		DW_FORM_string = 0x08,
+		DW_FORM_block = 0x09,
+		DW_FORM_block1 = 0x0a,
+		DW_FORM_data1 = 0x0b,
+		DW_FORM_flag = 0x0c,
+		DW_FORM_sdata = 0x0d,
+		DW_FORM_strp = 0x0e,
+		DW_FORM_udata = 0x0f,
+		DW_FORM_ref_addr = 0x10,
+		DW_FORM_ref1 = 0x11,
+		DW_FORM_ref2 = 0x12,
+		DW_FORM_ref4 = 0x13,
+		DW_FORM_ref8 = 0x14,
+		DW_FORM_ref_udata = 0x15,
+		DW_FORM_indirect = 0x16,
+		DW_FORM_sec_offset = 0x17,
+		DW_FORM_exprloc = 0x18,
+		DW_FORM_flag_present = 0x19,
+		DW_FORM_strx = 0x1a,
+		DW_FORM_addrx = 0x1b,
+		DW_FORM_ref_sup4 = 0x1c,
+		DW_FORM_strp_sup = 0x1d,
+		DW_FORM_data16 = 0x1e,
+		DW_FORM_line_strp = 0x1f,
+		DW_FORM_ref_sig8 = 0x20,
+		DW_FORM_implicit_const = 0x21,
+		DW_FORM_loclistx = 0x22,
+		DW_FORM_rnglistx = 0x23,
+		DW_FORM_ref_sup8 = 0x24,
+		DW_FORM_strx1 = 0x25,
+		DW_FORM_strx2 = 0x26,
+		DW_FORM_strx3 = 0x27,
+		DW_FORM_strx4 = 0x28,
+		DW_FORM_addrx1 = 0x29,
+		DW_FORM_addrx2 = 0x2a,
+		DW_FORM_addrx3 = 0x2b,
+		DW_FORM_addrx4 = 0x2c,
+		DW_FORM_GNU_addr_index = 0x1f01,
+		DW_FORM_GNU_str_index = 0x1f02,
+		DW_FORM_GNU_ref_alt = 0x1f20,
+		DW_FORM_GNU_strp_alt = 0x1f21
+	};
+
+	enum {
+		DW_UT_type = 0x02,
+		DW_UT_skeleton = 0x04,
+		DW_UT_split_compile = 0x05,
+		DW_UT_split_type = 0x06
+	};
+
+	enum {
+		DW_LNS_copy = 1,
+		DW_LNS_advance_pc,
+		DW_LNS_advance_line,
+		DW_LNS_set_file,
+		DW_LNS_set_column,
+		DW_LNS_negate_stmt,
+		DW_LNS_set_basic_block,
+		DW_LNS_const_add_pc,
+		DW_LNS_fixed_advance_pc
+	};
+
+	enum {
+		DW_LNE_end_sequence = 1,
+		DW_LNE_set_address = 2,
+		DW_LNE_define_file = 3
+	};
+
+	enum {
+		DW_LNCT_path = 1,
+		DW_LNCT_directory_index = 2
+	};
+
+	enum {
+		DW_RLE_end_of_list = 0,
+		DW_RLE_base_addressx,
+		DW_RLE_startx_endx,
+		DW_RLE_startx_length,
+		DW_RLE_offset_pair,
+		DW_RLE_base_address,
+		DW_RLE_start_end,
+		DW_RLE_start_length
+	};
+
+	typedef DwarfReader Reader;
+
+	struct AttrSpec {
+		uint16_t name;
+		uint16_t form;
+		int64_t implicitConst;
+	};
+
+	struct Abbrev {
+		uint64_t code;
+		uint64_t tag;
+		bool hasChildren;
+		vector<AttrSpec> attrs;
+	};
+
+	struct AbbrevTable {
+		vector<Abbrev> abbrevs;
+
+		const Abbrev* find(uint64_t code) const {
+			// os codigos costumam ser sequenciais a partir de 1
+			if (code > 0 && code <= abbrevs.size() && abbrevs[code - 1].code == code) {
+				return &abbrevs[code - 1];
+			}
+			for (size_t i = 0; i < abbrevs.size(); ++i) {
+				if (abbrevs[i].code == code) {
+					return &abbrevs[i];
+				}
+			}
+			return NULL;
+		}
+	};
+
+	struct Unit {
+		uint64_t offset;
+		uint64_t dieStart;
+		uint64_t end;
+		int version;
+		int addrSize;
+		int offsetSize;
+		const AbbrevTable* abbrevs;
+		uint64_t strOffsetsBase;
+		uint64_t addrBase;
+		uint64_t rnglistsBase;
+		// base of the ranges of DWARF 2-4 and of DW_RLE_offset_pair
+		uint64_t lowPc;
+	};
+
+	// Raw value of an attribute, form is 0 if the DIE doesn't have it
+	struct Attr {
+		uint16_t form;
+		uint64_t value;
+		const char* str;
+
+		Attr() : form(0), value(0), str(NULL) {}
+	};
+
+	struct Die {
+		uint64_t offset;
+		uint64_t tag;
+		bool hasChildren;
+		Attr name;
+		Attr linkageName;
+		Attr lowPc;
+		Attr highPc;
+		Attr ranges;
+		Attr origin;
+		Attr specification;
+		Attr stmtList;
+		Attr compDir;
+		Attr strOffsetsBase;
+		Attr addrBase;
+		Attr rnglistsBase;
+	};
+
+	const uint32_t END_OF_SEQUENCE = 0xffffffff;
+
+	struct LineRow {
+		uint64_t addr;
+		// index in DwarfModule::m_files or END_OF_SEQUENCE
+		uint32_t file;
+		int32_t line;
+
+	};
+
+	bool rowAfter(uint64_t addr, const LineRow& row)
+	{
+		return addr < row.addr;
+	}
+
+	struct FileName {
+		const char* name;
+		uint64_t dir;
+	};
+
+	struct FunctionRange {
+		uint64_t start;
+		uint64_t end;
+		// offset of the DIE in .debug_info
+		uint64_t die;
+		int depth;
+
+		bool operator<(const FunctionRange& that) const {
+			// os de fora antes, para ficarem embaixo na pilha do flatten
+			if (start != that.start) return start < that.start;
+			if (end != that.end) return end > that.end;
+			return depth < that.depth;
+		}
+	};
+
+	bool byStart(const FunctionRange& range, uint64_t addr)
+	{
+		return range.start < addr;
+	}
+
+	bool isAddressForm(uint16_t form)
+	{
+		switch (form) {
+			case DW_FORM_addr:
+			case DW_FORM_addrx:
+			case DW_FORM_addrx1:
+			case DW_FORM_addrx2:
+			case DW_FORM_addrx3:
+			case DW_FORM_addrx4:
+			case DW_FORM_GNU_addr_index:
+				return true;
+		}
+		return false;
+	}
+
+	// Linkers put discarded functions (--gc-sections, COMDAT) at 0 or -1
+	bool tombstone(uint64_t addr)
+	{
+		return addr == 0 || addr == ~static_cast<uint64_t>(0) || addr == ~static_cast<uint64_t>(1);
+	}
+
+	class DwarfModule {
+	public:
+		bool load(const string& path);
+
+		const string& path() const { return m_path; }
+
+		/* Looks up the address, relative to the ELF file. The function is
+		 * skipped if it's NULL. Returns false if nothing was found.
+		 */
+		bool find(uint64_t addr, string* file, int* line, string* function);
+
+	private:
+		ElfSection m_info;
+		ElfSection m_abbrev;
+		ElfSection m_str;
+		ElfSection m_lineStr;
+		ElfSection m_line;
+		ElfSection m_ranges;
+		ElfSection m_rnglists;
+		ElfSection m_addr;
+		ElfSection m_strOffsets;
+
+		ElfFile m_elf;
+		// arquivo separado com o debug, se o modulo foi stripado
+		ElfFile m_debugElf;
+		string m_path;
+
+		map<uint64_t, AbbrevTable> m_abbrevTables;
+		vector<Unit> m_units;
+		vector<string> m_files;
+		vector<LineRow> m_rows;
+		// inicio e primeira linha de cada sequencia, ate serem ordenadas
+		vector<pair<uint64_t, size_t> > m_sequences;
+		vector<FunctionRange> m_functions;
+		map<uint64_t, string> m_names;
+		// so durante a carga, para nao repetir os nomes de arquivo
+		map<string, uint32_t> m_fileIds;
+
+		const AbbrevTable* abbrevTable(uint64_t offset);
+		const Unit* unitAt(uint64_t offset) const;
+
+		bool readAttr(Reader& r, uint16_t form, int64_t implicitConst, const Unit& unit, Attr* attr);
+		bool readDie(Reader& r, const Unit& unit, Die* die);
+
+		const char* attrString(const Unit& unit, const Attr& attr) const;
+		uint64_t address(const Unit& unit, const Attr& attr) const;
+		uint64_t reference(const Unit& unit, const Attr& attr) const;
+		void addRanges(const Unit& unit, const Die& die, int depth);
+
+		void parseUnits();
+		void parseLines(const Unit& unit, uint64_t offset, const char* compDir);
+		void sortLines();
+		void flattenFunctions();
+
+		const std::string& functionName(uint64_t die);
+	};
+
+	bool DwarfModule::load(const std::string& path)
+	{
+		m_path = path;
+		if (!m_elf.open(path)) {
+			return false;
+		}
+		const ElfFile* elf = &m_elf;
+		if (!m_elf.section(".debug_info", &m_info)) {
+			const std::string debugPath = m_elf.debugFilePath();
+			if (debugPath.empty() || !m_debugElf.open(debugPath) || !m_debugElf.section(".debug_info", &m_info)) {
+				return false;
+			}
+			elf = &m_debugElf;
+		}
+		if (!elf->section(".debug_abbrev", &m_abbrev)) {
+			return false;
+		}
+		elf->section(".debug_str", &m_str);
+		elf->section(".debug_line_str", &m_lineStr);
+		elf->section(".debug_line", &m_line);
+		elf->section(".debug_ranges", &m_ranges);
+		elf->section(".debug_rnglists", &m_rnglists);
+		elf->section(".debug_addr", &m_addr);
+		elf->section(".debug_str_offsets", &m_strOffsets);
+
+		parseUnits();
+		map<std::string, uint32_t>().swap(m_fileIds);
+		sortLines();
+		flattenFunctions();
+		return !m_rows.empty() || !m_functions.empty();
+	}
+
+	bool DwarfModule::find(uint64_t addr, std::string* file, int* line, std::string* function)
+	{
+		bool found = false;
+
+		vector<LineRow>::const_iterator row = upper_bound(m_rows.begin(), m_rows.end(), addr, rowAfter);
+		if (row != m_rows.begin()) {
+			--row;
+			if (row->file != END_OF_SEQUENCE && row->line > 0) {
+				*file = m_files[row->file];
+				*line = row->line;
+				found = true;
+			}
+		}
+
+		if (function == NULL) {
+			return found;
+		}
+		vector<FunctionRange>::const_iterator range = lower_bound(m_functions.begin(), m_functions.end(), addr + 1, byStart);
+		if (range != m_functions.begin()) {
+			--range;
+			if (addr < range->end) {
+				const std::string& name = functionName(range->die);
+				if (!name.empty()) {
+					*function = name;
+					found = true;
+				}
+			}
+		}
+		return found;
+	}
+
+	const AbbrevTable* DwarfModule::abbrevTable(uint64_t offset)
+	{
+		map<uint64_t, AbbrevTable>::iterator it = m_abbrevTables.find(offset);
+		if (it != m_abbrevTables.end()) {
+			return &it->second;
+		}
+		AbbrevTable& table = m_abbrevTables[offset];
+		if (offset >= m_abbrev.size) {
+			return &table;
+		}
+		Reader r(m_abbrev.data + offset, m_abbrev.data + m_abbrev.size);
+		while (r.ok()) {
+			Abbrev abbrev;
+			abbrev.code = r.uleb();
+			if (abbrev.code == 0) {
+				break;
+			}
+			abbrev.tag = r.uleb();
+			abbrev.hasChildren = r.read<uint8_t>() != 0;
+			while (r.ok()) {
+				AttrSpec spec;
+				spec.name = static_cast<uint16_t>(r.uleb());
+				spec.form = static_cast<uint16_t>(r.uleb());
+				spec.implicitConst = (spec.form == DW_FORM_implicit_const) ? r.sleb() : 0;
+				if (spec.name == 0 && spec.form == 0) {
+					break;
+				}
+				abbrev.attrs.push_back(spec);
+			}
+			table.abbrevs.push_back(abbrev);
+		}
+		return &table;
+	}
+
+	const Unit* DwarfModule::unitAt(uint64_t offset) const
+	{
+		size_t low = 0;
+		size_t high = m_units.size();
+		while (low < high) {
+			const size_t mid = (low + high) / 2;
+			if (m_units[mid].end <= offset) {
+				low = mid + 1;
+			} else {
+				high = mid;
+			}
+		}
+		if (low < m_units.size() && m_units[low].dieStart <= offset) {
+			return &m_units[low];
+		}
+		return NULL;
+	}
+
+	bool DwarfModule::readAttr(Reader& r, uint16_t form, int64_t implicitConst, const Unit& unit, Attr* attr)
+	{
+		attr->form = form;
+		attr->str = NULL;
+		switch (form) {
+			case DW_FORM_addr: attr->value = r.sized(unit.addrSize); break;
+			case DW_FORM_data1:
+			case DW_FORM_ref1:
+			case DW_FORM_flag:
+			case DW_FORM_strx1:
+			case DW_FORM_addrx1: attr->value = r.read<uint8_t>(); break;
+			case DW_FORM_data2:
+			case DW_FORM_ref2:
+			case DW_FORM_strx2:
+			case DW_FORM_addrx2: attr->value = r.read<uint16_t>(); break;
+			case DW_FORM_strx3:
+			case DW_FORM_addrx3: attr->value = r.sized(3); break;
+			case DW_FORM_data4:
+			case DW_FORM_ref4:
+			case DW_FORM_ref_sup4:
+			case DW_FORM_strx4:
+			case DW_FORM_addrx4: attr->value = r.read<uint32_t>(); break;
+			case DW_FORM_data8:
+			case DW_FORM_ref8:
+			case DW_FORM_ref_sig8:
+			case DW_FORM_ref_sup8: attr->value = r.read<uint64_t>(); break;
+			case DW_FORM_data16: r.skip(16); break;
+			case DW_FORM_sdata: attr->value = static_cast<uint64_t>(r.sleb()); break;
+			case DW_FORM_udata:
+			case DW_FORM_ref_udata:
+			case DW_FORM_strx:
+			case DW_FORM_addrx:
+			case DW_FORM_loclistx:
+			case DW_FORM_rnglistx:
+			case DW_FORM_GNU_addr_index:
+			case DW_FORM_GNU_str_index: attr->value = r.uleb(); break;
+			case DW_FORM_strp:
+			case DW_FORM_line_strp:
+			case DW_FORM_sec_offset:
+			case DW_FORM_strp_sup:
+			case DW_FORM_GNU_ref_alt:
+			case DW_FORM_GNU_strp_alt: attr->value = r.sized(unit.offsetSize); break;
+			case DW_FORM_ref_addr: attr->value = r.sized(unit.version <= 2 ? unit.addrSize : unit.offsetSize); break;
+			case DW_FORM_string: attr->str = r.cstring(); break;
+			case DW_FORM_block1: r.skip(r.read<uint8_t>()); break;
+			case DW_FORM_block2: r.skip(r.read<uint16_t>()); break;
+			case DW_FORM_block4: r.skip(r.read<uint32_t>()); break;
+			case DW_FORM_block:
+			case DW_FORM_exprloc: r.skip(r.uleb()); break;
+			case DW_FORM_flag_present: attr->value = 1; break;
+			case DW_FORM_implicit_const: attr->value = static_cast<uint64_t>(implicitConst); break;
+			case DW_FORM_indirect: return readAttr(r, static_cast<uint16_t>(r.uleb()), implicitConst, unit, attr);
+			default:
+				// sem o tamanho, o resto da unidade nao pode ser lido
+				return false;
+		}
+		return r.ok();
+	}
+
+	bool DwarfModule::readDie(Reader& r, const Unit& unit, Die* die)
+	{
+		const Abbrev* abbrev = unit.abbrevs->find(r.uleb());
+		if (abbrev == NULL) {
+			return false;
+		}
+		die->tag = abbrev->tag;
+		die->hasChildren = abbrev->hasChildren;
+		for (size_t i = 0; i < abbrev->attrs.size(); ++i) {
+			const AttrSpec& spec = abbrev->attrs[i];
+			Attr* target;
+			Attr ignored;
+			switch (spec.name) {
+				case DW_AT_name: target = &die->name; break;
+				case DW_AT_linkage_name:
+				case DW_AT_MIPS_linkage_name: target = &die->linkageName; break;
+				case DW_AT_low_pc: target = &die->lowPc; break;
+				case DW_AT_high_pc: target = &die->highPc; break;
+				case DW_AT_ranges: target = &die->ranges; break;
+				case DW_AT_abstract_origin: target = &die->origin; break;
+				case DW_AT_specification: target = &die->specification; break;
+				case DW_AT_stmt_list: target = &die->stmtList; break;
+				case DW_AT_comp_dir: target = &die->compDir; break;
+				case DW_AT_str_offsets_base: target = &die->strOffsetsBase; break;
+				case DW_AT_addr_base: target = &die->addrBase; break;
+				case DW_AT_rnglists_base: target = &die->rnglistsBase; break;
+				default: target = &ignored; break;
+			}
+			if (!readAttr(r, spec.form, spec.implicitConst, unit, target)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	const char* DwarfModule::attrString(const Unit& unit, const Attr& attr) const
+	{
+		const ElfSection* section = &m_str;
+		uint64_t offset = attr.value;
+		switch (attr.form) {
+			case DW_FORM_string:
+				return attr.str;
+			case DW_FORM_strp:
+				break;
+			case DW_FORM_line_strp:
+				section = &m_lineStr;
+				break;
+			case DW_FORM_strx:
+			case DW_FORM_strx1:
+			case DW_FORM_strx2:
+			case DW_FORM_strx3:
+			case DW_FORM_strx4:
+			case DW_FORM_GNU_str_index:
+			{
+				const uint64_t entry = unit.strOffsetsBase + attr.value * unit.offsetSize;
+				if (entry + unit.offsetSize > m_strOffsets.size) {
+					return NULL;
+				}
+				Reader r(m_strOffsets.data + entry, m_strOffsets.data + m_strOffsets.size);
+				offset = r.sized(unit.offsetSize);
+				break;
+			}
+			default:
+				return NULL;
+		}
+		if (offset >= section->size || memchr(section->data + offset, '\0', section->size - offset) == NULL) {
+			return NULL;
+		}
+		return reinterpret_cast<const char*>(section->data + offset);
+	}
+
+	uint64_t DwarfModule::address(const Unit& unit, const Attr& attr) const
+	{
+		if (attr.form == DW_FORM_addr) {
+			return attr.value;
+		}
+		const uint64_t entry = unit.addrBase + attr.value * unit.addrSize;
+		if (entry + unit.addrSize > m_addr.size) {
+			return 0;
+		}
+		Reader r(m_addr.data + entry, m_addr.data + m_addr.size);
+		return r.sized(unit.addrSize);
+	}
+
+	uint64_t DwarfModule::reference(const Unit& unit, const Attr& attr) const
+	{
+		switch (attr.form) {
+			case DW_FORM_ref1:
+			case DW_FORM_ref2:
+			case DW_FORM_ref4:
+			case DW_FORM_ref8:
+			case DW_FORM_ref_udata:
+				return unit.offset + attr.value;
+			case DW_FORM_ref_addr:
+				return attr.value;
+		}
+		// tipos em outra unidade ou no arquivo suplementar
+		return 0;
+	}
+
+	void DwarfModule::addRanges(const Unit& unit, const Die& die, int depth)
+	{
+		FunctionRange range;
+		range.die = die.offset;
+		range.depth = depth;
+
+		if (die.lowPc.form && die.highPc.form) {
+			range.start = address(unit, die.lowPc);
+			range.end = isAddressForm(die.highPc.form) ? address(unit, die.highPc) : range.start + die.highPc.value;
+			if (!tombstone(range.start) && range.start < range.end) {
+				m_functions.push_back(range);
+			}
+			return;
+		}
+		if (!die.ranges.form) {
+			return;
+		}
+
+		if (unit.version < 5) {
+			if (die.ranges.value >= m_ranges.size) {
+				return;
+			}
+			Reader r(m_ranges.data + die.ranges.value, m_ranges.data + m_ranges.size);
+			const uint64_t maxAddress = (unit.addrSize == 8) ? ~static_cast<uint64_t>(0) : 0xffffffff;
+			uint64_t base = unit.lowPc;
+			while (r.ok()) {
+				const uint64_t start = r.sized(unit.addrSize);
+				const uint64_t end = r.sized(unit.addrSize);
+				if (start == 0 && end == 0) {
+					break;
+				}
+				if (start == maxAddress) {
+					base = end;
+					continue;
+				}
+				range.start = base + start;
+				range.end = base + end;
+				if (!tombstone(range.start) && range.start < range.end) {
+					m_functions.push_back(range);
+				}
+			}
+			return;
+		}
+
+		uint64_t offset = die.ranges.value;
+		if (die.ranges.form == DW_FORM_rnglistx) {
+			const uint64_t entry = unit.rnglistsBase + die.ranges.value * unit.offsetSize;
+			if (entry + unit.offsetSize > m_rnglists.size) {
+				return;
+			}
+			Reader r(m_rnglists.data + entry, m_rnglists.data + m_rnglists.size);
+			offset = unit.rnglistsBase + r.sized(unit.offsetSize);
+		}
+		if (offset >= m_rnglists.size) {
+			return;
+		}
+		Reader r(m_rnglists.data + offset, m_rnglists.data + m_rnglists.size);
+		uint64_t base = unit.lowPc;
+		while (r.ok()) {
+			Attr index;
+			index.form = DW_FORM_addrx;
+			switch (r.read<uint8_t>()) {
+				case DW_RLE_end_of_list:
+					return;
+				case DW_RLE_base_addressx:
+					index.value = r.uleb();
+					base = address(unit, index);
+					continue;
+				case DW_RLE_startx_endx:
+					index.value = r.uleb();
+					range.start = address(unit, index);
+					index.value = r.uleb();
+					range.end = address(unit, index);
+					break;
+				case DW_RLE_startx_length:
+					index.value = r.uleb();
+					range.start = address(unit, index);
+					range.end = range.start + r.uleb();
+					break;
+				case DW_RLE_offset_pair:
+					range.start = base + r.uleb();
+					range.end = base + r.uleb();
+					break;
+				case DW_RLE_base_address:
+					base = r.sized(unit.addrSize);
+					continue;
+				case DW_RLE_start_end:
+					range.start = r.sized(unit.addrSize);
+					range.end = r.sized(unit.addrSize);
+					break;
+				case DW_RLE_start_length:
+					range.start = r.sized(unit.addrSize);
+					range.end = range.start + r.uleb();
+					break;
+				default:
+					return;
+			}
+			if (!tombstone(range.start) && range.start < range.end) {
+				m_functions.push_back(range);
+			}
+		}
+	}
+
+	void DwarfModule::parseUnits()
+	{
+		set<uint64_t> linePrograms;
+
+		Reader units(m_info.data, m_info.data + m_info.size);
+		while (!units.atEnd() && units.ok()) {
+			Unit unit;
+			unit.offset = units.pos() - m_info.data;
+			const uint64_t length = units.unitLength(&unit.offsetSize);
+			const uint8_t* end = units.pos() + length;
+			if (!units.ok() || length > static_cast<uint64_t>(m_info.data + m_info.size - units.pos())) {
+				break;
+			}
+			unit.end = end - m_info.data;
+
+			Reader r(units.pos(), end);
+			units.skip(length);
+
+			unit.version = r.read<uint16_t>();
+			uint8_t type = 0;
+			uint64_t abbrevOffset;
+			if (unit.version >= 5) {
+				type = r.read<uint8_t>();
+				unit.addrSize = r.read<uint8_t>();
+				abbrevOffset = r.sized(unit.offsetSize);
+				if (type == DW_UT_skeleton || type == DW_UT_split_compile) {
+					r.skip(8);
+				} else if (type == DW_UT_type || type == DW_UT_split_type) {
+					r.skip(8 + unit.offsetSize);
+				}
+			} else {
+				abbrevOffset = r.sized(unit.offsetSize);
+				unit.addrSize = r.read<uint8_t>();
+			}
+			if (!r.ok() || unit.version < 2 || unit.version > 5 || type == DW_UT_type || type == DW_UT_split_type
+					|| (unit.addrSize != 4 && unit.addrSize != 8)) {
+				continue;
+			}
+			unit.dieStart = r.pos() - m_info.data;
+			unit.abbrevs = abbrevTable(abbrevOffset);
+			unit.strOffsetsBase = 0;
+			unit.addrBase = 0;
+			unit.rnglistsBase = 0;
+			unit.lowPc = 0;
+
+			// a DIE da unidade tem as bases usadas para ler as outras
+			Die root;
+			root.offset = unit.dieStart;
+			if (!readDie(r, unit, &root)) {
+				continue;
+			}
+			if (root.strOffsetsBase.form) unit.strOffsetsBase = root.strOffsetsBase.value;
+			if (root.addrBase.form) unit.addrBase = root.addrBase.value;
+			if (root.rnglistsBase.form) unit.rnglistsBase = root.rnglistsBase.value;
+			if (root.lowPc.form) unit.lowPc = address(unit, root.lowPc);
+			m_units.push_back(unit);
+
+			if (root.stmtList.form && linePrograms.insert(root.stmtList.value).second) {
+				const char* compDir = root.compDir.form ? attrString(unit, root.compDir) : NULL;
+				parseLines(unit, root.stmtList.value, compDir ? compDir : "");
+			}
+
+			int depth = root.hasChildren ? 1 : 0;
+			while (depth > 0 && !r.atEnd()) {
+				Die die;
+				die.offset = r.pos() - m_info.data;
+				if (*r.pos() == 0) {
+					// fim dos filhos
+					r.skip(1);
+					--depth;
+					continue;
+				}
+				if (!readDie(r, unit, &die)) {
+					break;
+				}
+				if (die.tag == DW_TAG_subprogram) {
+					addRanges(unit, die, depth);
+				}
+				if (die.hasChildren) {
+					++depth;
+				}
+			}
+		}
+	}
+
+	void DwarfModule::parseLines(const Unit& unit, uint64_t offset, const char* compDir)
+	{
+		if (offset >= m_line.size) {
+			return;
+		}
+		Reader r(m_line.data + offset, m_line.data + m_line.size);
+		Unit lineUnit = unit;
+		const uint64_t length = r.unitLength(&lineUnit.offsetSize);
+		if (!r.ok() || length > static_cast<uint64_t>(m_line.data + m_line.size - r.pos())) {
+			return;
+		}
+		const uint8_t* end = r.pos() + length;
+		r = Reader(r.pos(), end);
+
+		const int version = r.read<uint16_t>();
+		if (version >= 5) {
+			lineUnit.addrSize = r.read<uint8_t>();
+			r.read<uint8_t>(); // segment selector size
+		}
+		const uint64_t headerLength = r.sized(lineUnit.offsetSize);
+		const uint8_t* program = r.pos() + headerLength;
+		const uint8_t minInstLength = r.read<uint8_t>();
+		if (version >= 4) {
+			r.read<uint8_t>(); // max ops per instruction, so para VLIW
+		}
+		r.read<uint8_t>(); // default_is_stmt, todas as linhas sao usadas
+		const int8_t lineBase = r.read<int8_t>();
+		const uint8_t lineRange = r.read<uint8_t>();
+		const uint8_t opcodeBase = r.read<uint8_t>();
+		vector<uint8_t> opcodeLengths(opcodeBase > 0 ? opcodeBase - 1 : 0);
+		for (size_t i = 0; i < opcodeLengths.size(); ++i) {
+			opcodeLengths[i] = r.read<uint8_t>();
+		}
+		if (!r.ok() || version < 2 || version > 5 || lineRange == 0 || program > end) {
+			return;
+		}
+
+		// Indices do programa para os nomes completos, em m_files
+		vector<std::string> dirs;
+		vector<uint32_t> files;
+
+		vector<FileName> names;
+
+		if (version < 5) {
+			dirs.push_back(compDir);
+			while (r.ok()) {
+				const char* dir = r.cstring();
+				if (dir == NULL || *dir == '\0') {
+					break;
+				}
+				dirs.push_back(dir);
+			}
+			// o indice 0 nao e usado antes do DWARF 5
+			FileName none = { "", 0 };
+			names.push_back(none);
+			while (r.ok()) {
+				FileName file;
+				file.name = r.cstring();
+				if (file.name == NULL || *file.name == '\0') {
+					break;
+				}
+				file.dir = r.uleb();
+				r.uleb(); // mtime
+				r.uleb(); // size
+				names.push_back(file);
+			}
+		} else {
+			for (int table = 0; table < 2 && r.ok(); ++table) {
+				vector<pair<uint64_t, uint16_t> > format(r.read<uint8_t>());
+				for (size_t i = 0; i < format.size(); ++i) {
+					format[i].first = r.uleb();
+					format[i].second = static_cast<uint16_t>(r.uleb());
+				}
+				const uint64_t count = r.uleb();
+				for (uint64_t i = 0; i < count && r.ok(); ++i) {
+					FileName entry = { "", 0 };
+					for (size_t f = 0; f < format.size(); ++f) {
+						Attr value;
+						if (!readAttr(r, format[f].second, 0, lineUnit, &value)) {
+							return;
+						}
+						if (format[f].first == DW_LNCT_path) {
+							const char* path = attrString(lineUnit, value);
+							entry.name = path ? path : "";
+						} else if (format[f].first == DW_LNCT_directory_index) {
+							entry.dir = value.value;
+						}
+					}
+					if (table == 0) {
+						dirs.push_back(entry.name);
+					} else {
+						names.push_back(entry);
+					}
+				}
+			}
+			// o diretorio 0 do DWARF 5 e o da compilacao
+			if (!dirs.empty() && dirs[0].empty()) {
+				dirs[0] = compDir;
+			}
+		}
+		if (!r.ok()) {
+			return;
+		}
+
+		for (size_t i = 0; i < names.size(); ++i) {
+			std::string path;
+			if (names[i].name[0] != '/' && names[i].dir < dirs.size()) {
+				const std::string& dir = dirs[names[i].dir];
+				if (!dir.empty() && dir[0] != '/' && *compDir != '\0') {
+					path = std::string(compDir) + "/";
+				}
+				path += dir;
+				if (!path.empty()) {
+					path += '/';
+				}
+			}
+			path += names[i].name;
+
+			map<std::string, uint32_t>::iterator it = m_fileIds.find(path);
+			if (it == m_fileIds.end()) {
+				it = m_fileIds.insert(make_pair(path, static_cast<uint32_t>(m_files.size()))).first;
+				m_files.push_back(path);
+			}
+			files.push_back(it->second);
+		}
+
+		// Maquina de estados do programa de linhas
+		r = Reader(program, end);
+		uint64_t address = 0;
+		uint64_t file = 1;
+		int64_t line = 1;
+		size_t sequenceStart = m_rows.size();
+		bool discard = false;
+
+		while (!r.atEnd() && r.ok()) {
+			const uint8_t opcode = r.read<uint8_t>();
+			bool emit = false;
+			bool endSequence = false;
+
+			if (opcode >= opcodeBase) {
+				const uint8_t adjusted = opcode - opcodeBase;
+				address += (adjusted / lineRange) * minInstLength;
+				line += lineBase + (adjusted % lineRange);
+				emit = true;
+			} else if (opcode == 0) {
+				const uint64_t size = r.uleb();
+				const uint8_t* next = r.pos() + size;
+				if (size == 0 || size > static_cast<uint64_t>(end - r.pos())) {
+					break;
+				}
+				switch (r.read<uint8_t>()) {
+					case DW_LNE_end_sequence:
+						emit = true;
+						endSequence = true;
+						break;
+					case DW_LNE_set_address:
+						address = r.sized(static_cast<int>(size - 1));
+						if (m_rows.size() == sequenceStart) {
+							discard = tombstone(address);
+						}
+						break;
+					default:
+						// DW_LNE_define_file e extensoes, raros
+						break;
+				}
+				r = Reader(next, end);
+			} else {
+				switch (opcode) {
+					case DW_LNS_copy:
+						emit = true;
+						break;
+					case DW_LNS_advance_pc:
+						address += r.uleb() * minInstLength;
+						break;
+					case DW_LNS_advance_line:
+						line += r.sleb();
+						break;
+					case DW_LNS_set_file:
+						file = r.uleb();
+						break;
+					case DW_LNS_const_add_pc:
+						address += ((255 - opcodeBase) / lineRange) * minInstLength;
+						break;
+					case DW_LNS_fixed_advance_pc:
+						address += r.read<uint16_t>();
+						break;
+					default:
+						for (int i = 0; i < opcodeLengths[opcode - 1]; ++i) {
+							r.uleb();
+						}
+						break;
+				}
+			}
+
+			if (emit && !discard) {
+				LineRow row;
+				row.addr = address;
+				row.file = (endSequence || file >= files.size()) ? END_OF_SEQUENCE : files[file];
+				row.line = endSequence ? 0 : static_cast<int32_t>(line);
+				// linhas seguidas no mesmo endereco, vale a ultima
+				if (m_rows.size() > sequenceStart && m_rows.back().addr == address && !endSequence) {
+					m_rows.back() = row;
+				} else {
+					m_rows.push_back(row);
+				}
+			}
+			if (endSequence) {
+				if (discard) {
+					m_rows.resize(sequenceStart);
+				} else if (m_rows.size() > sequenceStart) {
+					m_sequences.push_back(make_pair(m_rows[sequenceStart].addr, sequenceStart));
+				}
+				sequenceStart = m_rows.size();
+				address = 0;
+				file = 1;
+				line = 1;
+				discard = false;
+			}
+		}
+		// sequencia sem o fim, descartada
+		m_rows.resize(sequenceStart);
+	}
+
+	void DwarfModule::sortLines()
+	{
+		// cada sequencia ja esta em ordem, basta ordenar as sequencias
+		bool sorted = true;
+		for (size_t i = 1; i < m_sequences.size() && sorted; ++i) {
+			sorted = m_sequences[i - 1] < m_sequences[i];
+		}
+		if (!sorted) {
+			sort(m_sequences.begin(), m_sequences.end());
+			vector<LineRow> rows;
+			rows.reserve(m_rows.size());
+			for (size_t i = 0; i < m_sequences.size(); ++i) {
+				const size_t first = m_sequences[i].second;
+				size_t last = first;
+				while (m_rows[last].file != END_OF_SEQUENCE) {
+					++last;
+				}
+				rows.insert(rows.end(), m_rows.begin() + first, m_rows.begin() + last + 1);
+			}
+			m_rows.swap(rows);
+		}
+		vector<pair<uint64_t, size_t> >().swap(m_sequences);
+	}
+
+	void DwarfModule::flattenFunctions()
+	{
+		// As funcoes inline ficam dentro das que as chamam, a pilha guarda as
+		// que contem o cursor e o topo e a mais interna
+		sort(m_functions.begin(), m_functions.end());
+		vector<FunctionRange> flat;
+		vector<FunctionRange> open;
+		uint64_t cursor = 0;
+
+		for (size_t i = 0; i <= m_functions.size(); ++i) {
+			const uint64_t limit = (i < m_functions.size()) ? m_functions[i].start : ~static_cast<uint64_t>(0);
+			while (!open.empty()) {
+				const FunctionRange& top = open.back();
+				const uint64_t end = min(top.end, limit);
+				if (cursor < end) {
+					FunctionRange range = top;
+					range.start = cursor;
+					range.end = end;
+					if (!flat.empty() && flat.back().die == range.die && flat.back().end == range.start) {
+						flat.back().end = range.end;
+					} else {
+						flat.push_back(range);
+					}
+					cursor = end;
+				}
+				if (top.end > limit) {
+					break;
+				}
+				open.pop_back();
+			}
+			if (i < m_functions.size()) {
+				cursor = max(cursor, limit);
+				open.push_back(m_functions[i]);
+			}
+		}
+		m_functions.swap(flat);
+	}
+
+	const std::string& DwarfModule::functionName(uint64_t die)
+	{
+		map<uint64_t, std::string>::iterator it = m_names.find(die);
+		if (it != m_names.end()) {
+			return it->second;
+		}
+		std::string& result = m_names[die];
+
+		// O nome pode estar na declaracao: abstract_origin -> specification
+		const char* name = NULL;
+		for (int hops = 0; hops < 8 && die != 0; ++hops) {
+			const Unit* unit = unitAt(die);
+			if (unit == NULL) {
+				break;
+			}
+			Reader r(m_info.data + die, m_info.data + unit->end);
+			Die entry;
+			entry.offset = die;
+			if (!readDie(r, *unit, &entry)) {
+				break;
+			}
+			const char* linkage = entry.linkageName.form ? attrString(*unit, entry.linkageName) : NULL;
+			if (linkage) {
+				if (!Demangling::demangle(linkage, result)) {
+					result = linkage;
+				}
+				return result;
+			}
+			if (name == NULL && entry.name.form) {
+				name = attrString(*unit, entry.name);
+			}
+			die = entry.origin.form ? reference(*unit, entry.origin) : reference(*unit, entry.specification);
+		}
+		if (name) {
+			result = name;
+		}
+		return result;
+	}
+}
+
+namespace Backtrace {
+	using namespace BacktracePrivate;
+
+	class DwarfSymbolLoader: public IDebugSymbolLoader {
+
+		// NULL para os modulos sem informacao de debug
+		typedef std::map<std::string, DwarfModule*> module_map;
+#ifdef USE_CXX11
+		typedef std::mutex mutex_t;
+		struct mutex_locker_t {
+			std::lock_guard<mutex_t> guard;
+			mutex_locker_t(mutex_t* l) : guard(*l) {}
+		};
+#elif defined USE_QT
+		typedef QMutex mutex_t;
+		typedef QMutexLocker mutex_locker_t;
+#endif
+	public:
+
+		DwarfSymbolLoader()
+		{
+		}
+
+		~DwarfSymbolLoader()
+		{
+			module_map::iterator it = m_modules.begin();
+			for (; it != m_modules.end(); ++it) {
+				delete it->second;
+			}
+		}
+
+		virtual bool findDebugInfo(StackFrame* frames, int nFrames)
+		{
+			bool status = false;
+			for (int i = 0; i < nFrames; ++i) {
+				SymbolCache& cache = SymbolCache::instance();
+				if (cache.fill(SymbolCache::keyFor(frames[i].addr), &frames[i], SymbolCache::SymbolsLoaded)) {
+					status = true;
+					continue;
+				}
+
+				// o endereco de retorno pode ser o inicio da proxima linha, ou
+				// da proxima funcao depois de uma chamada noreturn
+				const uintptr_t pc = reinterpret_cast<uintptr_t>(frames[i].addr) - 1;
+				ModuleInfo info;
+				if (frames[i].addr == NULL || !findModule(pc, &info)) {
+					continue;
+				}
+
+				mutex_locker_t locker(&m_mutex);
+				DwarfModule* module = moduleFor(info);
+				if (module == NULL) {
+					continue;
+				}
+				std::string source;
+				int line = -1;
+				std::string function;
+				// o nome da tabela de simbolos tem os parametros, o do DWARF
+				// so e usado se ela nao tiver a funcao
+				std::string* name = frames[i].function.empty() ? &function : NULL;
+				if (!module->find(pc - info.loadBias, &source, &line, name)) {
+					continue;
+				}
+				if (line > 0) {
+					frames[i].sourceFile = source;
+					frames[i].line = line;
+				}
+				if (!function.empty()) {
+					frames[i].function = function;
+				}
+				if (frames[i].imageFile.empty()) {
+					frames[i].imageFile = module->path();
+				}
+				SymbolCache::instance().updateCache(&frames[i], SymbolCache::SymbolsLoaded);
+				status = true;
+			}
+			return status;
+		}
+
+	private:
+		module_map m_modules;
+		mutex_t m_mutex;
+
+		DwarfModule* moduleFor(const ModuleInfo& info)
+		{
+			const std::string key = moduleKey(info);
+			module_map::iterator it = m_modules.find(key);
+			if (it != m_modules.end()) {
+				return it->second;
+			}
+			DwarfModule* module = new DwarfModule();
+			if (!module->load(info.path)) {
+				delete module;
+				module = NULL;
+			}
+			m_modules[key] = module;
+			return module;
+		}
+	};
+
+	IDebugSymbolLoader& getPlatformDebugSymbolLoader()
+	{
+		static DwarfSymbolLoader instance;
+		return instance;
+	}
+
+	void initializeExecutablePath(const char*)
+	{
+	}
+}
@@ -0,0 +1,182 @@
+#include "ElfFile.h"
+
+#include <link.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+	const uint32_t NOTE_GNU_BUILD_ID = 3;
+
+	size_t noteAlign(size_t size)
+	{
+		return (size + 3) & ~static_cast<size_t>(3);
+	}
+
+	bool fileExists(const std::string& path)
+	{
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+	}
+
+	bool nativeElf(const uint8_t* base, size_t size)
+	{
+		if (size < sizeof(ElfW(Ehdr)) || memcmp(base, ELFMAG, SELFMAG) != 0) {
+			return false;
+		}
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		const unsigned char data = ELFDATA2LSB;
+#else
+		const unsigned char data = ELFDATA2MSB;
+#endif
+#if __WORDSIZE == 64
+		const unsigned char elfClass = ELFCLASS64;
+#else
+		const unsigned char elfClass = ELFCLASS32;
+#endif
+		return base[EI_CLASS] == elfClass && base[EI_DATA] == data;
+	}
+}
+
+namespace BacktracePrivate {
+
+	ElfFile::ElfFile() : m_base(NULL), m_size(0)
+	{
+	}
+
+	ElfFile::~ElfFile()
+	{
+		if (m_base) {
+			munmap(const_cast<uint8_t*>(m_base), m_size);
+		}
+	}
+
+	bool ElfFile::open(const std::string& path)
+	{
+		const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		void* base = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		}
+		close(fd);
+		if (base == MAP_FAILED) {
+			return false;
+		}
+		if (!nativeElf(static_cast<const uint8_t*>(base), st.st_size)) {
+			munmap(base, st.st_size);
+			return false;
+		}
+		m_base = static_cast<const uint8_t*>(base);
+		m_size = st.st_size;
+		m_path = path;
+		return true;
+	}
+
+	bool ElfFile::section(const char* name, ElfSection* out) const
+	{
+		if (!m_base) {
+			return false;
+		}
+		const ElfW(Ehdr)* header = reinterpret_cast<const ElfW(Ehdr)*>(m_base);
+		if (header->e_shoff == 0 || header->e_shentsize != sizeof(ElfW(Shdr))
+				|| header->e_shoff + header->e_shnum * sizeof(ElfW(Shdr)) > m_size
+				|| header->e_shstrndx >= header->e_shnum) {
+			return false;
+		}
+		const ElfW(Shdr)* sections = reinterpret_cast<const ElfW(Shdr)*>(m_base + header->e_shoff);
+		const ElfW(Shdr)& names = sections[header->e_shstrndx];
+		if (names.sh_offset + names.sh_size > m_size) {
+			return false;
+		}
+		const char* strings = reinterpret_cast<const char*>(m_base + names.sh_offset);
+
+		for (int i = 0; i < header->e_shnum; ++i) {
+			const ElfW(Shdr)& section = sections[i];
+			if (section.sh_name >= names.sh_size || strcmp(strings + section.sh_name, name) != 0) {
+				continue;
+			}
+			if (section.sh_type == SHT_NOBITS || (section.sh_flags & SHF_COMPRESSED)
+					|| section.sh_offset + section.sh_size > m_size) {
+				return false;
+			}
+			out->data = m_base + section.sh_offset;
+			out->size = section.sh_size;
+			out->addr = section.sh_addr;
+			return true;
+		}
+		return false;
+	}
+
+	std::string ElfFile::buildId() const
+	{
+		ElfSection note;
+		if (!section(".note.gnu.build-id", &note)) {
+			return std::string();
+		}
+		const uint8_t* p = note.data;
+		const uint8_t* end = note.data + note.size;
+		while (p + sizeof(ElfW(Nhdr)) <= end) {
+			const ElfW(Nhdr)* header = reinterpret_cast<const ElfW(Nhdr)*>(p);
+			const uint8_t* name = p + sizeof(ElfW(Nhdr));
+			const uint8_t* desc = name + noteAlign(header->n_namesz);
+			if (desc + header->n_descsz > end) {
+				break;
+			}
+			if (header->n_type == NOTE_GNU_BUILD_ID && header->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+				return std::string(reinterpret_cast<const char*>(desc), header->n_descsz);
+			}
+			p = desc + noteAlign(header->n_descsz);
+		}
+		return std::string();
+	}
+
+	std::string ElfFile::debugFilePath() const
+	{
+		static const char HEX[] = "0123456789abcdef";
+
+		const std::string id = buildId();
+		if (id.size() > 1) {
+			std::string path("/usr/lib/debug/.build-id/");
+			for (size_t i = 0; i < id.size(); ++i) {
+				const uint8_t byte = id[i];
+				path += HEX[byte >> 4];
+				path += HEX[byte & 0xf];
+				if (i == 0) {
+					path += '/';
+				}
+			}
+			path += ".debug";
+			if (fileExists(path)) {
+				return path;
+			}
+		}
+
+		ElfSection link;
+		if (!section(".gnu_debuglink", &link) || memchr(link.data, '\0', link.size) == NULL) {
+			return std::string();
+		}
+		const std::string name(reinterpret_cast<const char*>(link.data));
+		const size_t slash = m_path.rfind('/');
+		const std::string dir = (slash == std::string::npos) ? std::string() : m_path.substr(0, slash + 1);
+
+		const std::string candidates[] = {
+			dir + name,
+			dir + ".debug/" + name,
+			"/usr/lib/debug/" + dir + name
+		};
+		for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+			// o debuglink pode ter o mesmo nome do proprio arquivo
+			if (candidates[i] != m_path && fileExists(candidates[i])) {
+				return candidates[i];
+			}
+		}
+		return std::string();
+	}
+}
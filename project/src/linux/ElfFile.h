@@ -0,0 +1,60 @@
+#ifndef ELFFILE_H
+#define ELFFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Read-only view of an ELF file mapped in memory, for the debug symbol loaders
+
+namespace BacktracePrivate {
+
+	struct ElfSection {
+		const uint8_t* data;
+		size_t size;
+		// Address of the section in the file's address space, 0 if it isn't loaded
+		uint64_t addr;
+
+		ElfSection() : data(NULL), size(0), addr(0) {}
+	};
+
+	class ElfFile {
+	public:
+		ElfFile();
+		~ElfFile();
+
+		/* Maps the file. Fails if it isn't an ELF file of the same class and
+		 * byte order of the process.
+		 */
+		bool open(const std::string& path);
+
+		bool isOpen() const { return m_base != NULL; }
+		const std::string& path() const { return m_path; }
+
+		/* Finds a section by name. Compressed sections (SHF_COMPRESSED) and
+		 * SHT_NOBITS sections, like the debug sections left by strip, are
+		 * reported as missing.
+		 */
+		bool section(const char* name, ElfSection* out) const;
+
+		// GNU build-id note, empty if the file has none
+		std::string buildId() const;
+
+		/* Path of the file with the debug information of a stripped file:
+		 * /usr/lib/debug/.build-id/xx/yyyy.debug or the .gnu_debuglink target
+		 * next to the file, in .debug/ or under /usr/lib/debug. Empty if none
+		 * of them exists.
+		 */
+		std::string debugFilePath() const;
+
+	private:
+		ElfFile(const ElfFile&);
+		ElfFile& operator=(const ElfFile&);
+
+		const uint8_t* m_base;
+		size_t m_size;
+		std::string m_path;
+	};
+}
+
+#endif // ELFFILE_H
@@ -0,0 +1,419 @@
+#include "Modules.h"
+#include "config.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+#include <link.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef USE_CXX11
+#include <mutex>
+#elif defined USE_QT
+#include <QMutex>
+#include <QMutexLocker>
+#endif
+
+namespace {
+	using namespace BacktracePrivate;
+
+#ifdef USE_CXX11
+	typedef std::mutex mutex_t;
+	struct mutex_locker_t {
+		std::lock_guard<mutex_t> guard;
+		mutex_locker_t(mutex_t* l) : guard(*l) {}
+	};
+#elif defined USE_QT
+	typedef QMutex mutex_t;
+	typedef QMutexLocker mutex_locker_t;
+#endif
+
+	const uint32_t NOTE_GNU_BUILD_ID = 3;
+
+	size_t noteAlign(size_t size)
+	{
+		return (size + 3) & ~static_cast<size_t>(3);
+	}
+
+	// Procura a nota do build-id nos segmentos PT_NOTE, que ja estao na memoria
+	int readBuildId(const struct dl_phdr_info* phdrInfo, uint8_t* out)
+	{
+		for (int i = 0; i < phdrInfo->dlpi_phnum; ++i) {
+			const ElfW(Phdr)& phdr = phdrInfo->dlpi_phdr[i];
+			if (phdr.p_type != PT_NOTE) {
+				continue;
+			}
+			const char* note = reinterpret_cast<const char*>(phdrInfo->dlpi_addr + phdr.p_vaddr);
+			const char* end = note + phdr.p_memsz;
+			while (note + sizeof(ElfW(Nhdr)) <= end) {
+				const ElfW(Nhdr)* header = reinterpret_cast<const ElfW(Nhdr)*>(note);
+				const char* name = note + sizeof(ElfW(Nhdr));
+				const char* desc = name + noteAlign(header->n_namesz);
+				if (desc + header->n_descsz > end) {
+					break;
+				}
+				if (header->n_type == NOTE_GNU_BUILD_ID && header->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+					const int size = header->n_descsz < MAX_BUILD_ID ? header->n_descsz : MAX_BUILD_ID;
+					memcpy(out, desc, size);
+					return size;
+				}
+				note = desc + noteAlign(header->n_descsz);
+			}
+		}
+		return 0;
+	}
+
+	// Os campos que nao dependem do endereco procurado
+	void describeModule(const struct dl_phdr_info* phdrInfo, ModuleInfo* info)
+	{
+		info->loadBias = phdrInfo->dlpi_addr;
+		info->start = 0;
+		info->end = 0;
+		info->ehFrameHdr = 0;
+		for (int i = 0; i < phdrInfo->dlpi_phnum; ++i) {
+			const ElfW(Phdr)& phdr = phdrInfo->dlpi_phdr[i];
+			if (phdr.p_type == PT_LOAD) {
+				const uintptr_t start = info->loadBias + phdr.p_vaddr;
+				const uintptr_t end = start + phdr.p_memsz;
+				if (info->end == 0 || start < info->start) {
+					info->start = start;
+				}
+				if (end > info->end) {
+					info->end = end;
+				}
+			} else if (phdr.p_type == PT_GNU_EH_FRAME) {
+				info->ehFrameHdr = info->loadBias + phdr.p_vaddr;
+			}
+		}
+		info->path = phdrInfo->dlpi_name ? phdrInfo->dlpi_name : "";
+		// o vdso tem nome, so o executavel fica sem
+		info->executable = (info->path[0] == '\0');
+		info->buildIdSize = readBuildId(phdrInfo, info->buildId);
+	}
+
+	struct FindContext {
+		uintptr_t addr;
+		ModuleInfo* info;
+	};
+
+	int findCallback(struct dl_phdr_info* phdrInfo, size_t, void* data)
+	{
+		FindContext* ctx = reinterpret_cast<FindContext*>(data);
+		const uintptr_t bias = phdrInfo->dlpi_addr;
+
+		for (int i = 0; i < phdrInfo->dlpi_phnum; ++i) {
+			const ElfW(Phdr)& phdr = phdrInfo->dlpi_phdr[i];
+			if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X)) {
+				const uintptr_t start = bias + phdr.p_vaddr;
+				const uintptr_t end = start + phdr.p_memsz;
+				if (ctx->addr >= start && ctx->addr < end) {
+					describeModule(phdrInfo, ctx->info);
+					ctx->info->textStart = start;
+					ctx->info->textEnd = end;
+					return 1;
+				}
+			}
+		}
+		return 0;
+	}
+
+	/*************************************************************************
+	 * Tabela de modulos
+	 */
+
+	struct Generation {
+		unsigned long long adds;
+		unsigned long long subs;
+
+		bool operator==(const Generation& that) const { return adds == that.adds && subs == that.subs; }
+	};
+}
+
+namespace BacktracePrivate {
+	struct ModuleTable {
+		Generation generation;
+		// unloadEpoch() quando a tabela foi montada
+		unsigned unloads;
+		// threads (ou handlers de sinal) lendo a tabela
+		int readers;
+		// um por segmento executavel, em ordem de endereco
+		std::vector<ModuleInfo> segments;
+	};
+}
+
+namespace {
+	bool byTextStart(const ModuleInfo& module, uintptr_t addr)
+	{
+		return module.textStart < addr;
+	}
+
+	bool textOrder(const ModuleInfo& a, const ModuleInfo& b)
+	{
+		return a.textStart < b.textStart;
+	}
+
+	ModuleTable* currentTable = NULL;
+	mutex_t rebuildLock;
+	// Tabelas substituidas, os segmentos sao liberados quando ninguem mais
+	// le. As estruturas sao reaproveitadas e nunca liberadas: uma thread
+	// que acabou de ler currentTable ainda pode incrementar readers.
+	std::vector<ModuleTable*>* retiredTables = NULL;
+	// os paths nunca sao liberados, um por arquivo
+	std::set<std::string>* paths = NULL;
+
+	// Incrementado por cada dlclose (veja __wrap_dlclose) e quando o rebuild
+	// ve um dlclose que nao passou pelo wrapper
+	unsigned unloadCount = 0;
+
+	// Os contadores estao em todas as entradas, basta a primeira
+	int generationCallback(struct dl_phdr_info* phdrInfo, size_t size, void* data)
+	{
+		Generation* generation = reinterpret_cast<Generation*>(data);
+		if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(phdrInfo->dlpi_subs)) {
+			generation->adds = phdrInfo->dlpi_adds;
+			generation->subs = phdrInfo->dlpi_subs;
+		}
+		return 1;
+	}
+
+	Generation loaderGeneration()
+	{
+		Generation generation = { 0, 0 };
+		dl_iterate_phdr(generationCallback, &generation);
+		return generation;
+	}
+
+	std::string executablePath()
+	{
+		char buffer[4096];
+		const ssize_t size = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+		if (size <= 0) {
+			return std::string();
+		}
+		return std::string(buffer, size);
+	}
+
+	// chamado com o rebuildLock
+	const char* internPath(const std::string& path)
+	{
+		if (paths == NULL) {
+			paths = new std::set<std::string>();
+		}
+		return paths->insert(path).first->c_str();
+	}
+
+	int buildCallback(struct dl_phdr_info* phdrInfo, size_t size, void* data)
+	{
+		ModuleTable* table = reinterpret_cast<ModuleTable*>(data);
+		generationCallback(phdrInfo, size, &table->generation);
+
+		ModuleInfo info;
+		describeModule(phdrInfo, &info);
+		info.path = internPath(info.executable ? executablePath() : std::string(info.path));
+
+		for (int i = 0; i < phdrInfo->dlpi_phnum; ++i) {
+			const ElfW(Phdr)& phdr = phdrInfo->dlpi_phdr[i];
+			if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X)) {
+				info.textStart = info.loadBias + phdr.p_vaddr;
+				info.textEnd = info.textStart + phdr.p_memsz;
+				table->segments.push_back(info);
+			}
+		}
+		return 0;
+	}
+
+	// A tabela corrente com um leitor a mais, ou NULL. Nao aloca nem trava,
+	// pode ser chamada de um handler de sinal.
+	ModuleTable* acquireTable()
+	{
+		for (;;) {
+			ModuleTable* table = __atomic_load_n(&currentTable, __ATOMIC_SEQ_CST);
+			if (table == NULL) {
+				return NULL;
+			}
+			__atomic_add_fetch(&table->readers, 1, __ATOMIC_SEQ_CST);
+			// se ainda e a corrente, o rebuild vai ver o leitor antes de liberar
+			if (__atomic_load_n(&currentTable, __ATOMIC_SEQ_CST) == table) {
+				return table;
+			}
+			__atomic_sub_fetch(&table->readers, 1, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	void releaseTable(const ModuleTable* table)
+	{
+		if (table != NULL) {
+			__atomic_sub_fetch(&const_cast<ModuleTable*>(table)->readers, 1, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	// chamado com o rebuildLock, libera os segmentos das tabelas sem leitores
+	// e devolve uma delas para ser reaproveitada
+	ModuleTable* recycleTables()
+	{
+		ModuleTable* free = NULL;
+		for (size_t i = 0; i < retiredTables->size(); ++i) {
+			ModuleTable* table = (*retiredTables)[i];
+			if (__atomic_load_n(&table->readers, __ATOMIC_SEQ_CST) != 0) {
+				continue;
+			}
+			std::vector<ModuleInfo>().swap(table->segments);
+			if (free == NULL) {
+				free = table;
+				(*retiredTables)[i] = retiredTables->back();
+				retiredTables->pop_back();
+				--i;
+			}
+		}
+		return free != NULL ? free : new ModuleTable();
+	}
+
+	bool isCurrent(const ModuleTable* table)
+	{
+		return table->unloads == unloadEpoch();
+	}
+
+	// Devolve a tabela atualizada, com um leitor a mais, no lugar de old
+	ModuleTable* rebuildTable(const ModuleTable* old)
+	{
+		mutex_locker_t locker(&rebuildLock);
+		// outra thread pode ter atualizado enquanto esta esperava
+		ModuleTable* table = __atomic_load_n(&currentTable, __ATOMIC_SEQ_CST);
+		if (table != NULL && table != old && isCurrent(table) && table->generation == loaderGeneration()) {
+			releaseTable(old);
+			return acquireTable();
+		}
+		if (retiredTables == NULL) {
+			retiredTables = new std::vector<ModuleTable*>();
+		}
+
+		// um dlclose que nao passou pelo wrapper (de outra biblioteca, como o
+		// QtCore) so aparece nos contadores, os caches tambem precisam dele
+		if (table != NULL && loaderGeneration().subs != table->generation.subs) {
+			__atomic_add_fetch(&unloadCount, 1, __ATOMIC_RELEASE);
+		}
+
+		ModuleTable* fresh = recycleTables();
+		// lido antes, um dlclose durante a montagem refaz a tabela de novo
+		fresh->unloads = unloadEpoch();
+		// uma thread atrasada pode ter incrementado readers de uma reaproveitada
+		__atomic_add_fetch(&fresh->readers, 1, __ATOMIC_SEQ_CST);
+		dl_iterate_phdr(buildCallback, fresh);
+		std::sort(fresh->segments.begin(), fresh->segments.end(), textOrder);
+		__atomic_store_n(&currentTable, fresh, __ATOMIC_SEQ_CST);
+		if (table != NULL) {
+			retiredTables->push_back(table);
+		}
+		releaseTable(old);
+		return fresh;
+	}
+
+	bool searchTable(const ModuleTable* table, uintptr_t addr, ModuleInfo* info)
+	{
+		std::vector<ModuleInfo>::const_iterator it = std::lower_bound(table->segments.begin(), table->segments.end(), addr + 1, byTextStart);
+		if (it == table->segments.begin()) {
+			return false;
+		}
+		--it;
+		if (addr >= it->textEnd) {
+			return false;
+		}
+		*info = *it;
+		return true;
+	}
+
+	struct VisitContext {
+		ModuleVisitor visit;
+		void* data;
+	};
+
+	int visitCallback(struct dl_phdr_info* phdrInfo, size_t, void* data)
+	{
+		VisitContext* ctx = reinterpret_cast<VisitContext*>(data);
+		ModuleInfo info;
+		describeModule(phdrInfo, &info);
+		LoadedModule module;
+		module.loadBias = info.loadBias;
+		module.start = info.start;
+		module.end = info.end;
+		module.path = info.path;
+		module.buildIdSize = info.buildIdSize;
+		memcpy(module.buildId, info.buildId, info.buildIdSize);
+		ctx->visit(module, ctx->data);
+		return 0;
+	}
+}
+
+namespace BacktracePrivate {
+
+	bool findModule(uintptr_t addr, ModuleInfo* info, bool refresh)
+	{
+		const ModuleSnapshot snapshot(refresh);
+		return snapshot.find(addr, info);
+	}
+
+	ModuleSnapshot::ModuleSnapshot(bool refresh)
+		: m_table(acquireTable())
+		, m_refresh(refresh)
+	{
+		// o epoch so conta os dlclose do wrapper, fora dos handlers de sinal
+		// os contadores do loader sao conferidos uma vez por snapshot
+		if (m_refresh && (m_table == NULL || !isCurrent(m_table) || !(m_table->generation == loaderGeneration()))) {
+			m_table = rebuildTable(m_table);
+		}
+	}
+
+	ModuleSnapshot::~ModuleSnapshot()
+	{
+		releaseTable(m_table);
+	}
+
+	bool ModuleSnapshot::find(uintptr_t addr, ModuleInfo* info) const
+	{
+		if (m_table != NULL && isCurrent(m_table) && searchTable(m_table, addr, info)) {
+			return true;
+		}
+		// os dlopen so sao vistos aqui, quando o endereco nao esta na tabela
+		if (m_refresh) {
+			if (m_table != NULL && m_table->generation == loaderGeneration()) {
+				return false;
+			}
+			m_table = rebuildTable(m_table);
+			return searchTable(m_table, addr, info);
+		}
+		FindContext ctx = { addr, info };
+		return dl_iterate_phdr(findCallback, &ctx) != 0;
+	}
+
+	unsigned unloadEpoch()
+	{
+		return __atomic_load_n(&unloadCount, __ATOMIC_ACQUIRE);
+	}
+
+	std::string moduleKey(const ModuleInfo& module)
+	{
+		std::string key(module.path);
+		key += '\0';
+		key.append(reinterpret_cast<const char*>(module.buildId), module.buildIdSize);
+		return key;
+	}
+
+	void forEachModule(ModuleVisitor visit, void* data)
+	{
+		VisitContext ctx = { visit, data };
+		dl_iterate_phdr(visitCallback, &ctx);
+	}
+}
+
+extern "C" int __real_dlclose(void* handle);
+
+// O dlclose e o unico jeito de um endereco da tabela passar a ser de outro
+// modulo, os dlopen sao achados quando um endereco nao esta na tabela
+extern "C" int __wrap_dlclose(void* handle)
+{
+	const int result = __real_dlclose(handle);
+	__atomic_add_fetch(&unloadCount, 1, __ATOMIC_RELEASE);
+	return result;
+}
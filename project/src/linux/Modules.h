@@ -0,0 +1,100 @@
+#ifndef MODULES_H
+#define MODULES_H
+
+#include <stdint.h>
+#include <string>
+
+// Lookup of the modules (executable and shared libraries) loaded in the process
+
+namespace BacktracePrivate {
+
+	const int MAX_BUILD_ID = 32;
+
+	struct ModuleInfo {
+		// Difference between the addresses in the ELF file and in memory
+		uintptr_t loadBias;
+		// Range covered by the loaded segments
+		uintptr_t start;
+		uintptr_t end;
+		// Range of the executable segment that contains the address
+		uintptr_t textStart;
+		uintptr_t textEnd;
+		// Address of the .eh_frame_hdr section or 0 if there is none
+		uintptr_t ehFrameHdr;
+		// File of the module, for the main executable it's read from
+		// /proc/self/exe. Interned by the module table and never freed.
+		const char* path;
+		bool executable;
+		// GNU build-id note, buildIdSize is 0 if the module has none
+		uint8_t buildId[MAX_BUILD_ID];
+		int buildIdSize;
+
+		ModuleInfo() : loadBias(0), start(0), end(0), textStart(0), textEnd(0), ehFrameHdr(0), path(""),
+			executable(false), buildIdSize(0) {}
+	};
+
+	/* Finds the module containing the address in the module table, a sorted
+	 * copy of the dynamic loader's list shared by the stack loaders, the
+	 * symbolizers and the caches. With refresh, each snapshot checks the
+	 * dlpi_adds/dlpi_subs counters once, taking the dynamic loader's lock,
+	 * and the table is rebuilt if a library was loaded or unloaded since,
+	 * which allocates. Where that isn't possible (signal handlers) pass
+	 * refresh = false: a hit is then trusted while unloadEpoch() is
+	 * unchanged, and a stale table or a miss reads the module from the
+	 * dynamic loader's list, with an empty path for the main executable.
+	 */
+	bool findModule(uintptr_t addr, ModuleInfo* info, bool refresh = true);
+
+	struct ModuleTable;
+
+	// Holds the module table for the lookups of a whole trace. The tables
+	// replaced after a dlclose or dlopen are freed when no snapshot uses them.
+	class ModuleSnapshot {
+	public:
+		explicit ModuleSnapshot(bool refresh = true);
+		~ModuleSnapshot();
+
+		bool find(uintptr_t addr, ModuleInfo* info) const;
+
+	private:
+		ModuleSnapshot(const ModuleSnapshot&);
+		ModuleSnapshot& operator=(const ModuleSnapshot&);
+
+		// trocada por uma atualizada quando um endereco nao e achado
+		mutable ModuleTable* m_table;
+		bool m_refresh;
+	};
+
+	// Changes on every dlclose seen by the wrapper (the programs must be
+	// linked with -Wl,--wrap,dlclose, like for __cxa_throw), and when a table
+	// rebuild finds an unload the wrapper missed: the caches keyed by code
+	// addresses must drop their entries, the address may now be of another
+	// module. Doesn't lock, it can be called from a signal handler.
+	unsigned unloadEpoch();
+
+	// Key of the module's file in the caches of the symbolizers: the path and
+	// the build-id, so a library rebuilt and loaded again at the same path
+	// isn't mistaken for the old one
+	std::string moduleKey(const ModuleInfo& module);
+
+	struct LoadedModule {
+		uintptr_t loadBias;
+		// Range covered by the loaded segments
+		uintptr_t start;
+		uintptr_t end;
+		// Owned by the dynamic loader, it's empty for the main executable
+		const char* path;
+		// GNU build-id note, buildIdSize is 0 if the module has none
+		uint8_t buildId[MAX_BUILD_ID];
+		int buildIdSize;
+	};
+
+	typedef void (*ModuleVisitor)(const LoadedModule& module, void* data);
+
+	// Calls visit for each loaded module, in load order, straight from the
+	// dynamic loader's list. It doesn't allocate, the crash handler uses it,
+	// but takes the dynamic loader's lock.
+	void forEachModule(ModuleVisitor visit, void* data);
+}
+
+#endif // MODULES_H
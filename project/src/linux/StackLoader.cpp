@@ -1,102 +1,357 @@
 #include "StackAddressLoader.h"
 #include "SymbolCache.h"
+#include "StackLoaderPrivate.h"
+#include "Modules.h"
+#include "SymbolTable.h"
 
 #include <algorithm>
 #include <string.h>
 #include <string>
 #include <execinfo.h>
+#include <pthread.h>
 #include "Demangling.h"
 using namespace std;
 
-namespace Backtrace {
+namespace {
+	using namespace Backtrace;
 	using namespace BacktracePrivate;
 
-	class LinuxStacktraceLoader: public Backtrace::IStackAddresLoader {
+	const int MAX_STACK = MAX_STACK_DEPTH;
 
-		virtual int getStack(int depth, StackFrame* frames) {
-			const int MAX_STACK = 32;
+	uint64_t hashBytes(const void* data, size_t size)
+	{
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		uint64_t hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < size; ++i) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
 
-			depth = std::min(MAX_STACK, depth);
-			void* addrs[MAX_STACK];
-			void* addrs_to_load[MAX_STACK];
-			int index[MAX_STACK];
-
-			const int effDepth = backtrace(addrs, depth);
-
-			// heuristica: vou de baixo para cima até achar o primeiro simbolo desconhecido
-			int symbolLoadDepth=0;
-
-			// pula o frame deste metodo
-			for (int i = 1; i < effDepth; ++i) {
-				const SymbolCache::CachedFrame* frame = SymbolCache::instance().cachedFor(addrs[i]);
-				if (frame == NULL || frame->state == SymbolCache::NothingLoaded) {
-					addrs_to_load[symbolLoadDepth] = addrs[i];
-					index[symbolLoadDepth] = i-1;
-					symbolLoadDepth++;
-				} else {
-					frames[i-1] = *frame;
+	// O build-id identifica o arquivo em qualquer diretorio, sem ele so o caminho
+	uint64_t moduleId(const ModuleInfo& module)
+	{
+		if (module.buildIdSize > 0) {
+			return hashBytes(module.buildId, module.buildIdSize);
+		}
+		return hashBytes(module.path, strlen(module.path));
+	}
+
+	/* A busca de moduleOffsets() e moduleAddresses(), para o fingerprint e a
+	 * chave de um frame virem do mesmo modulo. O endereco de retorno pode
+	 * estar logo depois do fim do modulo, entao o modulo e o de addr-1. ids
+	 * recebe moduleId() e names o hash so do nome do arquivo (o diretorio de
+	 * instalacao pode mudar), qualquer um pode ser NULL.
+	 */
+	void findModules(void* const* addrs, int n, uintptr_t* offsets, uint64_t* ids, uint64_t* names)
+	{
+		// frames vizinhos quase sempre estao no mesmo modulo
+		const ModuleSnapshot snapshot;
+		ModuleInfo module;
+		bool haveModule = false;
+		uint64_t id = 0;
+		uint64_t name = 0;
+
+		for (int i = 0; i < n; ++i) {
+			const uintptr_t addr = reinterpret_cast<uintptr_t>(addrs[i]);
+			const uintptr_t pc = addr - 1;
+			if (!haveModule || pc < module.textStart || pc >= module.textEnd) {
+				haveModule = (addr != 0) && snapshot.find(pc, &module);
+				if (haveModule) {
+					id = ids ? moduleId(module) : 0;
+					const char* file = strrchr(module.path, '/');
+					file = file ? file + 1 : module.path;
+					name = names ? hashBytes(file, strlen(file)) : 0;
 				}
 			}
+			offsets[i] = haveModule ? addr - module.loadBias : addr;
+			if (ids) {
+				ids[i] = haveModule ? id : 0;
+			}
+			if (names) {
+				names[i] = haveModule ? name : 0;
+			}
+		}
+	}
 
-			char **strings = backtrace_symbols (addrs_to_load, symbolLoadDepth);
+	// How far the walk may go when the stack bounds of the thread are unknown
+	const uintptr_t UNKNOWN_STACK_SIZE = 1024*1024;
 
-			for (int i = 0; i < symbolLoadDepth; i++) {
+	/* Fills the function and module names of the frames, using the cache when
+	 * possible. The names come from the symbol table of each module, which
+	 * unlike backtrace_symbols() also has the static functions.
+	 */
+	void loadNames(StackFrame* frames, int nFrames)
+	{
+		SymbolCache& cache = SymbolCache::instance();
+		// frames vizinhos quase sempre estao no mesmo modulo
+		const ModuleSnapshot snapshot;
+		ModuleInfo module;
+		bool haveModule = false;
+		uint64_t id = 0;
+		const SymbolTable* symbols = NULL;
+		bool symbolsLoaded = false;
 
-				StackFrame& frame = frames[index[i]];
+		for (int i = 0; i < nFrames; ++i) {
+			StackFrame& frame = frames[i];
+			const uintptr_t addr = reinterpret_cast<uintptr_t>(frame.addr);
+			// o endereco de retorno pode ser o inicio da proxima funcao,
+			// depois de uma chamada noreturn
+			const uintptr_t pc = addr - 1;
+			if (!haveModule || pc < module.textStart || pc >= module.textEnd) {
+				haveModule = (addr != 0) && snapshot.find(pc, &module);
+				id = haveModule ? moduleId(module) : 0;
+				symbolsLoaded = false;
+			}
+			// a mesma chave de moduleAddresses()
+			const SymbolCache::Key key = haveModule ? SymbolCache::Key(id, addr - module.loadBias) : SymbolCache::Key(0, addr);
+			if (cache.fill(key, &frame, SymbolCache::AddressLoaded)) {
+				continue;
+			}
 
-				frame.addr = addrs_to_load[i];
+			if (haveModule) {
+				if (!symbolsLoaded) {
+					symbols = SymbolTable::forModule(module);
+					symbolsLoaded = true;
+				}
+				frame.imageFile = module.path;
+				const char* name = symbols ? symbols->find(pc - module.loadBias) : NULL;
+				if (name != NULL && !Demangling::demangle(name, frame.function)) {
+					frame.function = name;
+				}
+			}
+			cache.intern(key, &frame, SymbolCache::AddressLoaded);
+		}
+	}
+}
 
-				bool success = false;
-				char * begin = strstr(strings[i], "(");
+namespace BacktracePrivate {
 
-				if (begin) {
+	void setAddresses(void** addrs, int nFrames, StackFrame* frames)
+	{
+		for (int i = 0; i < nFrames; ++i) {
+			StackFrame& frame = frames[i];
+			frame.addr = addrs[i];
+			frame.function.clear();
+			frame.line = -1;
+			frame.sourceFile.clear();
+			frame.imageFile.clear();
+		}
+	}
 
-					frame.imageFile.clear();
-					frame.imageFile.append(strings[i], begin-strings[i]);
+	// Limites da pilha da thread corrente, carregados na primeira chamada
+	static __thread uintptr_t stackLow = 0;
+	static __thread uintptr_t stackHigh = 0;
 
-					++begin;
-					if (strncmp(begin, "_Z", 2) != 0) {
-						continue;
-					}
+	bool currentStackBounds(uintptr_t* low, uintptr_t* high)
+	{
+		if (stackHigh == 0) {
+			pthread_attr_t attr;
+			if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+				return false;
+			}
+			void* addr = NULL;
+			size_t size = 0;
+			const bool ok = (pthread_attr_getstack(&attr, &addr, &size) == 0);
+			pthread_attr_destroy(&attr);
+			if (!ok) {
+				return false;
+			}
+			stackLow = reinterpret_cast<uintptr_t>(addr);
+			stackHigh = stackLow + size;
+		}
+		*low = stackLow;
+		*high = stackHigh;
+		return true;
+	}
 
-					char * pos = 0;
+	// Codigo da biblioteca, vazio se ela foi ligada estaticamente
+	static uintptr_t libraryStart = 0;
+	static uintptr_t libraryEnd = 0;
 
-					for (char * c = begin+1; *c != '\0'; ++c) {
-						if (!(isalnum(*c) || *c == '_')) {
-							pos = c;
-							break;
-						}
-					}
-					if (pos) {
-						char c = *pos;
-						*pos = 0;
+	void loadLibraryRange()
+	{
+		if (__atomic_load_n(&libraryEnd, __ATOMIC_ACQUIRE) != 0) {
+			return;
+		}
+		ModuleInfo module;
+		// ligada estaticamente o codigo da biblioteca esta misturado com o do programa
+		if (findModule(reinterpret_cast<uintptr_t>(&loadLibraryRange), &module) && !module.executable) {
+			libraryStart = module.textStart;
+			__atomic_store_n(&libraryEnd, module.textEnd, __ATOMIC_RELEASE);
+		}
+	}
 
-                        string demangled;
+	bool skipFrame(void* pc, int* skip)
+	{
+		if (*skip > 0) {
+			--*skip;
+			return true;
+		}
+		if (*skip == SKIP_LIBRARY) {
+			const uintptr_t addr = reinterpret_cast<uintptr_t>(pc);
+			if (addr >= libraryStart && addr < __atomic_load_n(&libraryEnd, __ATOMIC_ACQUIRE)) {
+				return true;
+			}
+			// so os frames do topo
+			*skip = 0;
+		}
+		return false;
+	}
+
+	void signalSafeStackBounds(uintptr_t* low, uintptr_t* high)
+	{
+		if (stackHigh != 0) {
+			*low = stackLow;
+			*high = stackHigh;
+		} else {
+			// a thread nao foi inicializada, entao so o que esta acima deste frame
+			int marker = 0;
+			*low = reinterpret_cast<uintptr_t>(&marker);
+			*high = *low + UNKNOWN_STACK_SIZE;
+		}
+	}
+}
 
-                        bool dem_success = Demangling::demangle(begin, demangled);
+namespace {
 
-						if (dem_success) {
-							frame.function = demangled;
-							success = true;
-						}
-						*pos = c;
-					}
-				}
-				if (!success) {
-					frame.function = strings[i];
-				}
-				SymbolCache::instance().updateCache(&frame, SymbolCache::AddressLoaded);
-            }
-			free (strings);
+	// backtrace() can't skip frames, so the skipped ones use part of this
+	const int MAX_CAPTURE = 2*MAX_STACK;
+
+	// backtrace() includes the frame of the function calling it, it must be
+	// inlined in the loader methods so that only their frames are dropped
+	inline __attribute__((always_inline)) int captureWithBacktrace(int depth, int skip, void** out)
+	{
+		depth = std::min(MAX_STACK, depth);
+		void* addrs[MAX_CAPTURE+1];
 
-			return effDepth - 1;
+		const int wanted = (skip >= 0) ? std::min(depth + skip, MAX_CAPTURE) : MAX_CAPTURE;
+		const int effDepth = backtrace(addrs, wanted+1);
+
+		// pula o frame do metodo
+		int first = 1;
+		while (first < effDepth && skipFrame(addrs[first], &skip)) {
+			++first;
+		}
+		const int n = std::min(effDepth - first, depth);
+		if (n <= 0) {
+			return 0;
+		}
+		memcpy(out, addrs+first, n*sizeof(void*));
+		return n;
+	}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+	#define FRAME_POINTER_SUPPORTED
+
+	// Every frame starts with the saved frame pointer of the caller followed by
+	// the return address (on aarch64 the frame record has the same layout). The
+	// chain must grow towards the top of the stack and stay inside the bounds
+	// of the thread's stack, otherwise we stop.
+	int walkFramePointers(uintptr_t fp, uintptr_t stackLow, uintptr_t stackHigh, int depth, int skip, void** out)
+	{
+		depth = std::min(MAX_STACK, depth);
+		int n = 0;
+
+		while (n < depth) {
+			if (fp < stackLow || fp + 2*sizeof(void*) > stackHigh || (fp & (sizeof(void*)-1)) != 0) {
+				break;
+			}
+			void** record = reinterpret_cast<void**>(fp);
+			if (record[1] == NULL) {
+				break;
+			}
+			if (!skipFrame(record[1], &skip)) {
+				out[n++] = record[1];
+			}
+
+			const uintptr_t next = reinterpret_cast<uintptr_t>(record[0]);
+			if (next <= fp) {
+				break;
+			}
+			fp = next;
+		}
+		return n;
+	}
+#endif
+}
+
+namespace Backtrace {
+
+	class LinuxStacktraceLoader: public Backtrace::IStackAddresLoader {
+
+		virtual int getStack(int depth, StackFrame* frames, int skip) {
+			void* addrs[MAX_STACK];
+			const int n = captureWithBacktrace(depth, skip, addrs);
+			setAddresses(addrs, n, frames);
+			return n;
+		}
+
+		// backtrace() is safe once libgcc was loaded, initialize() takes care of that
+		virtual int getStackAddresses(int depth, void** addrs, int skip) {
+			return captureWithBacktrace(depth, skip, addrs);
 		}
 	};
 
-	IStackAddresLoader& getPlatformStackLoader()
+	void loadSymbolNames(StackFrame* frames, int nFrames)
+	{
+		loadNames(frames, nFrames);
+	}
+
+	void moduleOffsets(void* const* addrs, int n, uintptr_t* offsets, uint64_t* modules)
+	{
+		findModules(addrs, n, offsets, NULL, modules);
+	}
+
+	void moduleAddresses(void* const* addrs, int n, uintptr_t* offsets, uint64_t* modules, uint64_t* names)
+	{
+		findModules(addrs, n, offsets, modules, names);
+	}
+
+	IStackAddresLoader& getDefaultStackLoader()
 	{
 		static LinuxStacktraceLoader instance;
 		return instance;
 	}
 
+#ifdef FRAME_POINTER_SUPPORTED
+
+	class FramePointerStackLoader: public Backtrace::IStackAddresLoader {
+
+		virtual int __attribute__((noinline)) getStack(int depth, StackFrame* frames, int skip) {
+			uintptr_t stackLow, stackHigh;
+			if (!currentStackBounds(&stackLow, &stackHigh)) {
+				return 0;
+			}
+			void* addrs[MAX_STACK];
+			const uintptr_t fp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+			const int n = walkFramePointers(fp, stackLow, stackHigh, depth, skip, addrs);
+			setAddresses(addrs, n, frames);
+			return n;
+		}
+
+		virtual int __attribute__((noinline)) getStackAddresses(int depth, void** addrs, int skip) {
+			uintptr_t stackLow, stackHigh;
+			signalSafeStackBounds(&stackLow, &stackHigh);
+			const uintptr_t fp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+			return walkFramePointers(fp, stackLow, stackHigh, depth, skip, addrs);
+		}
+	};
+
+	IStackAddresLoader* getFramePointerStackLoader()
+	{
+		static FramePointerStackLoader instance;
+		return &instance;
+	}
+
+#else
+
+	IStackAddresLoader* getFramePointerStackLoader()
+	{
+		return NULL;
+	}
+
+#endif
+
 }
@@ -0,0 +1,65 @@
+#ifndef STACKLOADERPRIVATE_H
+#define STACKLOADERPRIVATE_H
+
+#include "BackTrace.h"
+#include "StackAddressLoader.h"
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+
+// Helpers shared by the linux stack loaders
+
+namespace BacktracePrivate {
+	using namespace Backtrace;
+
+	// Only the address is loaded at capture time, the rest is cleared
+	// because the frames may be reused
+	void setAddresses(void** addrs, int nFrames, StackFrame* frames);
+
+	// Bounds of the current thread's stack. They are loaded on the first call
+	// in each thread.
+	bool currentStackBounds(uintptr_t* low, uintptr_t* high);
+
+	// Same as above, but never loads the bounds. If the thread wasn't
+	// initialized the bounds are estimated from the current frame.
+	void signalSafeStackBounds(uintptr_t* low, uintptr_t* high);
+
+	// Finds the code of this library, for SKIP_LIBRARY. It's called by
+	// initializeThread(), before that nothing is skipped.
+	void loadLibraryRange();
+
+	// Whether the loaders drop the frame at pc, the next one of the walk.
+	// skip is the number of frames still to be dropped or SKIP_LIBRARY.
+	bool skipFrame(void* pc, int* skip);
+
+	// Stack of one thread, captured by the thread itself from a signal
+	struct ThreadSlot {
+		pid_t tid;
+		// -1 if the thread was gone when signaled
+		int size;
+		volatile int done;
+		void* addrs[MAX_STACK_DEPTH];
+	};
+
+	// Lists the threads of the process without allocating. Returns how many
+	// there are, only the first max are stored.
+	int listThreadIds(pid_t* tids, int max);
+
+	// Signals the threads of the slots not yet done to capture their stacks
+	// and waits at most timeoutMs for them. It doesn't allocate, so the crash
+	// handler can use it: with tryOnly it returns false instead of waiting
+	// for a snapshot that is already running.
+	bool signalThreads(ThreadSlot* slots, int n, int depth, int timeoutMs, bool tryOnly);
+
+	// Whether enableCrashReport() was called
+	bool crashReportEnabled();
+
+	// Writes the crash report from the signal handler and restores the
+	// default action of the signal, so the process dies when the handler
+	// returns. Without enableCrashReport() it goes to stderr as text.
+	// context is the ucontext_t of the handler. reason, if not NULL, is
+	// written before the signal name.
+	void reportCrash(int signum, siginfo_t* info, void* context, const char* reason);
+}
+
+#endif // STACKLOADERPRIVATE_H
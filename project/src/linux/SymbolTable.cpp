@@ -0,0 +1,167 @@
+#include "SymbolTable.h"
+
+#include <algorithm>
+#include <map>
+#include <link.h>
+#include <string.h>
+
+#ifdef USE_CXX11
+#include <mutex>
+#elif defined USE_QT
+#include <QMutex>
+#include <QMutexLocker>
+#endif
+
+using namespace std;
+
+namespace {
+	using namespace BacktracePrivate;
+
+#ifdef USE_CXX11
+	typedef std::mutex mutex_t;
+	struct mutex_locker_t {
+		std::lock_guard<mutex_t> guard;
+		mutex_locker_t(mutex_t* l) : guard(*l) {}
+	};
+#elif defined USE_QT
+	typedef QMutex mutex_t;
+	typedef QMutexLocker mutex_locker_t;
+#endif
+
+	// Simbolo candidato, antes de escolher entre os aliases
+	struct Candidate {
+		uint64_t start;
+		uint32_t size;
+		uint32_t name;
+		int rank;
+
+		bool operator<(const Candidate& that) const {
+			if (start != that.start) return start < that.start;
+			return rank < that.rank;
+		}
+	};
+
+	// Entre aliases no mesmo endereco: com tamanho, depois global, fraco, local
+	int rankOf(const ElfW(Sym)& symbol)
+	{
+		int rank = (symbol.st_size != 0) ? 0 : 4;
+		switch (ELF64_ST_BIND(symbol.st_info)) {
+			case STB_GLOBAL: break;
+			case STB_WEAK: rank += 1; break;
+			default: rank += 2; break;
+		}
+		return rank;
+	}
+
+	mutex_t tablesLock;
+	// as tabelas nunca sao liberadas, os nomes devolvidos continuam validos
+	map<string, const SymbolTable*>* tables = NULL;
+}
+
+namespace BacktracePrivate {
+
+	const SymbolTable* SymbolTable::forModule(const ModuleInfo& module)
+	{
+		const string key = moduleKey(module);
+		mutex_locker_t locker(&tablesLock);
+		if (tables == NULL) {
+			tables = new map<string, const SymbolTable*>();
+		}
+		map<string, const SymbolTable*>::iterator it = tables->find(key);
+		if (it != tables->end()) {
+			return it->second;
+		}
+		SymbolTable* table = new SymbolTable();
+		if (!table->load(module.path)) {
+			delete table;
+			table = NULL;
+		}
+		(*tables)[key] = table;
+		return table;
+	}
+
+	bool SymbolTable::byStart(const Symbol& symbol, uint64_t addr)
+	{
+		return symbol.start < addr;
+	}
+
+	const char* SymbolTable::find(uint64_t addr) const
+	{
+		vector<Symbol>::const_iterator it = lower_bound(m_symbols.begin(), m_symbols.end(), addr + 1, byStart);
+		if (it == m_symbols.begin()) {
+			return NULL;
+		}
+		--it;
+		if (it->size != 0 && addr - it->start >= it->size) {
+			return NULL;
+		}
+		return m_strings + it->name;
+	}
+
+	bool SymbolTable::load(const std::string& path)
+	{
+		if (!m_elf.open(path)) {
+			return false;
+		}
+		if (read(m_elf, ".symtab", ".strtab")) {
+			return true;
+		}
+		// o strip deixa o .symtab no arquivo de debug
+		const std::string debugPath = m_elf.debugFilePath();
+		if (!debugPath.empty() && m_debugElf.open(debugPath) && read(m_debugElf, ".symtab", ".strtab")) {
+			return true;
+		}
+		return read(m_elf, ".dynsym", ".dynstr");
+	}
+
+	bool SymbolTable::read(const ElfFile& elf, const char* symbolsName, const char* stringsName)
+	{
+		ElfSection symbols;
+		ElfSection strings;
+		if (!elf.section(symbolsName, &symbols) || !elf.section(stringsName, &strings) || strings.size == 0) {
+			return false;
+		}
+
+		const ElfW(Sym)* begin = reinterpret_cast<const ElfW(Sym)*>(symbols.data);
+		const size_t count = symbols.size / sizeof(ElfW(Sym));
+		vector<Candidate> candidates;
+		candidates.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			const ElfW(Sym)& symbol = begin[i];
+			const int type = ELF64_ST_TYPE(symbol.st_info);
+			if ((type != STT_FUNC && type != STT_GNU_IFUNC) || symbol.st_shndx == SHN_UNDEF
+					|| symbol.st_value == 0 || symbol.st_name == 0 || symbol.st_name >= strings.size) {
+				continue;
+			}
+			Candidate candidate;
+			candidate.start = symbol.st_value;
+			candidate.size = static_cast<uint32_t>(min<uint64_t>(symbol.st_size, 0xffffffff));
+			candidate.name = symbol.st_name;
+			candidate.rank = rankOf(symbol);
+			candidates.push_back(candidate);
+		}
+		if (candidates.empty()) {
+			return false;
+		}
+		sort(candidates.begin(), candidates.end());
+
+		m_symbols.reserve(candidates.size());
+		for (size_t i = 0; i < candidates.size(); ++i) {
+			if (!m_symbols.empty() && m_symbols.back().start == candidates[i].start) {
+				continue;
+			}
+			Symbol symbol;
+			symbol.start = candidates[i].start;
+			symbol.size = candidates[i].size;
+			symbol.name = candidates[i].name;
+			m_symbols.push_back(symbol);
+		}
+		// o ultimo byte da tabela de strings e sempre nulo
+		if (strings.data[strings.size - 1] != '\0') {
+			m_symbols.clear();
+			return false;
+		}
+		m_strings = reinterpret_cast<const char*>(strings.data);
+		return true;
+	}
+}
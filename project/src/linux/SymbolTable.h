@@ -0,0 +1,53 @@
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include "config.h"
+#include "ElfFile.h"
+#include "Modules.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Index of the function symbols of a module, for the names of the frames
+
+namespace BacktracePrivate {
+
+	class SymbolTable {
+	public:
+		/* Table of the module's file, built on the first call and kept until
+		 * the process ends (one per moduleKey). It reads .symtab, from the
+		 * file or from its separate debug file, or .dynsym if the module was
+		 * stripped. Returns NULL if the file has no function symbols.
+		 */
+		static const SymbolTable* forModule(const ModuleInfo& module);
+
+		/* Name (not demangled) of the function containing the address,
+		 * relative to the ELF file, or NULL. Doesn't allocate or lock: the
+		 * name points to the string table mapped in memory.
+		 */
+		const char* find(uint64_t addr) const;
+
+	private:
+		SymbolTable() : m_strings(NULL) {}
+
+		struct Symbol {
+			uint64_t start;
+			// 0 for symbols without size, they go up to the next symbol
+			uint32_t size;
+			uint32_t name;
+		};
+
+		static bool byStart(const Symbol& symbol, uint64_t addr);
+
+		bool load(const std::string& path);
+		bool read(const ElfFile& elf, const char* symbols, const char* strings);
+
+		ElfFile m_elf;
+		ElfFile m_debugElf;
+		const char* m_strings;
+		std::vector<Symbol> m_symbols;
+	};
+}
+
+#endif // SYMBOLTABLE_H
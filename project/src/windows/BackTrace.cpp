@@ -3,12 +3,64 @@
 #include "DebugSymbolLoader.h"
 
 #include <memory>
+#include <io.h>
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
 
 namespace Backtrace {
     void initialize(const char* argv0) {
         initializeExecutablePath(argv0);
 	}
 
+	void initializeThread()
+	{
+	}
+
+	// so a thread corrente, veja BackTrace.h
+	std::vector<ThreadStack> snapshotAllThreads(int depth)
+	{
+		std::vector<ThreadStack> stacks;
+		ThreadStack stack;
+		stack.threadId = currentThreadId();
+		stack.trace = trace(depth);
+		stacks.push_back(stack);
+		return stacks;
+	}
+
+	StackTrace* snapshotThread(int threadId, int depth)
+	{
+		if (threadId != currentThreadId()) {
+			return NULL;
+		}
+		return trace(depth);
+	}
+
+	int currentThreadId()
+	{
+		return static_cast<int>(GetCurrentThreadId());
+	}
+
+	void setSnapshotSignal(int)
+	{
+	}
+
+	void enableCrashReport(int, bool, CrashReportFormat)
+	{
+	}
+
+	void writeEmergencyReport(int fd, const char* message)
+	{
+		void* addrs[64];
+		const int n = getDefaultStackLoader().getStackAddresses(64, addrs, 1);
+		_write(fd, message, static_cast<unsigned>(strlen(message)));
+		char line[32];
+		for (int i = 0; i < n; ++i) {
+			const int size = _snprintf(line, sizeof(line), "%p\n", addrs[i]);
+			_write(fd, line, size);
+		}
+	}
+
 	bool backtraceSupported()
 	{
 		return true;
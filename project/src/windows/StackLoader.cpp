@@ -7,6 +7,7 @@
 // Substituir por std::mutex
 #include <QMutex>
 
+#include <algorithm>
 #include <string>
 using namespace std;
 
@@ -23,7 +24,7 @@ namespace Backtrace {
             SymCleanup(GetCurrentProcess());
         }
 
-        virtual int getStack(int depth, Backtrace::StackFrame* frames) {
+        virtual int getStack(int depth, Backtrace::StackFrame* frames, int skip) {
             QMutexLocker locker(&m_mutex);
 
             char procname[MAX_PATH];
@@ -53,7 +54,9 @@ namespace Backtrace {
             HANDLE process = GetCurrentProcess();
 
             int i = 0;
-            int skip = 2;
+            // os frames deste metodo e do GetThreadContext
+            int topFrames = 2;
+            const DWORD library = libraryBase();
 
             const int SYMBUF = 512;
             char symbol_buffer[sizeof(IMAGEHLP_SYMBOL) + SYMBUF];
@@ -68,12 +71,22 @@ namespace Backtrace {
                             SymFunctionTableAccess,
                             SymGetModuleBase, 0)) {
 
-                if (skip-- > 0) {
+                if (topFrames-- > 0) {
                     continue;
                 }
 
                 DWORD module_base = SymGetModuleBase(process, frame.AddrPC.Offset);
 
+                if (skip > 0) {
+                    --skip;
+                    continue;
+                } else if (skip == SKIP_LIBRARY) {
+                    if (library != 0 && module_base == library) {
+                        continue;
+                    }
+                    skip = 0;
+                }
+
                 GetModuleFileNameA((HINSTANCE)module_base, module_name_raw, MAX_PATH);
 
                 IMAGEHLP_SYMBOL* symbol = reinterpret_cast<IMAGEHLP_SYMBOL*>(symbol_buffer);
@@ -96,11 +109,133 @@ namespace Backtrace {
             }
             return i;
         }
+
+        // StackWalk isn't reentrant, but this one doesn't need the symbol handler
+        virtual int getStackAddresses(int depth, void** addrs, int skip) {
+            // pula o frame deste metodo
+            if (skip >= 0) {
+                return CaptureStackBackTrace(1 + skip, depth, addrs, NULL);
+            }
+            void* captured[2*MAX_STACK_DEPTH];
+            const int n = CaptureStackBackTrace(1, 2*MAX_STACK_DEPTH, captured, NULL);
+            const HMODULE library = reinterpret_cast<HMODULE>(libraryBase());
+            int first = 0;
+            for (; first < n; ++first) {
+                HMODULE module = NULL;
+                if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                                        reinterpret_cast<LPCSTR>(captured[first]), &module) || module != library) {
+                    break;
+                }
+            }
+            const int count = std::min(depth, n - first);
+            for (int i = 0; i < count; ++i) {
+                addrs[i] = captured[first + i];
+            }
+            return count;
+        }
+
+        // Base do modulo desta biblioteca, o executavel se ela foi ligada estaticamente
+        static DWORD libraryBase() {
+            HMODULE module = NULL;
+            GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                               reinterpret_cast<LPCSTR>(&getDefaultStackLoader), &module);
+            return module == GetModuleHandleA(NULL) ? 0 : reinterpret_cast<DWORD>(module);
+        }
+
+        void loadNames(StackFrame* frames, int nFrames) {
+            QMutexLocker locker(&m_mutex);
+
+            HANDLE process = GetCurrentProcess();
+
+            const int SYMBUF = 512;
+            char symbol_buffer[sizeof(IMAGEHLP_SYMBOL) + SYMBUF];
+            char module_name_raw[MAX_PATH];
+
+            for (int i = 0; i < nFrames; ++i) {
+                if (!frames[i].function.empty()) {
+                    continue;
+                }
+                const DWORD addr = reinterpret_cast<DWORD>(frames[i].addr);
+                DWORD module_base = SymGetModuleBase(process, addr);
+
+                if (GetModuleFileNameA((HINSTANCE)module_base, module_name_raw, MAX_PATH)) {
+                    frames[i].imageFile = module_name_raw;
+                }
+
+                IMAGEHLP_SYMBOL* symbol = reinterpret_cast<IMAGEHLP_SYMBOL*>(symbol_buffer);
+                symbol->SizeOfStruct = sizeof(IMAGEHLP_SYMBOL);
+                symbol->MaxNameLength = SYMBUF-1;
+                DWORD dummy = 0;
+
+                if (SymGetSymFromAddr(process, addr, &dummy, symbol)) {
+                    frames[i].function = symbol->Name;
+                }
+            }
+        }
     };
 
-    IStackAddresLoader& getPlatformStackLoader()
+    IStackAddresLoader& getDefaultStackLoader()
     {
         static WindowsStacktraceLoader instance;
         return instance;
     }
+
+    // getStack loads the names along with the addresses, this is for the
+    // frames captured with getStackAddresses
+    void loadSymbolNames(StackFrame* frames, int nFrames)
+    {
+        static_cast<WindowsStacktraceLoader&>(getDefaultStackLoader()).loadNames(frames, nFrames);
+    }
+
+    void moduleOffsets(void* const* addrs, int n, uintptr_t* offsets, uint64_t* modules)
+    {
+        HMODULE lastModule = NULL;
+        uint64_t lastHash = 0;
+        for (int i = 0; i < n; ++i) {
+            HMODULE module = NULL;
+            if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                                    reinterpret_cast<LPCSTR>(addrs[i]), &module)) {
+                offsets[i] = reinterpret_cast<uintptr_t>(addrs[i]);
+                modules[i] = 0;
+                continue;
+            }
+            if (module != lastModule) {
+                char path[MAX_PATH];
+                const DWORD len = GetModuleFileNameA(module, path, sizeof(path));
+                const char* name = path;
+                for (DWORD c = 0; c < len; ++c) {
+                    if (path[c] == '\\' || path[c] == '/') {
+                        name = path + c + 1;
+                    }
+                }
+                lastHash = 14695981039346656037ULL;
+                for (const char* c = name; c < path + len; ++c) {
+                    lastHash ^= static_cast<unsigned char>(*c);
+                    lastHash *= 1099511628211ULL;
+                }
+                lastModule = module;
+            }
+            offsets[i] = reinterpret_cast<uintptr_t>(addrs[i]) - reinterpret_cast<uintptr_t>(module);
+            modules[i] = lastHash;
+        }
+    }
+
+    void moduleAddresses(void* const* addrs, int n, uintptr_t* offsets, uint64_t* modules, uint64_t* names)
+    {
+        // sem build-id, o nome do arquivo identifica o modulo
+        moduleOffsets(addrs, n, offsets, modules);
+        if (names) {
+            std::copy(modules, modules + n, names);
+        }
+    }
+
+    IStackAddresLoader* getFramePointerStackLoader()
+    {
+        return NULL;
+    }
+
+    IStackAddresLoader* getCfiStackLoader()
+    {
+        return NULL;
+    }
 }
@@ -29,7 +29,10 @@ unix {
     	    EXE_DEPS += $$BUILD_DIR/libexception_tests.a
 	    LIBS += -Wl,--whole-archive -lexception_tests -Wl,--no-whole-archive
 	}
-	LIBS += -lexception -Wl,--wrap,__cxa_throw -Wl,--wrap,__cxa_bad_cast
+	LIBS += -lexception -Wl,--wrap,__cxa_throw -Wl,--wrap,__cxa_bad_cast -Wl,--wrap,__gxx_personality_v0
+	linux {
+		LIBS += -Wl,--wrap,dlclose
+	}
 	bfd {
 		LIBS += -lbfd -ldl -lz -liberty
 	}
@@ -19,7 +19,7 @@ static const int STACK_DEPTH = 20;
 
 void level5(int* eff, Backtrace::StackFrame* stack, void** vstack)
 {
-	*eff = Backtrace::getPlatformStackLoader().getStack(STACK_DEPTH, stack);
+	*eff = Backtrace::getPlatformStackLoader().getStack(STACK_DEPTH, stack, 0);
 	GET_CURRENT_ADDR(vstack[0]);
 }
 
@@ -47,6 +47,13 @@ void level1(int* eff, Backtrace::StackFrame* stack, void** vstack)
 	GET_CURRENT_ADDR(vstack[4]);
 }
 
+// depois das funcoes level*, as linhas delas estao em testBacktraceDebugInfo
+#include <QThread>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
 BacktraceTest::BacktraceTest() :
 	QObject(NULL)
 {
@@ -77,6 +84,8 @@ void BacktraceTest::testBacktrace()
 
 	level1(&eff, middle, end);
 
+	Backtrace::loadSymbolNames(middle, eff);
+
 	for (int i = 0; i < eff; ++i) {
 		QVERIFY(middle[i].imageFile.empty() || QFile::exists(QString::fromStdString(middle[i].imageFile)));
 	}
@@ -119,6 +128,7 @@ void BacktraceTest::testBacktraceDebugInfo()
 
 	eff = std::min(eff, 5);
 
+	Backtrace::loadSymbolNames(middle, eff);
 	Backtrace::getPlatformDebugSymbolLoader().findDebugInfo(middle, eff);
 	QString executableName = qApp->applicationFilePath().split("/").back();
 
@@ -141,3 +151,933 @@ void BacktraceTest::testBacktraceDebugInfo()
 	}
 #endif
 }
+
+
+static void checkAlternativeLoader(Backtrace::IStackAddresLoader* loader)
+{
+	void* start[5];
+	Backtrace::StackFrame middle[STACK_DEPTH];
+	void* end[5];
+	int eff = 0;
+
+	start[0] = (void*)level5;
+	start[1] = (void*)level4;
+	start[2] = (void*)level3;
+	start[3] = (void*)level2;
+	start[4] = (void*)level1;
+
+	Backtrace::setStackLoader(loader);
+	level1(&eff, middle, end);
+	Backtrace::setStackLoader(NULL);
+
+	QVERIFY(eff >= 5);
+
+	for (int i = 0; i < 5; ++i) {
+		QVERIFY( start[i] <= middle[i].addr );
+		QVERIFY( middle[i].addr <= end[i] );
+	}
+}
+
+void BacktraceTest::testFramePointerBacktrace()
+{
+	Backtrace::IStackAddresLoader* loader = Backtrace::getFramePointerStackLoader();
+	if (loader == NULL) {
+		QSKIP("frame pointer unwinding not supported", SkipSingle);
+	}
+	checkAlternativeLoader(loader);
+}
+
+void BacktraceTest::testCfiBacktrace()
+{
+	Backtrace::IStackAddresLoader* loader = Backtrace::getCfiStackLoader();
+	if (loader == NULL) {
+		QSKIP("CFI unwinding not supported", SkipSingle);
+	}
+	// the second time the rules come from the cache
+	checkAlternativeLoader(loader);
+	checkAlternativeLoader(loader);
+}
+
+#ifndef _WIN32
+
+static Backtrace::IStackAddresLoader* signalLoader = NULL;
+static void* signalStack[STACK_DEPTH];
+static volatile int signalDepth = 0;
+
+static void captureOnSignal(int)
+{
+	signalDepth = signalLoader->getStackAddresses(STACK_DEPTH, signalStack, 0);
+}
+
+void raiseSignal(void** end)
+{
+	raise(SIGUSR1);
+	GET_CURRENT_ADDR(*end);
+}
+
+void BacktraceTest::testStackAddressesInSignalHandler()
+{
+	Backtrace::IStackAddresLoader* loaders[] = {
+		&Backtrace::getDefaultStackLoader(),
+		Backtrace::getFramePointerStackLoader(),
+		Backtrace::getCfiStackLoader()
+	};
+
+	Backtrace::initializeThread();
+	void (*previous)(int) = signal(SIGUSR1, captureOnSignal);
+
+	for (size_t l = 0; l < sizeof(loaders)/sizeof(loaders[0]); ++l) {
+		if (loaders[l] == NULL) {
+			continue;
+		}
+		signalLoader = loaders[l];
+		signalDepth = 0;
+		void* end = NULL;
+		raiseSignal(&end);
+
+		QVERIFY(signalDepth > 0);
+		// raise() nao mantem o frame pointer, entao esse loader pula o
+		// frame interrompido e so precisa ter passado pelo handler
+		bool found = (loaders[l] == Backtrace::getFramePointerStackLoader());
+		for (int i = 0; i < signalDepth; ++i) {
+			if ((void*)raiseSignal <= signalStack[i] && signalStack[i] <= end) {
+				found = true;
+			}
+		}
+		QVERIFY(found);
+	}
+
+	signal(SIGUSR1, previous);
+}
+
+#else
+
+void BacktraceTest::testStackAddressesInSignalHandler()
+{
+	QSKIP("no signals on windows", SkipSingle);
+}
+
+#endif
+
+void BacktraceTest::testCompactFrames()
+{
+	Backtrace::StackTrace* trace = Backtrace::trace(8);
+	std::vector<Backtrace::CompactFrame> captured = trace->rawFrames();
+
+	QVERIFY(!captured.empty());
+	for (size_t i = 0; i < captured.size(); ++i) {
+		QCOMPARE(captured[i].symbol, 0u);
+	}
+
+	std::vector<Backtrace::StackFrame>& frames = trace->getFrames();
+	QCOMPARE(frames.size(), captured.size());
+	QCOMPARE(frames[1].function, std::string("BacktraceTest::testCompactFrames()"));
+
+	// os ids ficam no trace, o mesmo endereco tem sempre o mesmo id
+	Backtrace::StackTrace* again = Backtrace::trace(8);
+	again->getFrames();
+	QVERIFY(again->rawFrames()[1].addr != trace->rawFrames()[1].addr);
+	QVERIFY(again->rawFrames()[2].symbol != 0);
+	QCOMPARE(again->rawFrames()[2].symbol, trace->rawFrames()[2].symbol);
+	// e o mesmo lugar no codigo
+	QCOMPARE(again->rawFrames()[2].module, trace->rawFrames()[2].module);
+	QCOMPARE(again->rawFrames()[2].offset, trace->rawFrames()[2].offset);
+
+	again->decreaseCount();
+	trace->decreaseCount();
+}
+
+namespace {
+	class SleepingThread : public QThread {
+	public:
+		SleepingThread() : m_stop(false) {}
+		void stop() { m_stop = true; }
+	protected:
+		void run() {
+			while (!m_stop) {
+				msleep(1);
+			}
+		}
+	private:
+		volatile bool m_stop;
+	};
+}
+
+void BacktraceTest::testSnapshotAllThreads()
+{
+	SleepingThread thread;
+	thread.start();
+
+	std::vector<Backtrace::ThreadStack> stacks = Backtrace::snapshotAllThreads();
+
+	thread.stop();
+	thread.wait();
+
+#ifndef _WIN32
+	QVERIFY(stacks.size() >= 2);
+#endif
+	bool foundSelf = false;
+	for (size_t i = 0; i < stacks.size(); ++i) {
+		QVERIFY(stacks[i].trace != NULL);
+		std::vector<Backtrace::StackFrame>& frames = stacks[i].trace->getFrames();
+		QVERIFY(!frames.empty());
+		for (size_t f = 0; f < frames.size(); ++f) {
+			if (frames[f].function == "BacktraceTest::testSnapshotAllThreads()") {
+				foundSelf = true;
+			}
+		}
+		stacks[i].trace->decreaseCount();
+	}
+	QVERIFY(foundSelf);
+}
+
+namespace {
+	void programHandler(int)
+	{
+	}
+}
+
+void BacktraceTest::testSnapshotKeepsProgramHandler()
+{
+#ifdef __linux__
+	const int signum = SIGRTMIN + 6;
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = programHandler;
+	sigemptyset(&action.sa_mask);
+	sigaction(signum, &action, NULL);
+	Backtrace::setSnapshotSignal(signum);
+
+	SleepingThread thread;
+	thread.start();
+	std::vector<Backtrace::ThreadStack> stacks = Backtrace::snapshotAllThreads();
+	thread.stop();
+	thread.wait();
+
+	Backtrace::setSnapshotSignal(SIGRTMIN + 3);
+	struct sigaction current;
+	sigaction(signum, NULL, &current);
+	action.sa_handler = SIG_DFL;
+	sigaction(signum, &action, NULL);
+
+	// o handler do programa nao foi trocado e so a thread corrente responde
+	QVERIFY(current.sa_handler == programHandler);
+	QVERIFY(stacks.size() >= 2);
+	int traces = 0;
+	for (size_t i = 0; i < stacks.size(); ++i) {
+		if (stacks[i].trace != NULL) {
+			QCOMPARE(stacks[i].threadId, Backtrace::currentThreadId());
+			stacks[i].trace->decreaseCount();
+			++traces;
+		}
+	}
+	QCOMPARE(traces, 1);
+#else
+	QSKIP("The snapshots use a signal only on linux", SkipSingle);
+#endif
+}
+
+void BacktraceTest::testFingerprint()
+{
+	Backtrace::StackTrace* traces[3];
+	for (int i = 0; i < 2; ++i) {
+		traces[i] = Backtrace::trace(8);
+	}
+	// outra linha, outro endereco de retorno
+	traces[2] = Backtrace::trace(8);
+
+	QVERIFY(traces[0]->fingerprint() != 0);
+	QCOMPARE(traces[0]->fingerprint(), traces[1]->fingerprint());
+	QVERIFY(traces[0]->fingerprint() != traces[2]->fingerprint());
+
+	std::vector<void*> addrs;
+	for (size_t i = 0; i < traces[0]->rawFrames().size(); ++i) {
+		addrs.push_back(traces[0]->rawFrames()[i].addr);
+	}
+	QCOMPARE(Backtrace::fingerprint(&addrs[0], addrs.size()), traces[0]->fingerprint());
+
+	for (int i = 0; i < 3; ++i) {
+		traces[i]->decreaseCount();
+	}
+}
+
+void BacktraceTest::testSkipFrames()
+{
+	// o mesmo ponto de chamada, o segundo sem o primeiro frame
+	Backtrace::StackTrace* traces[2];
+	for (int skip = 0; skip < 2; ++skip) {
+		traces[skip] = Backtrace::trace(8, skip);
+	}
+
+	const std::vector<Backtrace::CompactFrame>& all = traces[0]->rawFrames();
+	const std::vector<Backtrace::CompactFrame>& skipped = traces[1]->rawFrames();
+	QCOMPARE(skipped.size(), all.size());
+	for (size_t i = 0; i + 1 < all.size(); ++i) {
+		QCOMPARE(skipped[i].addr, all[i+1].addr);
+	}
+
+	traces[0]->decreaseCount();
+	traces[1]->decreaseCount();
+}
+
+static int markerLine = 0;
+
+// O endereco de uma instrucao e a linha dela
+static void* lineMarker()
+{
+	void* addr;
+	markerLine = __LINE__ + 1;
+	GET_CURRENT_ADDR(addr);
+	return addr;
+}
+
+void BacktraceTest::testDebugInfoLine()
+{
+	// pelo ponteiro volatile para nao ser inline
+	void* (* volatile marker)() = lineMarker;
+	void* addr = marker();
+	if (addr == (void*)~0) {
+		QSKIP("no instruction address on this platform", SkipSingle);
+	}
+
+	Backtrace::StackFrame frame;
+	// os loaders procuram o endereco - 1, como para um endereco de retorno
+	frame.addr = static_cast<char*>(addr) + 1;
+	Backtrace::loadSymbolNames(&frame, 1);
+	Backtrace::getPlatformDebugSymbolLoader().findDebugInfo(&frame, 1);
+
+	QCOMPARE(frame.function, "lineMarker()");
+#ifdef DEBUG
+	QString sourceFile = QString::fromStdString(frame.sourceFile);
+	QVERIFY(sourceFile.endsWith("unit_test/src/BacktraceTest.cpp"));
+	QCOMPARE(frame.line, markerLine);
+#endif
+}
+
+#ifdef __linux__
+#include <execinfo.h>
+#include <stdlib.h>
+#endif
+
+void BacktraceTest::testStaticFunctionName()
+{
+	void* (* volatile marker)() = lineMarker;
+	void* addr = marker();
+	if (addr == (void*)~0) {
+		QSKIP("no instruction address on this platform", SkipSingle);
+	}
+
+	Backtrace::StackFrame frame;
+	frame.addr = static_cast<char*>(addr) + 1;
+	Backtrace::loadSymbolNames(&frame, 1);
+	// lineMarker e static, so o .symtab tem o nome
+	QCOMPARE(frame.function, "lineMarker()");
+#ifdef __linux__
+	char** names = backtrace_symbols(&frame.addr, 1);
+	QVERIFY(names != NULL);
+	const std::string name = names[0];
+	free(names);
+	QVERIFY(name.find("lineMarker") == std::string::npos);
+#endif
+}
+
+#ifdef __linux__
+#include "Breadcrumbs.h"
+#include "CrashReportFormat.h"
+#include "Exception.h"
+#include "Logger.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+	/* Roda crash(fd) num processo filho, com fd na ponta de escrita de um
+	 * pipe, e devolve tudo o que foi escrito nele ate o filho terminar
+	 */
+	std::string runCrashingChild(void (*crash)(int fd), int* status)
+	{
+		int fds[2];
+		if (pipe(fds) != 0) {
+			return std::string();
+		}
+		const pid_t child = fork();
+		if (child == 0) {
+			// sem core dump
+			const struct rlimit noCore = { 0, 0 };
+			setrlimit(RLIMIT_CORE, &noCore);
+			close(fds[0]);
+			crash(fds[1]);
+			_exit(0);
+		}
+		close(fds[1]);
+		std::string output;
+		char buffer[4096];
+		ssize_t n;
+		while ((n = read(fds[0], buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR)) {
+			if (n > 0) {
+				output.append(buffer, n);
+			}
+		}
+		close(fds[0]);
+		waitpid(child, status, 0);
+		return output;
+	}
+
+	__attribute__((noinline)) int overflowStack(int n)
+	{
+		volatile char buffer[256];
+		buffer[0] = static_cast<char>(n);
+		return overflowStack(n + 1) + buffer[0];
+	}
+
+	void* overflowingThread(void*)
+	{
+		Backtrace::initializeThread();
+		overflowStack(1);
+		return NULL;
+	}
+
+	void overflowInThread(int fd)
+	{
+		Backtrace::initialize("exception_tests");
+		Backtrace::enableCrashReport(fd, false);
+		pthread_t thread;
+		pthread_create(&thread, NULL, overflowingThread, NULL);
+		pthread_join(thread, NULL);
+	}
+
+	int* volatile nullPointer = NULL;
+
+	__attribute__((noinline)) void crashHere()
+	{
+		*nullPointer = 1;
+	}
+
+	void crashWithTextReport(int fd)
+	{
+		Backtrace::initialize("exception_tests");
+		Backtrace::enableCrashReport(fd, false);
+		crashHere();
+	}
+
+	void crashWithSymbolizedReport(int fd)
+	{
+		Backtrace::initialize("exception_tests");
+		Backtrace::enableCrashReport(fd, true);
+		crashHere();
+	}
+
+	void crashWithBinaryReport(int fd)
+	{
+		Backtrace::initialize("exception_tests");
+		Backtrace::enableCrashReport(fd, false, Backtrace::CRASH_REPORT_BINARY);
+		Breadcrumbs::enable(true);
+		Log::LoggerFactory::getLogger("crash_test").log(Log::LERROR, "before the crash %1", 42);
+		crashHere();
+	}
+
+	struct DecodedReport {
+		bool complete;
+		int signal;
+		int modules;
+		std::vector<uint64_t> crashedStack;
+		std::vector<std::string> logLines;
+	};
+
+	// Le os registros do relatorio binario, false se o cabecalho esta errado
+	bool decodeReport(const std::string& data, DecodedReport* report)
+	{
+		report->complete = false;
+		report->signal = 0;
+		report->modules = 0;
+		CrashReport::Header header;
+		if (data.size() < sizeof(header)) {
+			return false;
+		}
+		memcpy(&header, data.data(), sizeof(header));
+		if (header.magic != CrashReport::MAGIC || header.version != CrashReport::VERSION) {
+			return false;
+		}
+		size_t pos = sizeof(header);
+		CrashReport::RecordHeader record;
+		while (pos + sizeof(record) <= data.size()) {
+			memcpy(&record, data.data() + pos, sizeof(record));
+			pos += sizeof(record);
+			if (pos + record.size > data.size()) {
+				break;
+			}
+			const char* payload = data.data() + pos;
+			pos += record.size;
+			if (record.type == CrashReport::RECORD_SIGNAL && record.size >= sizeof(CrashReport::SignalRecord)) {
+				CrashReport::SignalRecord signal;
+				memcpy(&signal, payload, sizeof(signal));
+				report->signal = signal.signo;
+			} else if (record.type == CrashReport::RECORD_MODULE) {
+				++report->modules;
+			} else if (record.type == CrashReport::RECORD_THREAD && record.size >= sizeof(CrashReport::ThreadRecord)) {
+				CrashReport::ThreadRecord thread;
+				memcpy(&thread, payload, sizeof(thread));
+				if (thread.crashed && record.size >= sizeof(thread) + thread.count*sizeof(uint64_t)) {
+					report->crashedStack.resize(thread.count);
+					if (thread.count > 0) {
+						memcpy(&report->crashedStack[0], payload + sizeof(thread), thread.count*sizeof(uint64_t));
+					}
+				}
+			} else if (record.type == CrashReport::RECORD_LOG_LINE && record.size >= sizeof(CrashReport::LogLineRecord)) {
+				CrashReport::LogLineRecord line;
+				memcpy(&line, payload, sizeof(line));
+				if (record.size >= sizeof(line) + line.textSize) {
+					report->logLines.push_back(std::string(payload + sizeof(line), line.textSize));
+				}
+			} else if (record.type == CrashReport::RECORD_END) {
+				report->complete = true;
+			}
+		}
+		return true;
+	}
+
+	// CRASH_READER ou o crash_reader no diretorio dos testes
+	std::string crashReaderPath()
+	{
+		const char* path = getenv("CRASH_READER");
+		if (path != NULL) {
+			return path;
+		}
+		char exe[4096];
+		const ssize_t size = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+		if (size <= 0) {
+			return std::string();
+		}
+		const std::string self(exe, size);
+		return self.substr(0, self.rfind('/') + 1) + "crash_reader";
+	}
+
+	void throwUnhandled(int fd)
+	{
+		ExceptionLib::init("exception_tests");
+		// o log do terminate vai para o stderr
+		dup2(fd, STDERR_FILENO);
+		throw std::runtime_error("unhandled in the child");
+	}
+
+	// O filho e uma copia do processo, os enderecos dele valem aqui
+	std::string functionAt(uintptr_t addr)
+	{
+		Backtrace::StackFrame frame;
+		frame.addr = reinterpret_cast<void*>(addr);
+		Backtrace::loadSymbolNames(&frame, 1);
+		return frame.function;
+	}
+}
+#endif
+
+void BacktraceTest::testStackOverflowInThread()
+{
+#ifdef __linux__
+	int status = 0;
+	const std::string report = runCrashingChild(overflowInThread, &status);
+
+	QVERIFY(WIFSIGNALED(status));
+	QCOMPARE(WTERMSIG(status), SIGSEGV);
+	QVERIFY(report.find("*** Crash: stack overflow, SIGSEGV") == 0);
+	QVERIFY(report.find("Stack:\n0x") != std::string::npos);
+#else
+	QSKIP("The crash report is written only on linux", SkipSingle);
+#endif
+}
+
+void BacktraceTest::testCrashReport()
+{
+#ifdef __linux__
+	int status = 0;
+	const std::string report = runCrashingChild(crashWithTextReport, &status);
+
+	QVERIFY(WIFSIGNALED(status));
+	QCOMPARE(WTERMSIG(status), SIGSEGV);
+	QVERIFY(report.find("*** Crash: SIGSEGV (11, code ") == 0);
+	QVERIFY(report.find("Maps:\n") != std::string::npos);
+	// o primeiro frame e a instrucao que falhou, sem os frames do handler
+	const size_t stack = report.find("Stack:\n");
+	QVERIFY(stack != std::string::npos);
+	const uintptr_t first = strtoull(report.c_str() + stack + strlen("Stack:\n"), NULL, 16);
+	QVERIFY(functionAt(first).find("crashHere") != std::string::npos);
+#else
+	QSKIP("The crash report is written only on linux", SkipSingle);
+#endif
+}
+
+void BacktraceTest::testSymbolizedCrashReport()
+{
+#ifdef __linux__
+	int status = 0;
+	// o pipe so fecha quando o simbolizador, filho do processo que falhou, termina
+	const std::string report = runCrashingChild(crashWithSymbolizedReport, &status);
+
+	QVERIFY(WIFSIGNALED(status));
+	QCOMPARE(WTERMSIG(status), SIGSEGV);
+	const size_t symbolized = report.find("Symbolized stack of ");
+	QVERIFY(symbolized != std::string::npos);
+	QVERIFY(report.find("Maps:\n") < symbolized);
+	QVERIFY(report.find("crashHere", symbolized) != std::string::npos);
+#else
+	QSKIP("The crash report is written only on linux", SkipSingle);
+#endif
+}
+
+void BacktraceTest::testBinaryCrashReport()
+{
+#ifdef __linux__
+	int status = 0;
+	const std::string data = runCrashingChild(crashWithBinaryReport, &status);
+
+	QVERIFY(WIFSIGNALED(status));
+	QCOMPARE(WTERMSIG(status), SIGSEGV);
+	DecodedReport report;
+	QVERIFY(decodeReport(data, &report));
+	QVERIFY(report.complete);
+	QCOMPARE(report.signal, static_cast<int>(SIGSEGV));
+	QVERIFY(report.modules > 0);
+	QVERIFY(!report.crashedStack.empty());
+	QVERIFY(functionAt(report.crashedStack[0]).find("crashHere") != std::string::npos);
+	// a ultima linha do log, ja formatada
+	QVERIFY(!report.logLines.empty());
+	QCOMPARE(report.logLines.back(), std::string("crash_test: before the crash 42"));
+
+	// o crash_reader decodifica o mesmo relatorio
+	const std::string reader = crashReaderPath();
+	if (reader.empty() || access(reader.c_str(), X_OK) != 0) {
+		QSKIP("crash_reader not found, set CRASH_READER", SkipSingle);
+	}
+	char fileName[] = "/tmp/crash_reportXXXXXX";
+	const int fd = mkstemp(fileName);
+	QVERIFY(fd >= 0);
+	const bool written = write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+	close(fd);
+	std::string output;
+	FILE* pipe = popen((reader + " --no-symbols " + fileName).c_str(), "r");
+	if (pipe != NULL) {
+		char buffer[4096];
+		size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+			output.append(buffer, n);
+		}
+		pclose(pipe);
+	}
+	unlink(fileName);
+
+	QVERIFY(written);
+	QVERIFY(output.find("Crash: SIGSEGV (11, ") == 0);
+	char first[64];
+	snprintf(first, sizeof(first), "#0  0x%016llx", static_cast<unsigned long long>(report.crashedStack[0]));
+	QVERIFY(output.find(first) != std::string::npos);
+	QVERIFY(output.find("Last log lines:") != std::string::npos);
+	QVERIFY(output.find("level 0 crash_test: before the crash 42") != std::string::npos);
+#else
+	QSKIP("The crash report is written only on linux", SkipSingle);
+#endif
+}
+
+void BacktraceTest::testEmergencyReport()
+{
+#ifdef __linux__
+	int fds[2];
+	QVERIFY(pipe(fds) == 0);
+	Backtrace::writeEmergencyReport(fds[1], "Fatal: emergency report test\n");
+	close(fds[1]);
+	std::string report;
+	char buffer[4096];
+	ssize_t n;
+	while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+		report.append(buffer, n);
+	}
+	close(fds[0]);
+
+	QVERIFY(report.find("Fatal: emergency report test\nStack:\n") == 0);
+	// uma linha do backtrace_symbols_fd() por frame
+	QVERIFY(report.find("[0x") != std::string::npos);
+
+	// o terminate libera a reserva e o log do relatorio passa
+	int status = 0;
+	const std::string unhandled = runCrashingChild(throwUnhandled, &status);
+	QVERIFY(WIFSIGNALED(status));
+	QCOMPARE(WTERMSIG(status), SIGABRT);
+	QVERIFY(unhandled.find("Unhandled exception") != std::string::npos);
+	QVERIFY(unhandled.find("unhandled in the child") != std::string::npos);
+#else
+	QSKIP("The report is tested only on linux", SkipSingle);
+#endif
+}
+
+namespace {
+	const int INTERNING_THREADS = 4;
+	const int INTERNS_PER_THREAD = 1000;
+
+	// Interna a mesma pilha varias vezes, conta os traces diferentes do esperado
+	class InterningThread : public QThread {
+	public:
+		InterningThread(void* const* addrs, int n, Backtrace::StackTrace* expected) :
+			m_addrs(addrs), m_n(n), m_expected(expected), m_mismatches(0) {}
+
+		int mismatches() const { return m_mismatches; }
+
+	protected:
+		void run() {
+			for (int i = 0; i < INTERNS_PER_THREAD; ++i) {
+				Backtrace::StackTrace* trace = Backtrace::internedTrace(m_addrs, m_n);
+				if (trace != m_expected) {
+					++m_mismatches;
+				}
+				trace->decreaseCount();
+			}
+		}
+
+	private:
+		void* const* m_addrs;
+		int m_n;
+		Backtrace::StackTrace* m_expected;
+		int m_mismatches;
+	};
+}
+
+void BacktraceTest::testInternedTraceAcrossThreads()
+{
+	// enderecos de retorno dentro das funcoes level*
+	void* addrs[] = {
+		reinterpret_cast<char*>(level5) + 1, reinterpret_cast<char*>(level4) + 1,
+		reinterpret_cast<char*>(level3) + 1, reinterpret_cast<char*>(level2) + 1
+	};
+	const int n = sizeof(addrs) / sizeof(addrs[0]);
+	Backtrace::StackTrace* first = Backtrace::internedTrace(addrs, n);
+	const unsigned hits = first->hits();
+
+	InterningThread* threads[INTERNING_THREADS];
+	for (int i = 0; i < INTERNING_THREADS; ++i) {
+		threads[i] = new InterningThread(addrs, n, first);
+		threads[i]->start();
+	}
+	int mismatches = 0;
+	for (int i = 0; i < INTERNING_THREADS; ++i) {
+		threads[i]->wait();
+		mismatches += threads[i]->mismatches();
+		delete threads[i];
+	}
+
+	// todas as threads receberam o mesmo trace e nenhum hit se perdeu
+	QCOMPARE(mismatches, 0);
+	QCOMPARE(first->hits(), hits + INTERNING_THREADS*INTERNS_PER_THREAD);
+	QCOMPARE(first->getFrames()[0].function, "level5(int*, Backtrace::StackFrame*, void**)");
+	first->decreaseCount();
+}
+
+#ifdef __linux__
+#include "Watchdog.h"
+
+namespace {
+	const int WATCHDOG_DEADLINE_MS = 100;
+	const int WATCHDOG_STALLS = 2;
+
+	// Alterna periodos com heartbeat e travamentos bem maiores que o prazo
+	class StallingThread : public QThread {
+	protected:
+		void run() {
+			Watchdog::registerThread("stalling");
+			for (int i = 0; i < WATCHDOG_STALLS; ++i) {
+				beat(150);
+				stallHere();
+			}
+			beat(150);
+			Watchdog::unregisterThread();
+		}
+
+	private:
+		void beat(int ms) {
+			for (int i = 0; i < ms; ++i) {
+				Watchdog::heartbeat();
+				msleep(1);
+			}
+		}
+
+		NOINLINE void stallHere() {
+			msleep(4*WATCHDOG_DEADLINE_MS);
+		}
+	};
+}
+#endif
+
+void BacktraceTest::testWatchdogReportsStalls()
+{
+#ifdef __linux__
+	Log::Logger& logger = Log::LoggerFactory::getLogger("watchdog_test");
+	// o output e dono do buffer
+	Log::LineBufferOutput* buffer = new Log::LineBufferOutput(16);
+	logger.changeNamedOutput(Log::Logger::output_ptr(buffer));
+	logger.changeLevel(Log::LWARN);
+
+	Watchdog::start(WATCHDOG_DEADLINE_MS, "watchdog_test");
+	StallingThread thread;
+	thread.start();
+	thread.wait();
+	Watchdog::stop();
+
+	std::vector<Log::LineBufferOutput::Line> lines(buffer->numLines());
+	buffer->readN(lines.size(), lines.begin());
+	logger.changeNamedOutput(Log::LoggerFactory::defaultOutput());
+
+	// um aviso por travamento, com a pilha da thread travada
+	QCOMPARE(static_cast<int>(lines.size()), WATCHDOG_STALLS);
+	for (size_t i = 0; i < lines.size(); ++i) {
+		const std::string line = lines[i].data();
+		QCOMPARE(lines[i].level(), Log::LWARN);
+		QVERIFY(line.find("(stalling) sent no heartbeat for") != std::string::npos);
+		QVERIFY(line.find("StallingThread::stallHere()") != std::string::npos);
+	}
+#else
+	QSKIP("The stalled threads are captured with a signal only on linux", SkipSingle);
+#endif
+}
+
+namespace {
+	class CapturingThread : public QThread {
+	public:
+		CapturingThread() : m_trace(NULL) {}
+		Backtrace::StackTrace* trace() const { return m_trace; }
+	protected:
+		void run() {
+			m_trace = Backtrace::trace(4);
+		}
+	private:
+		Backtrace::StackTrace* m_trace;
+	};
+}
+
+void BacktraceTest::testTracePool()
+{
+	// o ultimo trace solto e o proximo a ser reaproveitado
+	Backtrace::StackTrace* first = Backtrace::trace(4);
+	first->decreaseCount();
+	Backtrace::StackTrace* again = Backtrace::trace(4);
+	QVERIFY(again == first);
+
+	// um trace de outra thread e liberado, o pool continua com o desta
+	CapturingThread thread;
+	thread.start();
+	thread.wait();
+	again->decreaseCount();
+	thread.trace()->decreaseCount();
+	Backtrace::StackTrace* next = Backtrace::trace(4);
+	QVERIFY(next == first);
+	next->decreaseCount();
+}
+
+#ifdef USE_CXX11
+namespace {
+	volatile int lateReuse = -1;
+
+	// Solta o trace no fim da thread, depois do destrutor do pool
+	struct LateRelease {
+		Backtrace::StackTrace* trace;
+		LateRelease() : trace(NULL) {}
+		~LateRelease() {
+			const void* released = trace;
+			trace->decreaseCount();
+			// se o trace foi liberado, o bloco fica com a memoria dele e o
+			// proximo trace nao pode ter o mesmo endereco
+			void* block = ::operator new(sizeof(Backtrace::StackTrace));
+			Backtrace::StackTrace* next = Backtrace::trace(4);
+			lateReuse = (next == released) ? 1 : 0;
+			next->decreaseCount();
+			::operator delete(block);
+		}
+	};
+
+	class LateReleaseThread : public QThread {
+	protected:
+		void run() {
+			// construido antes do pool, destruido depois dele
+			thread_local LateRelease late;
+			late.trace = Backtrace::trace(4);
+		}
+	};
+}
+#endif
+
+void BacktraceTest::testTraceReleasedAfterPool()
+{
+#ifdef USE_CXX11
+	LateReleaseThread thread;
+	thread.start();
+	thread.wait();
+	QCOMPARE(static_cast<int>(lateReuse), 0);
+#else
+	QSKIP("The order of destruction of the pools is known only with thread_local", SkipSingle);
+#endif
+}
+
+void BacktraceTest::testInternedTraceRetainedByHits()
+{
+	void* addrs[2];
+	addrs[1] = reinterpret_cast<void*>(&level1);
+	// enche a tabela com stacks que aparecem uma vez so
+	for (int i = 0; i < 4096; ++i) {
+		addrs[0] = reinterpret_cast<char*>(&level5) + i;
+		Backtrace::internedTrace(addrs, 2)->decreaseCount();
+	}
+
+	addrs[0] = reinterpret_cast<void*>(&level3);
+	addrs[1] = reinterpret_cast<void*>(&level2);
+	Backtrace::StackTrace* hot = Backtrace::internedTrace(addrs, 2);
+	hot->decreaseCount();
+	// o stack que se repete ainda tem que estar na tabela
+	Backtrace::StackTrace* again = Backtrace::internedTrace(addrs, 2);
+	QVERIFY(again == hot);
+	QCOMPARE(again->hits(), 2u);
+	again->decreaseCount();
+}
+
+#include "SymbolCache.h"
+
+void BacktraceTest::testSymbolCacheKeepsFrameAddress()
+{
+	typedef BacktracePrivate::SymbolCache SymbolCache;
+	SymbolCache& cache = SymbolCache::instance();
+
+	// um offset que nenhum trace usa, no modulo do teste
+	const SymbolCache::Key key(SymbolCache::keyFor(reinterpret_cast<void*>(&level1)).module, ~static_cast<uintptr_t>(0) >> 1);
+	QVERIFY(key.module != 0);
+	Backtrace::StackFrame loaded;
+	loaded.addr = reinterpret_cast<void*>(&level1);
+	loaded.function = "cachedFunction()";
+	loaded.imageFile = "cachedImage";
+	loaded.sourceFile = "cached.cpp";
+	loaded.line = 42;
+	const uint32_t id = cache.intern(key, &loaded, SymbolCache::SymbolsLoaded);
+	QVERIFY(id != 0);
+	QCOMPARE(cache.find(key), id);
+
+	// o mesmo codigo visto em outro endereco absoluto
+	Backtrace::StackFrame frame;
+	frame.addr = reinterpret_cast<void*>(&level2);
+	QVERIFY(cache.fill(key, &frame, SymbolCache::SymbolsLoaded));
+	QVERIFY(frame.addr == reinterpret_cast<void*>(&level2));
+	QCOMPARE(frame.function, std::string("cachedFunction()"));
+	QCOMPARE(frame.imageFile, std::string("cachedImage"));
+	QCOMPARE(frame.sourceFile, std::string("cached.cpp"));
+	QCOMPARE(frame.line, 42);
+
+	Backtrace::StackFrame byId;
+	byId.addr = reinterpret_cast<void*>(&level3);
+	QVERIFY(cache.fill(id, &byId, SymbolCache::AddressLoaded));
+	QVERIFY(byId.addr == reinterpret_cast<void*>(&level3));
+	QCOMPARE(byId.function, std::string("cachedFunction()"));
+
+	// fora de qualquer modulo o offset e o endereco, nada e guardado
+	const SymbolCache::Key outside(0, reinterpret_cast<uintptr_t>(&level3));
+	QCOMPARE(cache.intern(outside, &loaded, SymbolCache::SymbolsLoaded), uint32_t(0));
+	QCOMPARE(cache.find(outside), uint32_t(0));
+	Backtrace::StackFrame missing;
+	QVERIFY(!cache.fill(outside, &missing, SymbolCache::NothingLoaded));
+}
@@ -13,6 +13,27 @@ public:
 private slots:
 	void testBacktrace();
 	void testBacktraceDebugInfo();
+	void testFramePointerBacktrace();
+	void testCfiBacktrace();
+	void testStackAddressesInSignalHandler();
+	void testCompactFrames();
+	void testSnapshotAllThreads();
+	void testSnapshotKeepsProgramHandler();
+	void testFingerprint();
+	void testSkipFrames();
+	void testDebugInfoLine();
+	void testStaticFunctionName();
+	void testStackOverflowInThread();
+	void testCrashReport();
+	void testSymbolizedCrashReport();
+	void testBinaryCrashReport();
+	void testEmergencyReport();
+	void testInternedTraceAcrossThreads();
+	void testWatchdogReportsStalls();
+	void testTracePool();
+	void testTraceReleasedAfterPool();
+	void testInternedTraceRetainedByHits();
+	void testSymbolCacheKeepsFrameAddress();
 };
 
 #endif // BACKTRACETEST_H
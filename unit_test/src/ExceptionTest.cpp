@@ -5,10 +5,13 @@
 #include "TestSuite.h"
 #include "Exception.h"
 #include "BackTrace.h"
+#include "Breadcrumbs.h"
+#include "Logger.h"
 #include <stdexcept>
 #include <exception>
 #include <cxxabi.h>
 
+#include <QThread>
 #include <QTime>
 #include <QtTest/QtTest>
 
@@ -62,6 +65,12 @@ void NOINLINE do_throw_2()
 	throw ExceptionLib::IOException("lalala");
 }
 
+// o mesmo tipo de do_throw_2, de outro site
+void NOINLINE do_throw_2_other_site()
+{
+	throw ExceptionLib::IOException("lelele");
+}
+
 void MyExceptionTest::testThrowExcept()
 {
 	try {
@@ -105,3 +114,317 @@ void MyExceptionTest::testThrowExcept()
 		QFAIL("ExceptionLib::Exception");
 	}
 }
+
+struct Cleanup {
+	~Cleanup() { std::cout << ""; }
+};
+
+void NOINLINE do_throw_3()
+{
+	Cleanup c;
+	throw std::logic_error("lalala");
+}
+
+void NOINLINE do_throw_3_cleanup()
+{
+	Cleanup c;
+	do_throw_3();
+}
+
+void MyExceptionTest::testThrowStdExceptUnwindMode()
+{
+	ExceptionLib::throwTraceMode(ExceptionLib::THROW_TRACE_UNWIND);
+	try {
+		do_throw_3_cleanup();
+		ExceptionLib::throwTraceMode(ExceptionLib::THROW_TRACE_WALK);
+		QFAIL("expected exception throw");
+	} catch(const std::exception& ex) {
+		ExceptionLib::throwTraceMode(ExceptionLib::THROW_TRACE_WALK);
+		size_t depth = 0;
+		const Backtrace::StackFrame* frames = ExceptionLib::getBT(ex, &depth);
+
+		// a funcao do throw, a do cleanup e a do catch
+		QCOMPARE(ExceptionLib::getUnwoundFrames(), 3);
+		QCOMPARE(depth, size_t(3));
+		QCOMPARE(frames[0].function, "do_throw_3()");
+		QCOMPARE(frames[1].function, "do_throw_3_cleanup()");
+		QCOMPARE(frames[2].function, "MyExceptionTest::testThrowStdExceptUnwindMode()");
+	}
+}
+
+void NOINLINE throw_deep(int levels)
+{
+	if (levels > 0) {
+		throw_deep(levels - 1);
+	}
+	throw ExceptionLib::IOException("deep");
+}
+
+void MyExceptionTest::testStacktraceDepth()
+{
+	ExceptionLib::stacktraceDepth<ExceptionLib::Exception>(6);
+	ExceptionLib::stacktraceDepth<ExceptionLib::IOException>(3);
+
+	QCOMPARE(ExceptionLib::stacktraceDepthFor(typeid(ExceptionLib::IOException)), 3);
+	QCOMPARE(ExceptionLib::stacktraceDepthFor(typeid(ExceptionLib::AbortException)), 6);
+
+	try {
+		throw_deep(10);
+		QFAIL("expected exception throw");
+	} catch(const ExceptionLib::Exception& ex) {
+		QCOMPARE(ex.stacktrace()->getFrames().size(), size_t(3));
+	}
+
+	ExceptionLib::stacktraceDepth<ExceptionLib::IOException>(0);
+	try {
+		throw_deep(10);
+		QFAIL("expected exception throw");
+	} catch(const ExceptionLib::Exception& ex) {
+		QVERIFY(ex.stacktrace() == NULL);
+	}
+
+	ExceptionLib::stacktraceDepth<ExceptionLib::IOException>(28);
+	ExceptionLib::stacktraceDepth<ExceptionLib::Exception>(28);
+}
+
+void MyExceptionTest::testInternedTrace()
+{
+	Backtrace::StackTrace* first = NULL;
+	unsigned hits = 0;
+
+	for (int i = 0; i < 3; ++i) {
+		try {
+			do_throw_2();
+		} catch(const ExceptionLib::Exception& ex) {
+			if (first == NULL) {
+				first = ex.stacktrace();
+				hits = first->hits();
+			} else {
+				// a mesma pilha, o mesmo trace
+				QVERIFY(ex.stacktrace() == first);
+				QCOMPARE(ex.stacktrace()->hits(), hits + i);
+			}
+		}
+	}
+	QCOMPARE(first->getFrames()[0].function, "do_throw_2()");
+}
+
+void NOINLINE throw_deep_invalid(int levels)
+{
+	if (levels > 0) {
+		throw_deep_invalid(levels - 1);
+	}
+	throw ExceptionLib::InvalidParameterException("deep");
+}
+
+void MyExceptionTest::testDepthPolicyAndSampling()
+{
+	// sem configuracao propria o tipo usa a da base mais proxima
+	ExceptionLib::stacktraceDepth<ExceptionLib::ProgrammingError>(5);
+	try {
+		throw_deep_invalid(10);
+	} catch(const ExceptionLib::Exception& ex) {
+		QCOMPARE(ex.stacktrace()->getFrames().size(), size_t(5));
+	}
+
+	// a profundidade ja resolvida para o tipo muda com a configuracao
+	ExceptionLib::stacktraceDepth<ExceptionLib::InvalidParameterException>(2);
+	QCOMPARE(ExceptionLib::stacktraceDepthFor(typeid(ExceptionLib::InvalidParameterException)), 2);
+
+	ExceptionLib::stacktraceSampling(5);
+	int traced = 0;
+	int untraced = 0;
+	for (int i = 0; i < 1000; ++i) {
+		try {
+			throw_deep_invalid(10);
+		} catch(const ExceptionLib::Exception& ex) {
+			if (ex.stacktrace()) {
+				QCOMPARE(ex.stacktrace()->getFrames().size(), size_t(2));
+				++traced;
+			} else {
+				// o throw nao amostrado ainda tem o trace id
+				QVERIFY(ex.traceId() != 0);
+				++untraced;
+			}
+		}
+	}
+	ExceptionLib::stacktraceSampling(0);
+	ExceptionLib::stacktraceDepth<ExceptionLib::InvalidParameterException>(28);
+	ExceptionLib::stacktraceDepth<ExceptionLib::ProgrammingError>(28);
+
+	QVERIFY(traced > 0);
+	QVERIFY(untraced > traced);
+}
+
+void MyExceptionTest::testStacktraceSampling()
+{
+	ExceptionLib::stacktraceSampling(10);
+
+	int traced = 0;
+	uint64_t lastId = 0;
+	for (int i = 0; i < 10000; ++i) {
+		try {
+			do_throw_2();
+		} catch(const ExceptionLib::Exception& ex) {
+			if (ex.stacktrace()) {
+				++traced;
+			}
+			QVERIFY(ex.traceId() > lastId);
+			lastId = ex.traceId();
+		}
+	}
+	ExceptionLib::stacktraceSampling(0);
+
+	// os primeiros sao sempre capturados
+	QVERIFY(traced > 0);
+	QVERIFY(traced < 1000);
+}
+
+void MyExceptionTest::testThrowSiteThrottling()
+{
+	ExceptionLib::throwSiteThrottling(100);
+
+	int full = 0;
+	int addressOnly = 0;
+	for (int i = 0; i < 1000; ++i) {
+		try {
+			do_throw_2();
+		} catch(const ExceptionLib::Exception& ex) {
+			QVERIFY(ex.stacktrace() != NULL);
+			if (ex.stacktrace()->rawFrames().size() == 1) {
+				++addressOnly;
+			} else {
+				++full;
+			}
+		}
+	}
+
+	std::vector<ExceptionLib::ThrowSiteStats> stats = ExceptionLib::throwSiteStats();
+	ExceptionLib::throwSiteThrottling(0);
+
+	QCOMPARE(full, 100);
+	QCOMPARE(addressOnly, 900);
+	QCOMPARE(stats.size(), size_t(1));
+	QCOMPARE(stats[0].throws, uint64_t(1000));
+	QVERIFY(stats[0].throttled);
+}
+
+void MyExceptionTest::testThrowSitesOfOneType()
+{
+	ExceptionLib::throwSiteThrottling(100);
+
+	void* site2 = NULL;
+	void* site3 = NULL;
+	for (int i = 0; i < 1000; ++i) {
+		try {
+			do_throw_2();
+		} catch(const ExceptionLib::Exception& ex) {
+			site2 = ex.stacktrace()->rawFrames()[0].addr;
+		}
+	}
+	for (int i = 0; i < 10; ++i) {
+		try {
+			do_throw_2_other_site();
+		} catch(const ExceptionLib::Exception& ex) {
+			// o site de do_throw_2 esta limitado, este nao
+			QVERIFY(ex.stacktrace()->rawFrames().size() > 1);
+			site3 = ex.stacktrace()->rawFrames()[0].addr;
+		}
+	}
+
+	std::vector<ExceptionLib::ThrowSiteStats> stats = ExceptionLib::throwSiteStats();
+	ExceptionLib::throwSiteThrottling(0);
+
+	QCOMPARE(stats.size(), size_t(2));
+	for (size_t i = 0; i < stats.size(); ++i) {
+		if (stats[i].site == site2) {
+			QCOMPARE(stats[i].throws, uint64_t(1000));
+			QVERIFY(stats[i].throttled);
+		} else {
+			QCOMPARE(stats[i].site, site3);
+			QCOMPARE(stats[i].throws, uint64_t(10));
+			QVERIFY(!stats[i].throttled);
+		}
+	}
+}
+
+namespace {
+	// Loga, lanca e loga de novo, e guarda os breadcrumbs da propria thread
+	class BreadcrumbThread : public QThread {
+	public:
+		BreadcrumbThread(const char* before, const char* after, bool stdException)
+			: before(before), after(after), stdException(stdException), site(NULL), n(0) {}
+
+		const char* before;
+		const char* after;
+		bool stdException;
+		void* site;
+		Breadcrumbs::Entry entries[Breadcrumbs::MAX_ENTRIES];
+		int n;
+
+	protected:
+		void run() {
+			Log::Logger& logger = Log::LoggerFactory::getLogger("breadcrumbs");
+			logger.log(Log::LDEBUG2, before, 1);
+			try {
+				if (stdException) {
+					do_throw_1();
+				} else {
+					do_throw_2();
+				}
+			} catch(const ExceptionLib::Exception& ex) {
+				site = ex.stacktrace()->rawFrames()[0].addr;
+			} catch(const std::exception& ex) {
+				size_t depth = 0;
+				const Backtrace::StackFrame* frames = ExceptionLib::getBT(ex, &depth, false);
+				site = depth > 0 ? frames[0].addr : NULL;
+			}
+			logger.log(Log::LDEBUG1, after);
+			n = Breadcrumbs::collect(entries, Breadcrumbs::MAX_ENTRIES);
+		}
+	};
+
+	void checkBreadcrumbs(const BreadcrumbThread& thread, const char* type)
+	{
+		QCOMPARE(thread.n, 3);
+		for (int i = 0; i < thread.n; ++i) {
+			// a sequencia e da thread, a outra thread nao aparece
+			QCOMPARE(thread.entries[i].sequence, uint32_t(i + 1));
+		}
+
+		const Breadcrumbs::Entry& before = thread.entries[0];
+		QCOMPARE(int(before.kind), int(Breadcrumbs::LOG));
+		QCOMPARE(int(before.level), int(Log::LDEBUG2));
+		QCOMPARE(std::string(before.text), std::string(thread.before));
+
+		const Breadcrumbs::Entry& exception = thread.entries[1];
+		QCOMPARE(int(exception.kind), int(Breadcrumbs::EXCEPTION));
+		QCOMPARE(std::string(exception.text), std::string(type));
+		QVERIFY(thread.site != NULL);
+		QCOMPARE(exception.site, thread.site);
+		QVERIFY(exception.nFrames > 1);
+		QCOMPARE(exception.frames[0], thread.site);
+		QVERIFY(Breadcrumbs::fingerprint(exception) != 0);
+
+		const Breadcrumbs::Entry& after = thread.entries[2];
+		QCOMPARE(int(after.kind), int(Breadcrumbs::LOG));
+		QCOMPARE(int(after.level), int(Log::LDEBUG1));
+		QCOMPARE(std::string(after.text), std::string(thread.after));
+	}
+}
+
+void MyExceptionTest::testBreadcrumbsOfTwoThreads()
+{
+	BreadcrumbThread first("first thread before %1", "first thread after", true);
+	BreadcrumbThread second("second thread before %1", "second thread after", false);
+
+	Breadcrumbs::enable(true);
+	first.start();
+	second.start();
+	first.wait();
+	second.wait();
+	Breadcrumbs::enable(false);
+
+	checkBreadcrumbs(first, typeid(std::logic_error).name());
+	checkBreadcrumbs(second, typeid(ExceptionLib::IOException).name());
+}
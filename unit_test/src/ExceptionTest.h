@@ -19,6 +19,14 @@ public:
 private slots:
 	void testThrowStdExcept();
 	void testThrowExcept();
+	void testThrowStdExceptUnwindMode();
+	void testStacktraceDepth();
+	void testInternedTrace();
+	void testDepthPolicyAndSampling();
+	void testStacktraceSampling();
+	void testThrowSiteThrottling();
+	void testThrowSitesOfOneType();
+	void testBreadcrumbsOfTwoThreads();
 
 };
 